@@ -0,0 +1,166 @@
+/*******************************************
+*
+* @file NTagBenchmark.hh
+*
+* @brief Defines NTagBenchmark.
+*
+********************************************/
+
+#ifndef NTAGBENCHMARK_HH
+#define NTAGBENCHMARK_HH 1
+
+#include <array>
+#include <vector>
+
+#include <TRandom3.h>
+
+#include "NTagMessage.hh"
+
+/********************************************************
+ * @brief The class for benchmarking NTag routines.
+ *
+ * This class generates synthetic events and measures
+ * the time taken by the optimized routines of NTag
+ * against the straightforward implementations they
+ * replace. Each benchmark also checks that the two
+ * implementations give the same results, and stops
+ * with an error message if they don't.
+ *
+ * No input file is needed; use `NTag -benchmark` to run.
+ * SK geometry is set with `geoset_` for benchmarks that
+ * need PMT positions.
+ *******************************************************/
+class NTagBenchmark
+{
+    public:
+        /**
+         * @brief Constructor of NTagBenchmark.
+         * @param nEvents Number of synthetic events to generate per benchmark.
+         * @param verbose #Verbosity.
+         */
+        NTagBenchmark(int nEvents=100, Verbosity verbose=pDEFAULT);
+        ~NTagBenchmark();
+
+        /**
+         * @brief Runs all benchmarks.
+         */
+        void Run();
+
+        /**
+         * @brief Benchmarks the sliding-window hit scan used in
+         * NTagEventInfo::SearchCaptureCandidates against
+         * building a time vector for every hit with ::GetVectorFromStartIndex.
+         */
+        void BenchmarkHitWindow();
+
+        /**
+         * @brief Benchmarks NTagToFTable::GetTRMS used in the grid search of
+         * NTagCandidate::MinimizeTRMS against ToF subtraction, sorting, and ::GetTRMS.
+         */
+        void BenchmarkTRMSKernel();
+
+        /**
+         * @brief Benchmarks the vertex-parallel NTagToFTable::GetTRMS used in
+         * NTagCandidate::GetTRMSOfGridPoints against the single-vertex kernel for each grid point.
+         */
+        void BenchmarkBatchedTRMS();
+
+        /**
+         * @brief Benchmarks the #mGRID mode of NTagCandidate::MinimizeTRMS against the grid search
+         * that sorts the ToF-subtracted hit times and takes ::GetTRMS at each grid point,
+         * and checks that \a "MinTRMS50_n" and the fit vertex are the same, bit by bit.
+         */
+        void BenchmarkNeutFitGrid();
+
+        /**
+         * @brief Benchmarks ::GetOpeningAngleStats against the loop over all hit triplets
+         * with \c TVector3 and ::GetOpeningAngle, for candidates with #NTagEventInfo::NHITSMX hits.
+         */
+        void BenchmarkOpeningAngleStats();
+
+        /**
+         * @brief Benchmarks ::GetBetaArray against the sum of Legendre polynomials over all hit pairs,
+         * for candidates with #NTagEventInfo::NHITSMX hits.
+         */
+        void BenchmarkBetaArray();
+
+        /**
+         * @brief Benchmarks the radix sort ::GetSortedIndex used in NTagEventInfo::SortToFSubtractedTQ
+         * against \c TMath::Sort, on the ToF-subtracted hit times of long AFT-like events.
+         */
+        void BenchmarkHitSort();
+
+        /**
+         * @brief Benchmarks ::GetSortedIndexOfBlocks used in NTagEventInfo::SortToFSubtractedTQ
+         * against ::GetSortedIndex of all hits, on long AFT-like events split into SHE and AFT blocks.
+         */
+        void BenchmarkBlockSort();
+
+        /**
+         * @brief Benchmarks the #mLM mode of NTagCandidate::MinimizeTRMS against the #mGRID mode,
+         * on 40-hit capture clusters with the default settings.
+         * Prints the distance between the two vertices and how often LM gets an equal or lower TRMS,
+         * and checks that LM does not end above the TRMS of its grid seed.
+         */
+        void BenchmarkNeutFitLM();
+
+        /**
+         * @brief Benchmarks the #mBNB mode of NTagCandidate::MinimizeTRMS against the #mGRID mode,
+         * on 40-hit capture clusters, and single hits, with the default settings.
+         * Checks that the fitted vertex and TRMS are the same, bit by bit.
+         */
+        void BenchmarkNeutFitPruned();
+
+        /**
+         * @brief Benchmarks NTagBonsaiPool::Fit against the O(n<sup>2</sup>) hit loop of \c bonsai.F
+         * on zeroed common blocks, followed by \c bonsai_fit. Checks that the BONSAI input hits
+         * of all PMTs and the fit results are the same, bit by bit.
+         */
+        void BenchmarkBonsaiHits();
+
+        /**
+         * @brief Benchmarks the fits of NTagBonsaiPool against NTagBonsaiPool::Fit in this process,
+         * with the run number changed after the pool processes are forked, and two threads sharing the pool.
+         * Checks that the fit results are the same, bit by bit.
+         */
+        void BenchmarkBonsaiPool();
+
+    private:
+        /**
+         * @brief Generates sorted hit times of a long AFT-like event:
+         * dark noise over 535 &mu;s with a few capture-like hit clusters.
+         * @param sortedT Output vector of sorted hit times. [ns]
+         * @param Q Output vector of charges [p.e.] corresponding to \p sortedT.
+         */
+        void GenerateAFTHits(std::vector<float>& sortedT, std::vector<float>& Q);
+
+        /**
+         * @brief Generates raw hits of a capture-like hit cluster from a random vertex in the tank.
+         * @param nHits Number of hits to generate.
+         * @param T Output vector of hit times [ns], with ToF from the vertex and a Gaussian jitter of 3 ns.
+         * @param cableID Output vector of hit PMT cable IDs corresponding to \p T.
+         */
+        void GenerateCaptureHits(int nHits, std::vector<float>& T, std::vector<int>& cableID);
+
+        /**
+         * @brief Fills grid points of the first iteration of NTagCandidate::MinimizeTRMS
+         * with the default search range.
+         * @param gridPoints Output vector of grid points. [cm]
+         */
+        void GetDefaultGridPoints(std::vector<std::array<float, 3>>& gridPoints);
+
+        /**
+         * @brief Prints the time per event for the reference and the new implementations.
+         * @param name Benchmark name.
+         * @param refTime Total time [sec] taken by the reference implementation.
+         * @param newTime Total time [sec] taken by the new implementation.
+         */
+        void PrintResult(const char* name, float refTime, float newTime);
+
+        int          fNEvents;
+        TRandom3     fRandom;
+
+        NTagMessage  msg;
+};
+
+#endif
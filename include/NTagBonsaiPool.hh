@@ -0,0 +1,190 @@
+/*******************************************
+*
+* @file NTagBonsaiPool.hh
+*
+* @brief Defines NTagBonsaiPool.
+*
+********************************************/
+
+#ifndef NTAGBONSAIPOOL_HH
+#define NTAGBONSAIPOOL_HH 1
+
+#include <condition_variable>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <semaphore.h>
+#include <sys/types.h>
+
+#include <skparmC.h>
+#include <skheadC.h>
+#include <skbadcC.h>
+
+#include "NTagMessage.hh"
+
+/******************************************
+* @brief BONSAI fit results of a capture
+* candidate, as returned by \c bonsai_fit.
+*******************************************/
+struct NTagBonsaiFit
+{
+    float energy, ///< Fitted energy. (\a "BSenergy") [MeV]
+          vx,     ///< X coordinate of the fitted vertex. (\a "bsvx") [cm]
+          vy,     ///< Y coordinate of the fitted vertex. (\a "bsvy") [cm]
+          vz,     ///< Z coordinate of the fitted vertex. (\a "bsvz") [cm]
+          t,      ///< Fitted capture time. (\a "BSReconCT") [ns]
+          good,   ///< Fit goodness. (\a "BSgood")
+          dirks,  ///< Direction KS. (\a "BSdirks")
+          patlik, ///< Pattern likelihood. (\a "BSpatlik")
+          ovaq;   ///< Ovaq. (\a "BSovaq")
+};
+
+/********************************************************
+ * @brief A pool of forked processes that run BONSAI fits.
+ *
+ * BONSAI keeps its state in Fortran common blocks, so a
+ * process can run one fit at a time. This class forks
+ * processes that inherit the BONSAI state initialized by
+ * \c bonsai_ini, and exchanges fit requests and results
+ * with them through shared memory.
+ *
+ * Each process has a ring of #DEPTH jobs in the shared
+ * memory. NTagBonsaiPool::Submit writes the hits of a
+ * candidate to a free job of the least busy process and
+ * returns at once, so that the calling process can go on
+ * while the fit runs. NTagBonsaiPool::GetFit waits for the
+ * result of a submitted job. Process-shared semaphores
+ * count the submitted and the fitted jobs of each process.
+ *
+ * Create the pool after \c bonsai_ini is called and before
+ * any thread is started, as the pool processes are forked.
+ * The pool can then be shared by threads, e.g., the worker
+ * threads of NTagIO.
+ *
+ * @see NTagEventInfo::SetCandidateFeatures
+ *******************************************************/
+class NTagBonsaiPool
+{
+    public:
+        /**
+         * @brief Constructor of NTagBonsaiPool. Forks the pool processes.
+         * @param nProcesses Number of pool processes.
+         * @param verbose #Verbosity.
+         */
+        NTagBonsaiPool(int nProcesses, Verbosity verbose=pDEFAULT);
+        /**
+         * @brief Destructor of NTagBonsaiPool. Stops and waits for the pool processes.
+         */
+        ~NTagBonsaiPool();
+
+        /**
+         * @brief Submits a BONSAI fit of the hits to a pool process.
+         * @details Waits for a fit to finish if all pool processes have #DEPTH jobs.
+         * The run state that BONSAI reads, \c skhead_ and \c skbadc_, is sent with the hits,
+         * so call this after the event is read, with NTagEventInfo::fFortranMutex locked if threads read events.
+         * @param isData \c true for data, \c false for MC.
+         * @param reconCT Reconstructed capture time. [ns]
+         * @param t Hit times. [ns]
+         * @param q Hit charges. [p.e.]
+         * @param cab Hit PMT cable IDs.
+         * @return ID of the job to get the fit with in NTagBonsaiPool::GetFit,
+         * or -1 if there are more than #MAXJOBHITS hits, in which case the fit is not submitted.
+         */
+        int Submit(bool isData, float reconCT,
+                    const std::vector<float>& t, const std::vector<float>& q, const std::vector<int>& cab);
+
+        /**
+         * @brief Gets the results of a fit submitted with NTagBonsaiPool::Submit, waiting until the fit is done.
+         * @param jobID The ID returned by NTagBonsaiPool::Submit.
+         * @param cpuTime If not \c NULL, set to the CPU time of the fit in the pool process. [s]
+         */
+        NTagBonsaiFit GetFit(int jobID, float* cpuTime=nullptr);
+
+        /**
+         * @brief Runs a BONSAI fit of the hits in this process.
+         * @details Sets the BONSAI input hits \c tisk, \c qisk and \c ihcab in the SK common blocks,
+         * merging the charges of hits on the same cable, and calls \c bonsai_fit.
+         * As in \c bonsai.F, the charges of the third and later hits on a cable are added to \c qisk(0),
+         * the word before \c qisk in the common block, which is \c mxqisk.
+         * The hits start from zero as in \c bonsai.F, but only the entries set by the last fit
+         * are cleared, in O(\p nHits), unless NTagBonsaiPool::SetHitsOverwritten is called.
+         * Must not run in two threads at a time. See NTagBonsaiPool::Submit for the parameters.
+         */
+        static NTagBonsaiFit Fit(bool isData, float reconCT, const float* t, const float* q, const int* cab, int nHits);
+
+        /**
+         * @brief Tells NTagBonsaiPool::Fit that the hits in the SK common blocks are overwritten,
+         * e.g., by \c skread, so that the next fit clears all of them.
+         */
+        static void SetHitsOverwritten();
+
+        /**
+         * @brief Gets the number of pool processes.
+         */
+        int GetNProcesses() const { return static_cast<int>(fPIDs.size()); }
+
+        static const int DEPTH      = 4;     ///< Number of jobs in the ring of each pool process.
+        static const int MAXJOBHITS = 20000; ///< Maximum number of hits of a job.
+
+    private:
+        /// @brief A fit request and its results, in shared memory.
+        struct Job
+        {
+            int           jobID;
+            int           isData;
+            float         reconCT;
+            int           nHits;           ///< Number of hits, or -1 to stop the pool process.
+            skhead_common header;          ///< \c skhead_ of the event, e.g., the run number.
+            skbadc_common badChannels;     ///< \c skbadc_ of the event, i.e., the bad channels of the run.
+            float         t[MAXJOBHITS];
+            float         q[MAXJOBHITS];
+            int           cab[MAXJOBHITS];
+            NTagBonsaiFit fit;
+            float         cpuTime;         ///< CPU time of the fit in the pool process. [s]
+        };
+
+        /// @brief The job ring of a pool process, in shared memory.
+        struct Channel
+        {
+            sem_t requested; ///< Number of submitted jobs not yet taken by the pool process.
+            sem_t done;      ///< Number of fitted jobs not yet received.
+            Job   jobs[DEPTH];
+        };
+
+        /**
+         * @brief The loop of each pool process: fits the submitted jobs in order until it is stopped.
+         * @param iProcess Index of the pool process.
+         */
+        void RunProcess(int iProcess);
+
+        /**
+         * @brief Waits for any fit to finish and saves its results to #fFits.
+         * @details One thread at a time waits for the pool processes, and the others wait for it,
+         * so a caller must check again if the fit it waits for is received.
+         * @param lock Lock on #fMutex, unlocked while waiting.
+         */
+        void ReceiveFit(std::unique_lock<std::mutex>& lock);
+
+        static bool fAreHitsOverwritten; ///< If \c true, NTagBonsaiPool::Fit clears all hits.
+
+        NTagMessage msg;
+
+        void*                        fSharedMemory;
+        std::size_t                  fSharedMemorySize;
+        sem_t*                       fAnyDone;   ///< Number of fitted jobs of all pool processes not yet received.
+        Channel*                     fChannels;  ///< Job rings of the pool processes.
+
+        std::vector<pid_t>           fPIDs;      ///< Process IDs of the pool processes.
+        std::vector<long>            fNSubmitted, ///< Number of jobs submitted to each pool process.
+                                     fNReceived;  ///< Number of fits received from each pool process.
+        std::vector<std::tuple<int, NTagBonsaiFit, float>> fFits; ///< Received fits not yet taken by NTagBonsaiPool::GetFit,
+                                                                   ///< with their job IDs and CPU times.
+        int                          fNextJobID;  ///< ID of the next submitted job.
+
+        std::mutex                   fMutex;       ///< Locked by the threads that submit and get fits.
+        std::condition_variable      fFitReceived; ///< Notified when a fit is received by NTagBonsaiPool::ReceiveFit.
+        bool                         fIsReceiving; ///< \c true if a thread waits for the pool processes.
+};
+
+#endif
@@ -68,6 +68,14 @@ float GetLegendreP(int i, float& x);
  */
 float GetTRMS(const std::vector<float>& T);
 
+/**
+ * @brief Same as ::GetTRMS of a vector, for an array of \p nHits hit times.
+ * @param T An array of PMT hit times. [ns]
+ * @param nHits Number of hits.
+ * @return The RMS value of \p T.
+ */
+float GetTRMS(const float* T, int nHits);
+
 /**
  * @brief Slice \c nElements elements from a given vector \c vec, starting from index \c startIndex.
  * @param vec A vector to slice.
@@ -102,6 +110,46 @@ std::vector<T> SliceVector(const std::vector<T>& vec, int startIndex, int nEleme
  */
 std::vector<float> GetVectorFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth);
 
+/******************************************
+* @brief A time window sliding over a sorted
+* hit-time vector.
+*
+* Holds the hit index range and the summed
+* charge of a window of width \p tWidth that
+* starts from a given hit. The window is moved
+* forward by SlideHitWindow, which only visits
+* each hit twice (once as it enters and once as
+* it leaves the window), so scanning all hits of
+* an event costs O(N) without any allocation.
+*
+* @see SlideHitWindow
+*******************************************/
+struct HitWindow
+{
+    int    startIndex; ///< Index of the first hit in the window.
+    int    endIndex;   ///< One past the index of the last hit in the window.
+    int    nHits;      ///< Number of hits in the window. Always equal to \c endIndex - \c startIndex.
+    double qSum;       ///< Summed charge [p.e.] of the hits in the window.
+
+    HitWindow(): startIndex(0), endIndex(0), nHits(0), qSum(0.) {}
+};
+
+/**
+ * @brief Moves \p window forward so that it starts from index \p startIndex, and updates
+ * its end index, number of hits, and summed charge.
+ * @details The window includes the hit at \p startIndex and all following hits whose time
+ * differences from it are smaller than \p tWidth, same as ::GetVectorFromStartIndex.
+ * \p startIndex must not decrease between successive calls with the same \p window.
+ * @param window The window to move. Default-constructed before the first call.
+ * @param sortedT A vector of PMT hit times. [ns] Must be sorted in ascending order!
+ * @param Q A vector of deposited charge. [p.e.] Each element of \p Q must correspond to the element of
+ * \p sortedT with the same index.
+ * @param startIndex The \p sortedT index of the first hit in the window.
+ * @param tWidth The width of the time window [ns].
+ */
+void SlideHitWindow(HitWindow& window, const std::vector<float>& sortedT, const std::vector<float>& Q,
+                    int startIndex, float tWidth);
+
 /**
  * @brief Gets number of hits within \p tWidth [ns] starting from index \p startIndex.
  * @param sortedT A vector of PMT hit times. [ns] Must be sorted in ascending order!
@@ -111,6 +159,50 @@ std::vector<float> GetVectorFromStartIndex(const std::vector<float>& sortedT, in
  */
 int GetNhitsFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth);
 
+/**
+ * @brief Gets the index one past the last hit within \p tWidth [ns] starting from index \p startIndex,
+ * by a binary search.
+ * @param sortedT A vector of PMT hit times. [ns] Must be sorted in ascending order!
+ * @param startIndex The \p T index of the first hit in a hit cluster or a capture candidate.
+ * @param tWidth The width of the time window [ns].
+ * @return The index one past the last hit within \p tWidth [ns] starting from index \p startIndex.
+ */
+int GetEndIndexFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth);
+
+/**
+ * @brief Gets the permutation that sorts hit times in ascending order.
+ * @details A stable LSD radix sort on the bits of the float times, in 3 passes of 11 bits.
+ * A pass is skipped if all times share its digit, and fewer than 64 hits are sorted by insertion.
+ * The buffers are reused between calls and nothing is allocated on the stack, so it is safe for
+ * long AFT windows with tens of thousands of hits.
+ * @param T An array of PMT hit times. [ns]
+ * @param nHits Number of hits.
+ * @param sortedIndex Output vector of size \p nHits, where \c T[sortedIndex[i]] is the i-th earliest hit time.
+ * Hits with equal times keep their input order.
+ */
+void GetSortedIndex(const float* T, int nHits, std::vector<int>& sortedIndex);
+
+/**
+ * @brief Same as ::GetSortedIndex, for hit times made of blocks that are each nearly sorted,
+ * such as the hits appended from consecutive triggers.
+ * @details Each block is sorted by insertion, while the hits move back by at most \p maxMeanDisplacement
+ * positions on average, or \p maxDisplacement positions for a single hit. Otherwise the block is not nearly
+ * sorted, and it is sorted with ::GetSortedIndex instead. The sorted blocks are then merged in order,
+ * where only the hits in the overlapping time range of the blocks move. The output is the same as
+ * ::GetSortedIndex of all hits.
+ * @param T An array of PMT hit times. [ns]
+ * @param nHits Number of hits.
+ * @param blockStart Indices of the first hit of each block, in ascending order. All hits are taken as
+ * one block if empty.
+ * @param sortedIndex Output vector of size \p nHits, where \c T[sortedIndex[i]] is the i-th earliest hit time.
+ * @param maxDisplacement Maximum number of positions a single hit may move in the insertion sort of a block.
+ * @param maxMeanDisplacement Maximum mean number of positions the hits may move in the insertion sort of a block.
+ * Beyond ~2, the insertion sort is slower than ::GetSortedIndex.
+ * @return Number of blocks that were sorted by insertion.
+ */
+int GetSortedIndexOfBlocks(const float* T, int nHits, const std::vector<int>& blockStart,
+                           std::vector<int>& sortedIndex, int maxDisplacement=64, int maxMeanDisplacement=2);
+
 /**
  * @brief Gets the summed charge [p.e.] of a hit cluster or a capture candidate, starting from
  * index \p startIndex within a time window with \p tWidth [ns].
@@ -136,7 +228,8 @@ float GetTRMSFromStartIndex(const std::vector<float>& sortedT, int startIndex, f
 
 /**
  * @brief Gets number of hits within \p tWidth [ns] whose center comes at time \p centerTime [ns].
- * @param T A vector of PMT hit times. [ns]
+ * Both edges of the window are inclusive.
+ * @param T A vector of PMT hit times. [ns] Must be sorted in ascending order!
  * @param centerTime The exact time [ns] to search for hits around.
  * @param tWidth The width of the time window [ns] to count hits within. \p centerTime comes in the center
  * of this \p tWidth.
@@ -144,29 +237,89 @@ float GetTRMSFromStartIndex(const std::vector<float>& sortedT, int startIndex, f
  */
 int GetNhitsFromCenterTime(const std::vector<float>& T, float centerTime, float tWidth);
 
+
+/******************************************
+* @brief Directions from a vertex to the hit
+* PMTs of a candidate.
+*
+* Unit vectors (in structure-of-arrays form),
+* distances, and the mean direction are computed
+* once per candidate and vertex, and shared by
+* the geometric feature functions:
+* ::GetMeanDirection, ::GetDWallInMeanDirection,
+* ::GetMeanAngleInMeanDirection, ::GetBetaArray,
+* and ::GetOpeningAngleStats.
+*******************************************/
+struct HitGeometry
+{
+    float vertex[3];                ///< Vertex coordinates. [cm]
+    std::vector<double> ux,         ///< X component of the unit vector from the vertex to each hit PMT.
+                        uy,         ///< Y component of the unit vector from the vertex to each hit PMT.
+                        uz;         ///< Z component of the unit vector from the vertex to each hit PMT.
+    std::vector<float> dist;        ///< Distance [cm] from the vertex to each hit PMT.
+    std::vector<double> angleUx,    ///< X component of the unit vector of each hit for ::GetOpeningAngleStats.
+                        angleUy,    ///< Y component of the unit vector of each hit for ::GetOpeningAngleStats.
+                        angleUz;    ///< Z component of the unit vector of each hit for ::GetOpeningAngleStats.
+                                    ///< The default weights are trained with the PMT lookup of the old triplet loop:
+                                    ///< PMT table entry \c PMTID[i-1], i.e., the PMT after the PMT of the previous hit,
+                                    ///< and entry 0 for the first hit, read from before the hit vector.
+    std::array<double, 3> meanDir;  ///< Unit vector of the mean direction, summed as by the old ::GetMeanDirection. Zero if there are no hits.
+
+    /**
+     * @brief Computes the hit directions from \p v.
+     * @param PMTID A vector of hit PMT cable IDs.
+     * @param v An array of vertex coordinates. [cm]
+     */
+    HitGeometry(const std::vector<int>& PMTID, const float v[3]);
+
+    /**
+     * @brief Computes the hit directions from \p v.
+     * @param PMTID An array of hit PMT cable IDs.
+     * @param nHits Number of hits.
+     * @param v An array of vertex coordinates. [cm]
+     */
+    HitGeometry(const int* PMTID, int nHits, const float v[3]);
+
+    /**
+     * @brief Constructs an empty HitGeometry, to be set by HitGeometry::Set.
+     */
+    HitGeometry() {}
+
+    /**
+     * @brief Recomputes the hit directions from \p v, reusing the allocated vectors.
+     * @param PMTID An array of hit PMT cable IDs.
+     * @param nHits Number of hits.
+     * @param v An array of vertex coordinates. [cm]
+     */
+    void Set(const int* PMTID, int nHits, const float v[3]);
+
+    /**
+     * @brief Gets the number of hits.
+     */
+    inline int GetNHits() const { return ux.size(); }
+};
+
 /**
- * @brief Calculates the mean direction of the hits.
- * @param vertex An array of vertex coordinates. [cm]
- * @param PMTID A vector of PMT cable IDs.
- * @return The \c TVector3 instance of the the averaged direction vector from \c vertex to each PMT.
+ * @brief Gets the mean direction of the hits.
+ * @param geometry Hit directions from a vertex.
+ * @return The \c TVector3 instance of the the averaged direction vector from the vertex to each PMT.
  */
-TVector3 GetMeanDirection(const std::vector<int>& PMTID, float vertex[3]);
+TVector3 GetMeanDirection(const HitGeometry& geometry);
 
 /**
  * @brief Calculates distance to the wall in the averaged direction from a vertex to hit PMTs.
- * @param vertex An array of vertex coordinates. [cm]
- * @param PMTID A vector of PMT cable IDs.
- * @return The distance to the wall in the averaged direction from \c vertex to each PMT.
+ * @param geometry Hit directions from a vertex.
+ * @return The distance to the wall in the averaged direction from the vertex to each PMT.
  */
-float GetDWallInMeanDirection(const std::vector<int>& PMTID, float vertex[3]);
+float GetDWallInMeanDirection(const HitGeometry& geometry);
 
 /**
  * @brief Calculates the mean angle in the averaged direction from a vertex to hit PMTs.
- * @param vertex An array of vertex coordinates. [cm]
- * @param PMTID A vector of PMT cable IDs.
- * @return The mean angle in the averaged direction from a vertex to hit PMTs.
+ * @details The angle to each hit is the \c acos of the dot product of two unit vectors.
+ * @param geometry Hit directions from a vertex.
+ * @return The mean angle [deg] in the averaged direction from a vertex to hit PMTs.
  */
-float GetMeanAngleInMeanDirection(const std::vector<int>& PMTID, float vertex[3]);
+float GetMeanAngleInMeanDirection(const HitGeometry& geometry);
 
 /**
  * @brief Calculates an opening angle given three unit vectors.
@@ -177,6 +330,22 @@ float GetMeanAngleInMeanDirection(const std::vector<int>& PMTID, float vertex[3]
  */
 float GetOpeningAngle(TVector3 uA, TVector3 uB, TVector3 uC);
 
+/**
+ * @brief Evaluate &beta;_i values of a hit cluster for i = 1...5 and return those in an array.
+ * @details &beta;_l is the mean of the Legendre polynomial P_l(cos&theta;_ij) over all pairs of hits,
+ * where &theta;_ij is the angle between the directions from the vertex to the two hit PMTs.
+ * Instead of looping over the pairs, the sum over pairs is taken from the spherical harmonic moments of
+ * the hit directions by the addition theorem, sum_ij P_l(u_i.u_j) = 4&pi;/(2l+1) sum_m |sum_i Y_lm(u_i)|^2,
+ * minus the terms with i = j. The moments are accumulated in double precision in one loop over the hits,
+ * so the cost is linear in the number of hits.
+ * @param geometry Hit directions from the photon emission vertex.
+ * @return An size-6 array of &beta; values. The i-th element of the returned array
+ * is the i-th &beta; value. The 0-th element is a dummy filled with 0.
+ * @see For the details of the &beta; values, see Eq. (5) of the SNO review article at
+ * <a href="https://arxiv.org/pdf/1602.02469.pdf">arXiv:1602.02469</a>.
+ */
+std::array<float, 6> GetBetaArray(const HitGeometry& geometry);
+
 /**
  * @brief Calculates the mean of the value distribution of the given vector.
  * @param vec The vector to calculate mean.
@@ -227,12 +396,21 @@ float GetSkew(const std::vector<T>& vec)
 }
 
 /**
- * @brief Calculates the mean, stdev, and skewness of opening angles from input vertex to given PMT positions.
- * @param PMTID A vector of hit PMT cable IDs.
- * @param vertex Input vertex.
- * @return A size-2 array of mean (element 0) and standard deviation (element 1).
+ * @brief Calculates the mean, median, stdev, and skewness of opening angles from input vertex to given PMT positions.
+ * @details An opening angle is defined by each triplet of hits, as in ::GetOpeningAngle.
+ * The distances between the unit vectors HitGeometry::angleUx, HitGeometry::angleUy and HitGeometry::angleUz
+ * are computed once per pair of hits,
+ * so each triplet costs one circumradius (4 triplets at a time with AVX2) and one \c asin.
+ * The median is found by partial sorting, and the other statistics in one pass.
+ * If \p maxTriplets is positive and smaller than the number of triplets, only \p maxTriplets
+ * triplets are sampled at random with a fixed seed. The statistical error of the mean is then
+ * about stdev/sqrt(\p maxTriplets), e.g., 0.1 degrees for 10<sup>5</sup> samples.
+ * @param geometry Hit directions from a vertex.
+ * @param maxTriplets Maximum number of triplets to use. 0 to use all triplets.
+ * @return A size-4 array of mean, median, standard deviation, and skewness (elements 0 to 3) [deg].
+ * All elements are 0 if there are less than 3 hits.
  */
-std::array<float, 4> GetOpeningAngleStats(const std::vector<int>& PMTID, float vertex[3]);
+std::array<float, 4> GetOpeningAngleStats(const HitGeometry& geometry, int maxTriplets=0);
 
 /**
  * @brief Returns particle name given a PDG encoding.
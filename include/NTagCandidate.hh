@@ -10,6 +10,7 @@
 #define NTAGCANDIDATE_HH 1
 
 #include <array>
+#include <bitset>
 #include <vector>
 
 #include "NTagMessage.hh"
@@ -26,29 +27,89 @@ enum ExtractionMode
     tNEUTFIT_RAW = 200  ///< Extract Neut-fit variables from raw hit times.
 };
 
+/******************************************
+* @brief The list of integer feature variables of a candidate.
+* @details Each entry is also the name of the branch in the \c ntvar tree,
+* and the name matched against NTagTMVAVariables. To add a variable, add an
+* entry here and set it with NTagCandidate::Set.
+* @see IVariable
+*******************************************/
+#define NTAG_INT_VARIABLES(X) \
+    X(CaptureType) X(CascadePass) X(N1300) X(N200) X(N200Raw) X(N50) X(NFitEval) X(NFitIter) X(NFitPruned) \
+    X(NHits) X(NHits_n) X(TrueCaptureID)
+
+/******************************************
+* @brief The list of float feature variables of a candidate.
+* @details Same as #NTAG_INT_VARIABLES, for float variables.
+* @see FVariable
+*******************************************/
+#define NTAG_FLOAT_VARIABLES(X) \
+    X(AngleMean) X(AngleMean_n) X(AngleMedian) X(AngleMedian_n) X(AngleSkew) X(AngleSkew_n) \
+    X(AngleStdev) X(AngleStdev_n) X(BSReconCT) X(BSdirks) X(BSenergy) X(BSgood) X(BSovaq) X(BSpatlik) \
+    X(Beta1) X(Beta1_n) X(Beta2) X(Beta2_n) X(Beta3) X(Beta3_n) X(Beta4) X(Beta4_n) X(Beta5) X(Beta5_n) \
+    X(DWall) X(DWallMeanDir) X(DWallMeanDir_n) X(DWall_n) X(MinTRMS30_n) X(MinTRMS50_n) X(QSum) \
+    X(ReconCT) X(ReconCT_n) X(TMVAOutput) X(TRMS) X(TRMS_n) X(TSpread) X(ThetaMeanDir) X(bonsai_nfit) \
+    X(bsvx) X(bsvy) X(bsvz) X(nvx) X(nvy) X(nvz) X(prompt_bonsai) X(prompt_nfit)
+
+#define NTAG_INT_VARIABLE_ENUM(name) i##name,
+#define NTAG_FLOAT_VARIABLE_ENUM(name) f##name,
+
+/******************************************
+* @brief Indices of integer feature variables, e.g., \c iNHits for \a "NHits".
+* @see #NTAG_INT_VARIABLES
+*******************************************/
+enum IVariable
+{
+    NTAG_INT_VARIABLES(NTAG_INT_VARIABLE_ENUM)
+    nIVariables ///< Number of integer feature variables.
+};
+
+/******************************************
+* @brief Indices of float feature variables, e.g., \c fTRMS for \a "TRMS".
+* @see #NTAG_FLOAT_VARIABLES
+*******************************************/
+enum FVariable
+{
+    NTAG_FLOAT_VARIABLES(NTAG_FLOAT_VARIABLE_ENUM)
+    nFVariables ///< Number of float feature variables.
+};
+
+#undef NTAG_INT_VARIABLE_ENUM
+#undef NTAG_FLOAT_VARIABLE_ENUM
+
 class NTagEventInfo;
+class NTagBonsaiPool;
+struct NTagBonsaiFit;
+struct HitGeometry;
 
 /********************************************************
  * @brief The class representing a neutron capture
  * candidate.
  *
- * The vectors of TQ information that are
- * extracted in NTagEventInfo::SearchCaptureCandidates
- * are input to this class via NTagCandidate::SetHitInfo
- * and all relevant feature variables are calculated
- * within this class using its member functions.
+ * The hits of a candidate found in
+ * NTagEventInfo::SearchCaptureCandidates are input to
+ * this class via NTagCandidate::SetHitInfo, and all
+ * relevant feature variables are calculated within
+ * this class using its member functions.
  *
- * The hit information are saved in #vHitRawTimes,
- * #vHitResTimes, #vHitChargePE, #vHitCableIDs, and
- * #vHitSigFlags. Feature variables that are extracted
- * by NTagCandidate::SetVariables are saved in #iVarMap
- * if the variable is integer and #fVarMap if the
- * variable is float. These variable containers are of
- * type IVarMap and FVarMap, which are basically maps
- * from C++ STL.
+ * The hits are not copied: a candidate only keeps the
+ * index range [#firstHitID, #firstHitID + #nHits) of
+ * its hits in the sorted hit vectors of the event,
+ * i.e., NTagEventInfo::vSortedT_ToF,
+ * NTagEventInfo::vSortedQ,
+ * NTagEventInfo::vSortedPMTID, and
+ * NTagEventInfo::vSortedSigFlag, which stay unchanged
+ * until the event is cleared. Feature variables that are extracted
+ * by NTagCandidate::SetVariables are saved in #iVars
+ * if the variable is integer and #fVars if the
+ * variable is float. These are flat arrays indexed by
+ * IVariable and FVariable, so that setting or getting
+ * a variable does not look up its name. The names are
+ * only used when the branches and the TMVA variables
+ * are bound. (See #NTAG_INT_VARIABLES.)
  *
- * All variables initialized in these maps are
- * automatically pushed to
+ * All variables set in the first candidate of a run
+ * are automatically pushed to
  * NTagEventInfo::iCandidateVarMap and
  * NTagEventInfo::fCandidateVarMap via
  * NTagEventInfo::SetCandidateVariables,
@@ -84,29 +145,119 @@ class NTagCandidate
         //////////////////////////////////////////////
 
         /**
-         * @brief Copies input vectors to private member vectors:
-         * #vHitResTimes, #vHitChargePE, #vHitCableIDs, and #vHitSigFlags.
-         * @param rawT A vector of raw PMT hit times. [ns]
-         * @param resT A vector of residual (ToF-subtracted) PMT hit times. [ns]
-         * @param Q A vector of PMT deposit charge in p.e.
-         * @param I A vector of hit PMT cable IDs.
-         * @param sigF A vector of hit signal flags. (0: bkg, 1: sig)
+         * @brief Sets the hits of the candidate.
+         * @param firstHit The index of the first hit of the candidate in NTagEventInfo::vSortedT_ToF.
+         * @param nCandidateHits Number of hits of the candidate.
+         */
+        void SetHitInfo(int firstHit, int nCandidateHits) { firstHitID = firstHit; nHits = nCandidateHits; }
+
+        /**
+         * @brief Gets the residual (ToF-subtracted) hit times [ns] of the candidate. [Size: #nHits]
+         */
+        const float* GetHitResTimes() const;
+
+        /**
+         * @brief Gets the deposited charge [p.e.] of the hits of the candidate. [Size: #nHits]
+         */
+        const float* GetHitChargePE() const;
+
+        /**
+         * @brief Gets the cable IDs of the hits of the candidate. [Size: #nHits]
+         */
+        const int* GetHitCableIDs() const;
+
+        /**
+         * @brief Gets the signal flags (0: bkg, 1: sig) of the hits of the candidate. [Size: #nHits]
+         * @return \c nullptr if the input file has no signal flags.
+         */
+        const int* GetHitSigFlags() const;
+
+        /**
+         * @brief Gets the raw hit time [ns] of a hit of the candidate.
+         * @param iHit The index of the hit within the candidate, from 0 to #nHits-1.
          */
-        void SetHitInfo(const std::vector<float>& rawT,
-                        const std::vector<float>& resT,
-                        const std::vector<float>& Q,
-                        const std::vector<int>& I,
-                        const std::vector<int>& sigF);
+        float GetHitRawTime(int iHit) const;
 
         /**
-         * @brief Set feature variables in #iVarMap and #fVarMap.
-         * @details Called inside NTagEventInfo::SavePeakFromHit which is called in
-         * NTagEventInfo::SearchCaptureCandidates. Calls other setter functions,
-         * i.e., NTagCandidate::SetVariablesForMode, NTagCandidate::SetTrueInfo,
-         * NTagCandidate::SetNNVariables, NTagCandidate::SetTMVAOutput.
+         * @brief Gets the reconstructed capture time [ns], the mean of the first and the last residual hit times.
+         * @details Same as \a "ReconCT", but available before NTagCandidate::SetFeatureVariables.
+         */
+        float GetReconCT() const;
+
+        /**
+         * @brief Set feature variables in #iVars and #fVars.
+         * @details Calls NTagCandidate::SetFeatureVariables, NTagCandidate::SetFortranVariables,
+         * NTagCandidate::SetNNVariables and NTagCandidate::SetTMVAOutput in order.
+         * NTagEventInfo::SetCandidateFeatures calls them itself, so as to lock
+         * NTagEventInfo::fFortranMutex for NTagCandidate::SetFortranVariables only.
          */
         void SetVariables();
 
+        /**
+         * @brief Set the cheap feature variables used by the cascade, i.e., \a "NHits", \a "N200", \a "TRMS",
+         * \a "QSum", \a "ReconCT", \a "TSpread", and \a "Beta1" to \a "Beta5" at the prompt vertex.
+         * @details NTagCandidate::SetFeatureVariables calls this function unless the variables are already set.
+         * @see NTagEventInfo::ApplyCascade
+         */
+        void SetCascadeVariables();
+
+        /**
+         * @brief Set the variables of a candidate rejected by the cascade, instead of the expensive stages.
+         * @details Sets the true capture info with NTagCandidate::SetTrueInfo for MC, and -9999 to
+         * the other variables flagged in \p iMask and \p fMask that are not set yet, including \a "TMVAOutput".
+         * @param iMask Flags of the integer variables to set.
+         * @param fMask Flags of the float variables to set.
+         */
+        void SetCascadeRejectedVariables(const std::bitset<nIVariables>& iMask,
+                                         const std::bitset<nFVariables>& fMask);
+
+        /**
+         * @brief Gets the variables that a candidate not rejected by the cascade sets with the settings of \p event,
+         * i.e., in NTagCandidate::SetFeatureVariables, NTagCandidate::SetFortranVariables and
+         * NTagCandidate::SetTMVAOutput. Keep in sync with the variables these functions set.
+         * @param event The event whose settings, e.g., NTagEventInfo::bUseNeutFit, select the variables.
+         * @param iMask Output flags of the integer variables.
+         * @param fMask Output flags of the float variables.
+         * @see NTagEventInfo::ApplyCascade
+         */
+        static void GetFeatureVariableMask(const NTagEventInfo& event, std::bitset<nIVariables>& iMask,
+                                           std::bitset<nFVariables>& fMask);
+
+        /**
+         * @brief Checks if the candidate is rejected by the cascade, so that the expensive stages are skipped.
+         */
+        inline bool IsCascadeRejected() const { return bCascadeRejected; }
+
+        /**
+         * @brief Set the feature variables computed in C++ only, including the Neut-fit variables.
+         * @details Reads the event only, so that it can run for many candidates in parallel.
+         * Calls NTagCandidate::SetVariablesForMode for Neut-fit, and NTagCandidate::SetTrueInfo.
+         */
+        void SetFeatureVariables();
+
+        /**
+         * @brief Set the feature variables that need SK Fortran routines, i.e., \a "DWall", \a "DWall_n",
+         * and the BONSAI variables from NTagCandidate::SetVariablesForMode.
+         * @details BONSAI keeps its state in Fortran common blocks, so this function must not run
+         * in two threads at a time. Call after NTagCandidate::SetFeatureVariables.
+         * @param fit BONSAI fit results from a NTagBonsaiPool. If \c nullptr, BONSAI is run in this process.
+         */
+        void SetFortranVariables(const NTagBonsaiFit* fit=nullptr);
+
+        /**
+         * @brief Submits the hits in the BONSAI window to a pool process, and sets \a "N1300".
+         * @details Pass the results of NTagBonsaiPool::GetFit to NTagCandidate::SetFortranVariables.
+         * @param pool The NTagBonsaiPool to submit the fit to.
+         * @return The job ID of the fit, or -1 if the fit is not submitted. @see NTagBonsaiPool::Submit
+         */
+        int SubmitBonsaiFit(NTagBonsaiPool& pool);
+
+        /**
+         * @brief Sets the BONSAI variables, i.e., \a "BSenergy", \a "bsvx", \a "BSgood", etc., from BONSAI fit results.
+         * @param fit BONSAI fit results.
+         */
+        void SetBonsaiVariables(const NTagBonsaiFit& fit);
+
         /**
          * @brief Set feature variables within given time window \c tWindow.
          * @details The input parameter \c tWindow serves as a mode for setting variables.
@@ -147,30 +298,86 @@ class NTagCandidate
         ///////////////////////
 
         /**
-         * @brief Dump raw hit info, i.e., #vHitResTimes, #vHitChargePE, #vHitCableIDs, and #vHitSigFlags.
+         * @brief Dump raw hit info, i.e., raw and residual hit times, charge, cable IDs, and signal flags.
          */
         void DumpHitInfo();
 
         /**
-         * @brief Dump all feature variables stored in #iVarMap and #fVarMap.
+         * @brief Dump all feature variables set in #iVars and #fVars.
          */
         void DumpVariables();
 
 
-        //////////////////////////
-        // Calculator functions //
-        //////////////////////////
+        ////////////////////////////////////////
+        // Accessors of the feature variables //
+        ////////////////////////////////////////
+
+        /**
+         * @brief Sets an integer feature variable.
+         * @param key Index of the variable.
+         * @param value Value of the variable.
+         */
+        inline void Set(IVariable key, int value) { iVars[key] = value; iVarIsSet[key] = true; }
 
         /**
-         * @brief Evaluate &beta;_i values of a hit cluster for i = 1...5 and return those in an array.
-         * @param PMTID A vector of PMT cable IDs. The locations of the PMTs are fetched from #PMTXYZ.
-         * @param v A 3D array of float that represents the SK coordinates of photon emission vertex.
-         * @return An size-6 array of &beta; values. The i-th element of the returned array
-         * is the i-th &beta; value. The 0-th element is a dummy filled with 0.
-         * @see For the details of the &beta; values, see Eq. (5) of the SNO review article at
-         * <a href="https://arxiv.org/pdf/1602.02469.pdf">arXiv:1602.02469</a>.
+         * @brief Sets a float feature variable.
+         * @param key Index of the variable.
+         * @param value Value of the variable.
          */
-        std::array<float, 6> GetBetaArray(const std::vector<int>& PMTID, float v[3]);
+        inline void Set(FVariable key, float value) { fVars[key] = value; fVarIsSet[key] = true; }
+
+        /**
+         * @brief Gets an integer feature variable.
+         * @param key Index of the variable.
+         * @return The value of the variable, or 0 if it is not set.
+         */
+        inline int Get(IVariable key) const { return iVars[key]; }
+
+        /**
+         * @brief Gets a float feature variable.
+         * @param key Index of the variable.
+         * @return The value of the variable, or 0 if it is not set.
+         */
+        inline float Get(FVariable key) const { return fVars[key]; }
+
+        /**
+         * @brief Gets the address of an integer feature variable, to be filled by a Fortran routine.
+         * @param key Index of the variable.
+         * @note The variable is marked as set.
+         */
+        inline int* GetAddress(IVariable key) { iVarIsSet[key] = true; return &iVars[key]; }
+
+        /**
+         * @brief Gets the address of a float feature variable, to be filled by a Fortran routine.
+         * @param key Index of the variable.
+         * @note The variable is marked as set.
+         */
+        inline float* GetAddress(FVariable key) { fVarIsSet[key] = true; return &fVars[key]; }
+
+        /**
+         * @brief Checks if an integer feature variable is set.
+         */
+        inline bool IsSet(IVariable key) const { return iVarIsSet[key]; }
+
+        /**
+         * @brief Checks if a float feature variable is set.
+         */
+        inline bool IsSet(FVariable key) const { return fVarIsSet[key]; }
+
+        /**
+         * @brief Gets the name of an integer feature variable, e.g., \a "NHits" for \c iNHits.
+         */
+        static const char* GetName(IVariable key) { return iVariableNames[key]; }
+
+        /**
+         * @brief Gets the name of a float feature variable, e.g., \a "TRMS" for \c fTRMS.
+         */
+        static const char* GetName(FVariable key) { return fVariableNames[key]; }
+
+
+        //////////////////////////
+        // Calculator functions //
+        //////////////////////////
 
       /**
          * @brief Gets the minimum RMS value of hit-times by searching for the minizing vertex.
@@ -180,27 +387,127 @@ class NTagCandidate
          * @return The RMS value of the extracted hit cluster from the input hit-tme vector \p T.
          * \p fitVertex is also returned as the coordinates of the TRMS minimizing vertex of \p T.
          * @note The input hit-time vector must not have ToF subtracted as ToF will be subtracted inside this function.
+         * In the #mLM and #mBNB modes, \a "NFitIter" and \a "NFitEval" are also set.
          */
         float MinimizeTRMS(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3]);
 
+        /**
+         * @brief Searches for the TRMS-minimizing vertex with a nested grid.
+         * @details The grid starts from the tank center with a 500 cm width (or half of
+         * #NTagEventInfo::VTXSRCRANGE if it is smaller than 200 cm), and the grid width is halved
+         * at each level around the TRMS-minimizing point until it gets smaller than
+         * #NTagEventInfo::MINGRIDWIDTH. All grid points of a level are evaluated at once with
+         * NTagCandidate::GetTRMSOfGridPoints.
+         * @param T A vector of PMT hit times. [ns]
+         * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
+         * @param fitVertex The array to have minimizing vertex coordinates filled.
+         * @param maxLevels Maximum number of grid levels to search.
+         * @return The minimum TRMS [ns] found.
+         */
+        float SearchTRMSGrid(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3],
+                             int maxLevels);
+
+        /**
+         * @brief Gets TRMS at the vertex found by the grid search as the grid search took it before
+         * the single-pass NTagToFTable::GetTRMS: ::GetTRMS of the sorted ToF-subtracted hit times.
+         * @details The kernel rounds differently, so its minimum is recomputed once per fit to keep
+         * \a "MinTRMS50_n" and \a "MinTRMS30_n" the same as before.
+         * @param T A vector of PMT hit times. [ns]
+         * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
+         * @param fitVertex The vertex found by the grid search.
+         * @param minTRMS The minimum TRMS [ns] returned by the grid search.
+         * @return TRMS [ns] at \p fitVertex, or \p minTRMS if there are less than two hits.
+         */
+        float GetGridFitTRMS(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3],
+                             float minTRMS);
+
+        /**
+         * @brief Gets TRMS of the hits at many grid points.
+         * @details Grid points with a table row use the ToF table of NTagEventInfo::fGridToFTable,
+         * and the others are evaluated in batches with the vertex-parallel NTagToFTable::GetTRMS.
+         * @param T A vector of PMT hit times. [ns]
+         * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
+         * @param points Grid point coordinates [cm], 3 per grid point.
+         * @param rows Table rows of the grid points from NTagGridToFTable::GetRow, or -1 if not tabulated.
+         * @param tRMS Output vector of TRMS [ns] at each grid point.
+         */
+        void GetTRMSOfGridPoints(const std::vector<float>& T, const std::vector<int>& PMTID,
+                                 const std::vector<float>& points, const std::vector<int>& rows,
+                                 std::vector<float>& tRMS);
+
+        /**
+         * @brief Same as NTagCandidate::SearchTRMSGrid, but skips blocks of grid points that cannot
+         * improve the minimum TRMS.
+         * @details Grid points of each level are grouped in blocks of 3x3x3 points. All points in a block
+         * are within \c d = \c gridWidth*sqrt(3) from the block center, so each ToF differs from that of
+         * the center by at most \c d/C_WATER, and the TRMS of any point in the block is at least
+         * TRMS(center) - (\c d/C_WATER)*sqrt(NHits/(NHits-1)). Blocks are visited in the order of this
+         * lower bound, and blocks whose lower bound (with a margin for rounding) is above the current
+         * minimum are skipped. Ties are broken by the loop order of NTagCandidate::SearchTRMSGrid,
+         * so the returned vertex and TRMS are the same as the exhaustive search.
+         * @param T A vector of PMT hit times. [ns]
+         * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
+         * @param fitVertex The array to have minimizing vertex coordinates filled.
+         * @return The minimum TRMS [ns] found.
+         */
+        float SearchTRMSGridPruned(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3]);
+
+        /**
+         * @brief Minimizes TRMS with the Levenberg-Marquardt algorithm from a seed vertex.
+         * @details The residuals are the ToF-subtracted hit times minus their mean, whose sum of squares
+         * is (NHits-1) TRMS^2. Their Jacobian with respect to the vertex is analytic: the derivative of the
+         * ToF-subtracted time of a hit is (PMT position - vertex) / (C_WATER * distance), minus its mean over
+         * all hits. Steps that leave the tank or #NTagEventInfo::VTXSRCRANGE from the tank center are rejected.
+         * @param T A vector of PMT hit times. [ns]
+         * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
+         * @param fitVertex The seed vertex as input, and the minimizing vertex as output.
+         * @return The minimum TRMS [ns] found.
+         */
+        float MinimizeTRMSWithLM(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3]);
+
     private:
+        /**
+         * @brief Gets the raw hits within the time window \p tWindow around the reconstructed capture time.
+         * @param tWindow Time window mode. See NTagCandidate::SetVariablesForMode for the window edges.
+         * @param cabiz Output vector of the PMT cable IDs of the hits.
+         * @param tiskz Output vector of the raw hit times. [ns]
+         * @param qiskz Output vector of the hit charges. [p.e.]
+         */
+        void GetRawHitsInWindow(ExtractionMode tWindow, std::vector<int>& cabiz,
+                                std::vector<float>& tiskz, std::vector<float>& qiskz);
+
+        /**
+         * @brief Set the cascade variables, with the hit geometry at the prompt vertex given.
+         * @see NTagCandidate::SetCascadeVariables
+         */
+        void SetCascadeVariables(const HitGeometry& promptGeometry);
+
         Verbosity fVerbosity;
         NTagMessage msg;
         NTagEventInfo* currentEvent; ///< A pointer to the concurrent NTagEventInfo.
 
-        FVarMap fVarMap; ///< A map of integer feature variables.
-        IVarMap iVarMap; ///< A map of float feature variables.
+        std::array<int, nIVariables>    iVars;     ///< Integer feature variables, indexed by IVariable.
+        std::array<float, nFVariables>  fVars;     ///< Float feature variables, indexed by FVariable.
+        std::bitset<nIVariables>        iVarIsSet; ///< Flags of the integer feature variables that are set.
+        std::bitset<nFVariables>        fVarIsSet; ///< Flags of the float feature variables that are set.
+
+        static const char* const iVariableNames[nIVariables]; ///< Names of integer feature variables.
+        static const char* const fVariableNames[nFVariables]; ///< Names of float feature variables.
 
         int candidateID; ///< Candidate ID of the candidate.
         float TWIDTH;    ///< TWIDTH for NHits counting. (ns) Taken from NTagCandidate::currentEvent.
 
-        std::vector<float> vHitRawTimes, ///< Vector of residual hit times. [Size: NHits]
-                           vHitResTimes, ///< Vector of residual hit times. [Size: NHits]
-                           vHitChargePE; ///< Vector of deposited charge in photoelectrons. [Size: NHits]
-        std::vector<int>   vHitCableIDs, ///< Vector of hit cable IDs. [Size: NHits]
-                           vHitSigFlags; ///< Vector of signal flags. (0: bkg, 1: sig) [Size: NHits]
+        int nFitIterations,  ///< Number of grid levels or minimizer iterations in NTagCandidate::MinimizeTRMS.
+            nFitEvaluations, ///< Number of TRMS evaluations in NTagCandidate::MinimizeTRMS.
+            nFitPruned;      ///< Number of grid points skipped in NTagCandidate::SearchTRMSGridPruned.
+
+        int firstHitID, ///< The index of the first hit of the candidate in NTagEventInfo::vSortedT_ToF.
+            nHits;      ///< Number of hits of the candidate.
+
+        bool bCascadeRejected; ///< \c true if rejected by the cascade. @see NTagEventInfo::ApplyCascade
 
     friend class NTagEventInfo;
+    friend class NTagBenchmark;
 };
 
 #endif
@@ -13,6 +13,8 @@
 #include <vector>
 #include <ctime>
 #include <cmath>
+#include <atomic>
+#include <mutex>
 
 #include <TString.h>
 #include <TMVA/Reader.h>
@@ -27,6 +29,9 @@
 #include "NTagTMVA.hh"
 #include "NTagTMVAVariables.hh"
 #include "NTagCandidate.hh"
+#include "NTagToFTable.hh"
+#include "NTagThreadPool.hh"
+#include "NTagBonsaiPool.hh"
 
 /******************************************
 *
@@ -60,6 +65,28 @@ enum VertexMode
     mSTMU    ///< Use the vertex where a stopping muon has stopped inside the tank. Not supported yet.
 };
 
+/******************************************
+*
+* @brief Neut-fit mode for NTagEventInfo
+*
+* Each option sets the minimizer used in
+* NTagCandidate::MinimizeTRMS to find the
+* vertex that minimizes the RMS of the
+* ToF-subtracted hit times (TRMS).
+*
+* Neut-fit mode can be set using
+* NTagEventInfo::SetNeutFitMode.
+*
+* @see NTagCandidate::MinimizeTRMS
+*
+*******************************************/
+enum NeutFitMode
+{
+    mGRID, ///< Nested grid search, halving the grid width until #NTagEventInfo::MINGRIDWIDTH. Default.
+    mLM,   ///< Levenberg-Marquardt minimization seeded by the first #NTagEventInfo::LMSEEDLEVELS levels of the grid search.
+    mBNB   ///< Same nested grid search as #mGRID with branch-and-bound pruning. Returns the same vertex as #mGRID.
+};
+
 /******************************************
 * @brief Constants used in NTag.
 *******************************************/
@@ -86,8 +113,40 @@ namespace NTagDefault{
     constexpr int   ODHITMX      = 16;    ///< Default value for NTagEventInfo::ODHITMX.
     constexpr float TRBNWIDTH    = 0.;    ///< Default value for NTagEventInfo::TRBNWIDTH. (us)
     constexpr float PVXRES       = 7.;    ///< Default value for NTagEventInfo::PVXRES. (cm)
+    constexpr int   GRIDTABLELEVELS = 1;  ///< Default value for NTagEventInfo::GRIDTABLELEVELS.
+    constexpr int   LMSEEDLEVELS = 1;     ///< Default value for NTagEventInfo::LMSEEDLEVELS.
+    constexpr float GRIDTABLEMEM = 512.;  ///< Default value for NTagEventInfo::GRIDTABLEMEM. (MB)
+    constexpr int   ANGLESAMPLE  = 0;     ///< Default value for NTagEventInfo::ANGLESAMPLE.
+    constexpr int   NTHREADS     = 1;     ///< Default value for NTagEventInfo::NTHREADS.
+    constexpr int   NWORKERS     = 0;     ///< Default value for NTagEventInfo::NWORKERS.
+    constexpr int   NBONSAIPROCS = 0;     ///< Default value for NTagEventInfo::NBONSAIPROCS.
 }
 
+/**********************************************************
+ * @brief Counters of the cascade, summed over events.
+ * @see NTagEventInfo::PrintCascadeSummary
+ **********************************************************/
+struct CascadeStats
+{
+    long   nCandidates       = 0; ///< Number of candidates.
+    long   nRejected         = 0; ///< Number of candidates rejected by the cascade.
+    long   nCaptures         = 0; ///< Number of candidates matched to a true capture. (MC only)
+    long   nCapturesRejected = 0; ///< Number of candidates matched to a true capture and rejected. (MC only)
+    double fullCPUTime       = 0; /*!< CPU time [s] spent on the candidates not rejected, after the cascade,
+                                       by the tagging thread, its #NTagEventInfo::fThreadPool, and the BONSAI
+                                       pool processes. */
+    bool   isMC              = false; ///< \c true if the counters include MC events.
+
+    CascadeStats& operator+=(const CascadeStats& other)
+    {
+        nCandidates += other.nCandidates; nRejected += other.nRejected;
+        nCaptures += other.nCaptures; nCapturesRejected += other.nCapturesRejected;
+        fullCPUTime += other.fullCPUTime;
+        isMC = isMC || other.isMC;
+        return *this;
+    }
+};
+
 /**********************************************************
  * @brief The container of raw TQ hit information,
  * event variables, and manipulating function library.
@@ -159,7 +218,7 @@ class NTagEventInfo
 
             /**
              * @brief Saves basic event information to member variables.
-             * @details Saved variables: #runNo, #subrunNo, #eventNo, #qismsk, #nhitac, #trgOffset
+             * @details Saved variables: #runNo, #subrunNo, #eventNo, #nhitac, #trgOffset
              */
             virtual void SetEventHeader();
 
@@ -189,10 +248,35 @@ class NTagEventInfo
 
             /**
              * @brief Extracts TQ hit arrays from input file and append it to the raw hit vectors.
-             * @details Saved variables: #vTISKZ, #vQISKZ, #vCABIZ
+             * @details Reads \c sktqz_ once, applying the in-gate and RBN reduction cuts, matching signal hits,
+             * and summing #qismsk for the first trigger of an event.
+             * Saved variables: #vTISKZ, #vQISKZ, #vCABIZ, #vISIGZ, #vTriggerBlockStart, #qismsk,
+             * #nTotalHits, #nRemovedHits, #nTotalSigHits, #nFoundSigHits, #sigMatchTime.
+             * The signal hits of an event are read and indexed once, at the first trigger of the event.
              */
             virtual void AppendRawHitInfo();
 
+            /**
+             * @brief Groups the signal hits in #vSIGT by PMT cable ID,
+             * so that a hit is matched to signal hits by looking up its PMT only.
+             * @details Saved variables: #vSigHitStart, #vSigHitTime
+             */
+            virtual void IndexSignalHits();
+
+            /**
+             * @brief Checks if a hit matches a signal hit in #vSIGT within 1e-3 ns.
+             * Call after NTagEventInfo::IndexSignalHits.
+             * @param hitTime Hit time. [ns]
+             * @param hitPMTID Hit PMT cable ID.
+             * @return \c true if the hit is from signal.
+             */
+            inline bool IsSignalHit(float hitTime, int hitPMTID)
+            {
+                for (int iSigHit = vSigHitStart[hitPMTID]; iSigHit < vSigHitStart[hitPMTID+1]; iSigHit++)
+                    if (fabs(hitTime - vSigHitTime[iSigHit]) < 1e-3) return true;
+                return false;
+            }
+
             /**
              * @brief Subtracts ToF from each raw hit time in #vTISKZ and sort.
              * @details Saved variables: #vUnsortedT_ToF, #vSortedT_ToF, #vSortedPMTID, #vSortedQ
@@ -249,6 +333,53 @@ class NTagEventInfo
          */
         virtual void SavePeakFromHit(int hitID);
 
+        /**
+         * @brief Sets the feature variables of all candidates in #vCandidates.
+         * @details With #NTHREADS = 1, sets the features of each candidate in turn.
+         * Otherwise, the threads of #fThreadPool run NTagCandidate::SetFeatureVariables for all candidates,
+         * while the main thread, the only one that calls Fortran, follows with
+         * NTagCandidate::SetFortranVariables in candidate order as each candidate is done.
+         * TMVA variables and outputs are then set in candidate order.
+         * The results are the same as with one thread.
+         * NTagCandidate::SetFortranVariables is called with #fFortranMutex locked by NTagEventInfo::LockFortran.
+         *
+         * With #fBonsaiPool, the BONSAI fits of all candidates are submitted to the pool processes
+         * before the C++ features are set, and their results are collected in candidate order.
+         *
+         * With the cascade on, NTagEventInfo::ApplyCascade runs first, and the candidates it rejects
+         * skip all of the above but the TMVA variables.
+         */
+        virtual void SetCandidateFeatures();
+
+        /**
+         * @brief Sets the feature variables of all candidates in #vCandidates, with #fThreadPool if #NTHREADS > 1.
+         * @details Called by NTagEventInfo::SetCandidateFeatures without #fBonsaiPool.
+         */
+        void SetCandidateFeaturesWithThreads();
+
+        /**
+         * @brief Sets the feature variables of all candidates in #vCandidates, with the BONSAI fits in #fBonsaiPool.
+         * @details Called by NTagEventInfo::SetCandidateFeatures if #fBonsaiPool exists.
+         * The C++ features are set by #fThreadPool with #NTHREADS > 1, and in this thread otherwise.
+         * @return CPU time of the fits in the pool processes. [s]
+         */
+        double SetCandidateFeaturesWithBonsaiPool();
+
+        /**
+         * @brief Sets the cascade variables of all candidates, and rejects the candidates that fail the cascade cuts.
+         * @details Each candidate gets NTagCandidate::SetCascadeVariables and \a "CascadePass", the cascade decision.
+         * Rejected candidates get NTagCandidate::SetCascadeRejectedVariables with the variables that the
+         * candidates not rejected set, from NTagCandidate::GetFeatureVariableMask with the settings of the event,
+         * so that all candidates have the same variables whatever the number of threads, workers or jobs.
+         * @see NTagEventInfo::SetCascadeCutRange
+         */
+        void ApplyCascade();
+
+        /**
+         * @brief Checks if the cascade variables of \p candidate are all within the cascade cut ranges.
+         */
+        bool PassesCascade(const NTagCandidate& candidate) const;
+
         /**
          * @brief Function for setting candidate variables.
          * @details Extract candidate variables from the candidate vector #vCandidates.
@@ -257,15 +388,24 @@ class NTagEventInfo
         virtual void SetCandidateVariables();
 
         /**
-         * @brief Initialize STL maps #iCandidateVarMap and #fCandidateVarMap with feature variable names
-         * declared in NTagCandidate::SetVariables.
+         * @brief Initialize STL maps #iCandidateVarMap and #fCandidateVarMap with the names of feature
+         * variables set in the first candidate by NTagCandidate::SetVariables, and the vectors of
+         * #iCandidateVectors and #fCandidateVectors with the same vectors.
          */
         void InitializeCandidateVariableVectors();
         /**
          * @brief Extract variable values from each candidates in #vCandidates and save those in
-         * #iCandidateVarMap and #fCandidateVarMap.
+         * #iCandidateVectors and #fCandidateVectors. The hits of each candidate are also saved in
+         * #vHitRawTimes, #vHitResTimes, #vHitCableIDs, and #vHitSigFlags.
          */
         void ExtractCandidateVariables();
+        /**
+         * @brief Binds #iTMVAVectors and #fTMVAVectors to the event vectors of
+         * NTagTMVAVariables with the same names as the feature variables.
+         * @details Called once at NTagEventInfo::SearchCaptureCandidates, so that NTagCandidate::SetNNVariables
+         * pushes back feature variables without looking up their names.
+         */
+        void BindTMVAVariables();
         /**
          * @brief Dump all saved candidates' hit information and feature variables.
          */
@@ -290,20 +430,47 @@ class NTagEventInfo
          * @param T A vector of PMT hit times. [ns]
          * @param PMTID A vector of PMT cable IDs corresponding to each hit in \p T.
          * @param vertex A size-3 array of vertex coordinates to calculate ToF from.
-         * @param doSort If \c true, the returned vector is sorted in ascending order.
-         * @return The ToF-subtracted version of an input hit-time vector \p T. If \p doSort is set to \c true,
-         * the returned vector is sorted in ascending order.
+         * @param t_ToF Output vector of the ToF-subtracted hit times, resized to the size of \p T.
+         * @param doSort If \c true, \p t_ToF is sorted in ascending order.
          * @note The input hit-time vector must not have ToF subtracted as ToF will be subtracted inside this function.
          */
-        std::vector<float> GetToFSubtracted(const std::vector<float>& T, const std::vector<int>& PMTID,
-                                              float vertex[3], bool doSort=false);
+        void GetToFSubtracted(const std::vector<float>& T, const std::vector<int>& PMTID,
+                              float vertex[3], std::vector<float>& t_ToF, bool doSort=false);
 
         /**
          * @brief Sort ToF-subtracted hit vector #vUnsortedT_ToF.
-         * @details Saved variables: #vSortedT_ToF, #vSortedQ, #vSortedPMTID.
+         * @details Saved variables: #vSortedT_ToF, #vSortedQ, #vSortedPMTID, #sortedIndex.
+         * The hits of each trigger block in #vTriggerBlockStart are sorted and merged with ::GetSortedIndexOfBlocks.
          */
         void SortToFSubtractedTQ();
 
+        /**
+         * @brief Gets the indices of #vTISKZ whose ToF-subtracted hit times are within (\p tStart, \p tEnd).
+         * Both edges are exclusive.
+         * @param tStart The start time of the window. [ns]
+         * @param tEnd The end time of the window. [ns]
+         * @param index Output vector of indices of #vTISKZ, in ascending order.
+         * @note Binary search over #vSortedT_ToF. Call after NTagEventInfo::SortToFSubtractedTQ.
+         */
+        void GetRawHitIndicesInWindow(float tStart, float tEnd, std::vector<int>& index);
+
+        /**
+         * @brief Builds #fGridToFTable with the current grid search settings.
+         * @details Tabulates #GRIDTABLELEVELS levels within #GRIDTABLEMEM.
+         * Call once before the event loop, after the SK geometry is set.
+         */
+        void BuildGridToFTable();
+
+        /**
+         * @brief Tags the hits of the current event: sorts the ToF-subtracted hits,
+         * searches for capture candidates and extracts their variables.
+         * @details Calls NTagEventInfo::SetToFSubtractedTQ, NTagEventInfo::SearchCaptureCandidates,
+         * and NTagEventInfo::SetCandidateVariables. Reads no SK common block other than through
+         * NTagCandidate::SetFortranVariables, so it can run on an event slot in a worker thread.
+         * @see NTagIO::StartPipeline
+         */
+        virtual void ProcessHits();
+
 
 
         /////////////////////////////
@@ -316,6 +483,36 @@ class NTagEventInfo
          */
         virtual void Clear();
 
+        /**
+         * @brief Copies the tag conditions and event processing options of \p source,
+         * so that this instance tags events the same way as \p source.
+         * @details The TMVA reader settings are copied but the reader is not instantiated.
+         * #fGridToFTable of \p source is shared, not copied.
+         * @param source The NTagEventInfo to copy the settings from.
+         */
+        void CopySettings(const NTagEventInfo& source);
+
+        /**
+         * @brief Swaps all event variables, hit vectors, candidates, and candidate variable vectors with \p other.
+         * @details Only the contents of the vectors are swapped, so that the addresses bound to the
+         * output tree branches stay valid. Settings, #TMVATools, and #nProcessedEvents are not swapped.
+         * @param other The NTagEventInfo to swap the event state with.
+         */
+        void SwapEventState(NTagEventInfo& other);
+
+        /**
+         * @brief Saves \c skhead_ and \c skbadc_ of the event being read, for a worker thread to tag the event with.
+         * @details Call with #fFortranMutex locked. @see NTagIO::SubmitEvent
+         */
+        void SaveRunState();
+
+        /**
+         * @brief Locks #fFortranMutex, and restores \c skhead_ and \c skbadc_ saved by NTagEventInfo::SaveRunState, if any.
+         * @details The thread reading events lets the threads waiting here take the lock first. @see NTagIO::ReadFile
+         * @return The lock on #fFortranMutex.
+         */
+        std::unique_lock<std::mutex> LockFortran();
+
         /**
          * @brief Saves the secondary of the given index. Called inside NTagEventInfo::SetMCInfo.
          * @param secID The index of the secondary particle saved in the \c secndprt common block.
@@ -379,6 +576,67 @@ class NTagEventInfo
          */
         inline void SetMinGridWidth(float w) { MINGRIDWIDTH = w; }
 
+        /**
+         * @brief Set the number of grid levels #GRIDTABLELEVELS in NTagCandidate::MinimizeTRMS
+         * to be precomputed as ToF tables.
+         * @param n Number of grid levels to tabulate. Set 0 to compute all ToF directly.
+         * @see NTagGridToFTable
+         */
+        inline void SetGridTableLevels(int n) { GRIDTABLELEVELS = n; }
+
+        /**
+         * @brief Set the memory limit #GRIDTABLEMEM of the grid ToF tables.
+         * @param mem Memory limit [MB] of the grid ToF tables.
+         * @see NTagGridToFTable
+         */
+        inline void SetGridTableMemory(float mem) { GRIDTABLEMEM = mem; }
+
+        /**
+         * @brief Set the maximum number of hit triplets #ANGLESAMPLE for the opening angle statistics.
+         * @param n Maximum number of triplets to sample. Set 0 to use all triplets.
+         * @see GetOpeningAngleStats
+         */
+        inline void SetOpeningAngleSample(int n) { ANGLESAMPLE = n; }
+
+        /**
+         * @brief Set the number of threads #NTHREADS that set candidate features in parallel.
+         * @param n Number of threads. Set 1 to set the features of all candidates in the main thread.
+         * @see NTagEventInfo::SetCandidateFeatures
+         */
+        inline void SetNumberOfThreads(int n) { NTHREADS = n; }
+
+        /**
+         * @brief Set the number of worker threads #NWORKERS that tag events in parallel.
+         * @param n Number of worker threads. Set 0 to tag each event in the main thread.
+         * @see NTagIO::StartPipeline
+         */
+        inline void SetNumberOfWorkers(int n) { NWORKERS = n; }
+
+        /**
+         * @brief Gets the number of worker threads #NWORKERS that tag events in parallel.
+         */
+        inline int GetNumberOfWorkers() const { return NWORKERS; }
+
+        /**
+         * @brief Set the number of processes #NBONSAIPROCS that run BONSAI fits in parallel.
+         * @param n Number of processes. Set 0 to run BONSAI in this process.
+         * @see NTagBonsaiPool
+         */
+        inline void SetNumberOfBonsaiProcesses(int n) { NBONSAIPROCS = n; }
+
+        /**
+         * @brief Set the minimizer #fNeutFitMode used in NTagCandidate::MinimizeTRMS.
+         * @param m #NeutFitMode.
+         */
+        inline void SetNeutFitMode(NeutFitMode m) { fNeutFitMode = m; }
+
+        /**
+         * @brief Set the number of grid levels #LMSEEDLEVELS that seed the Levenberg-Marquardt minimizer
+         * in the #mLM mode of NTagCandidate::MinimizeTRMS.
+         * @param n Number of grid levels, from the coarsest (500 cm) one. Each level halves the grid width.
+         */
+        inline void SetLMSeedLevels(int n) { LMSEEDLEVELS = n; }
+
         /**
          * @brief Set the width #TMATCHWINDOW of the time window used in true-to-reconstructed capture mapping.
          * @param t Width of the time window for capture mapping. [ns]
@@ -464,6 +722,39 @@ class NTagEventInfo
          */
         inline void UseNeutFit(bool b) { bUseNeutFit = b; }
 
+        /**
+         * @brief Sets the cut range of a cascade variable, and turns the cascade on.
+         * @details Candidates with a cascade variable out of its range skip Neut-fit, BONSAI, the opening
+         * angles and TMVA, and get -9999 for the skipped variables. The cut is \p low < variable < \p up,
+         * as in NTagTMVA::IsInRange.
+         * @param key Name of a variable set by NTagCandidate::SetCascadeVariables, e.g., \a "TRMS".
+         * @param low Lower limit of the variable.
+         * @param up Upper limit of the variable.
+         * @see NTagEventInfo::ApplyCascade
+         */
+        void SetCascadeCutRange(const char* key, float low, float up);
+
+        /**
+         * @brief Prints the number of candidates rejected by the cascade and the estimated CPU time saved,
+         * and for MC, the fraction of candidates matched to true captures that are rejected.
+         * @details The CPU time saved is estimated from the mean CPU time of the candidates not rejected.
+         * @see NTagEventInfo::PrintCascadeStats
+         */
+        void PrintCascadeSummary();
+
+        /**
+         * @brief Prints the counters of the cascade, e.g., summed over the jobs of an input file.
+         * @param stats Counters of the cascade.
+         * @param msg Message printer.
+         * @see NTagEventInfo::PrintCascadeSummary
+         */
+        static void PrintCascadeStats(const CascadeStats& stats, NTagMessage& msg);
+
+        /**
+         * @brief Gets the counters of the cascade summed over the events tagged so far.
+         */
+        inline const CascadeStats& GetCascadeStats() const { return fCascadeStats; }
+
         // TMVA tools
         /// All input variables to TMVA are controlled by this class!
         NTagTMVA    TMVATools;
@@ -484,6 +775,20 @@ class NTagEventInfo
         float       ODHITMX;      ///< Threshold on the number of OD hits. Not used at the moment.
         float       VTXSRCRANGE;  ///< Vertex search range in NTagCandidate::MinimizeTRMS. @see NTagCandidate::SetDistanceCut
         float       MINGRIDWIDTH;   ///< Vertex search grid width in NTagCandidate::MinimizeTRMS.
+        int         GRIDTABLELEVELS; ///< Number of grid levels in NTagCandidate::MinimizeTRMS to tabulate.
+                                     ///< @see NTagEventInfo::SetGridTableLevels
+        float       GRIDTABLEMEM;    ///< Memory limit [MB] of the grid ToF tables.
+                                     ///< @see NTagEventInfo::SetGridTableMemory
+        int         LMSEEDLEVELS;    ///< Number of grid levels that seed the #mLM minimizer.
+                                     ///< @see NTagEventInfo::SetLMSeedLevels
+        int         ANGLESAMPLE;  ///< Maximum number of hit triplets for the opening angle statistics.
+                                  ///< @see NTagEventInfo::SetOpeningAngleSample
+        int         NTHREADS;     ///< Number of threads that set candidate features in parallel.
+                                  ///< @see NTagEventInfo::SetNumberOfThreads
+        int         NWORKERS;     ///< Number of worker threads that tag events in parallel.
+                                  ///< @see NTagEventInfo::SetNumberOfWorkers
+        int         NBONSAIPROCS; ///< Number of processes that run BONSAI fits in parallel.
+                                  ///< @see NTagEventInfo::SetNumberOfBonsaiProcesses
         float       PVXRES;       ///< Prompt vertex resolution. (&Gamma of Breit-Wigner distribution) [cm]
 
         // Prompt-vertex-related
@@ -491,6 +796,7 @@ class NTagEventInfo
                     customvy,     ///< Y coordinate of a custom prompt vertex
                     customvz;     ///< Z coordinate of a custom prompt vertex
         VertexMode  fVertexMode;  ///< #VertexMode of class NTagInfo and all inheriting classes.
+        NeutFitMode fNeutFitMode; ///< #NeutFitMode used in NTagCandidate::MinimizeTRMS.
 
 
     protected:
@@ -506,6 +812,8 @@ class NTagEventInfo
         // Signal TQ source
         TFile* fSigTQFile;
         TTree* fSigTQTree;
+        long   fSigTQEntry; /*!< Entry of #fSigTQTree read into #vSIGT and indexed by NTagEventInfo::IndexSignalHits,
+                                 or -1 if none. */
 
         // Raw TQ hit vectors
         std::vector<int>    vCABIZ; ///< A vector of PMT cable IDs of all recorded hits from an event.
@@ -516,11 +824,23 @@ class NTagEventInfo
                                     ///< Forms a triplet with #vCABIZ and #vTISKZ.
         std::vector<int>    vISIGZ; ///< A vector of signal flags (0: bkg, 1: sig) of all recorded hits from an event.
                                     ///< If #fSigTQFile is not \c NULL, it is saved in NTagEventInfo::AppendRawHitInfo.
+        std::vector<int>    vTriggerBlockStart; ///< Indices of the first hit of #vTISKZ appended by each call of
+                                                ///< NTagEventInfo::AppendRawHitInfo, e.g., the SHE and the AFT triggers.
         std::vector<float>* vSIGT;  ///< A vector to save signal hit times from #fSigTQTree temporarily. Not included in output.
         std::vector<int>*   vSIGI;  ///< A vector to save signal hit PMT IDs from #fSigTQTree temporarily. Not included in output.
+        std::vector<int>    vSigHitStart; ///< Signal hits of PMT cable ID \c i are at indices from \c vSigHitStart[i]
+                                          ///< to \c vSigHitStart[i+1] of #vSigHitTime. Size: \c MAXPM + 2
+        std::vector<float>  vSigHitTime;  ///< Signal hit times [ns] of #vSIGT grouped by PMT cable ID.
+                                          ///< @see NTagEventInfo::IndexSignalHits
 
         std::array<float, MAXPM+1> vPMTHitTime; ///< An array to save hit times for each PMT. Used for RBN reduction.
 
+        NTagToFTable fPromptToFTable; ///< ToF from the prompt vertex to all PMTs. @see NTagEventInfo::SetToFSubtractedTQ
+        NTagGridToFTable fGridToFTable; ///< ToF from coarse grid points to all PMTs. @see NTagCandidate::MinimizeTRMS
+        const NTagGridToFTable* fGridToFTableInUse; /*!< The grid ToF table used by the candidates: #fGridToFTable,
+                                                         or that of the instance the settings are copied from.
+                                                         @see NTagEventInfo::CopySettings */
+
         // Processed TQ hit vectors
         std::vector<int>    vSortedPMTID;   ///< A vector of PMT cable IDs corresponding to each hit
                                             ///< sorted by ToF-subtracted hit time in ascending order.
@@ -534,7 +854,7 @@ class NTagEventInfo
                                             ///< Forms a triplet with #vSortedT_ToF and #vSortedPMTID.
         std::vector<int>    vSortedSigFlag; ///< A vector of signal flags (0: bkg, 1: sig) corresponding to each hit
                                             ///< in #vSortedT_ToF.
-        std::vector<int> reverseIndex;      ///< Inverse map from indices of vSortedT_ToF to indices of vTISKZ.
+        std::vector<int> sortedIndex;       ///< Map from indices of #vSortedT_ToF to indices of #vTISKZ.
 
         // event processing options
         bool        bData,          /*!< Set \c true for data events, \c false for MC events.
@@ -547,10 +867,38 @@ class NTagEventInfo
                                          Can be set to \c true from command line with option `-forceMC`. */
                     bUseResidual,   /*!< Set \c false if not using ToF-subtracted hit times, otherwise \c false.
                                          Can be set to \c false from command line with option `-noTOF`. */
-                    bUseNeutFit;    /*!< Set \c false if not using Neut-fit and MVA, otherwise \c false.
+                    bUseNeutFit,    /*!< Set \c false if not using Neut-fit and MVA, otherwise \c false.
                                          Can be set to \c false from command line with option `-noFit`. */
+                    bUseCascade;    /*!< Set \c true if using the cascade, otherwise \c false.
+                                         Set by NTagEventInfo::SetCascadeCutRange, e.g., with option `-cascade`. */
         bool candidateVariablesInitialized; /*!< A flag to check if #iCandidateVarMap and #fCandidateVarMap
                                                  are initialized. */
+        bool tmvaVariablesBound;            ///< A flag to check if #iTMVAVectors and #fTMVAVectors are bound.
+
+        unsigned long nHeapAllocationsAtClear,  ///< Number of heap allocations at the end of NTagEventInfo::Clear.
+                      nHeapAllocationsAtSearch; /*!< Number of heap allocations at the start of
+                                                     NTagEventInfo::SearchCaptureCandidates. */
+
+        NTagThreadPool* fThreadPool; /*!< Threads that set candidate features, created at the first event
+                                          with #NTHREADS > 1. @see NTagEventInfo::SetCandidateFeatures */
+        NTagBonsaiPool* fBonsaiPool; /*!< Processes that run BONSAI fits, created by NTagIO::ReadFile
+                                          with #NBONSAIPROCS > 0. @see NTagEventInfo::SetCandidateFeatures */
+
+        std::vector<std::pair<IVariable, Range>> fCascadeICuts; ///< Cascade cut ranges of the integer variables.
+        std::vector<std::pair<FVariable, Range>> fCascadeFCuts; ///< Cascade cut ranges of the float variables.
+        std::bitset<nIVariables> fCascadeIMask; ///< Integer variables set by the candidates not rejected by the cascade.
+                                                ///< @see NTagCandidate::GetFeatureVariableMask
+        std::bitset<nFVariables> fCascadeFMask; ///< Float variables set by the candidates not rejected by the cascade.
+                                                ///< @see NTagCandidate::GetFeatureVariableMask
+        CascadeStats             fCascadeStats; ///< @see NTagEventInfo::PrintCascadeSummary
+
+        static std::mutex fFortranMutex; /*!< Locked by any thread that calls Fortran, as the SK libraries and
+                                              BONSAI share common blocks. @see NTagIO::StartPipeline */
+        static std::atomic<int> fNFortranWaiters; ///< Number of threads waiting in NTagEventInfo::LockFortran.
+
+        bool          bHasRunState;    ///< \c true if the run state of the event is saved by NTagEventInfo::SaveRunState.
+        skhead_common fRunHeader;      ///< \c skhead_ saved by NTagEventInfo::SaveRunState.
+        skbadc_common fRunBadChannels; ///< \c skbadc_ saved by NTagEventInfo::SaveRunState.
 
 
 
@@ -603,15 +951,20 @@ class NTagEventInfo
         std::vector<int>    vFirstHitID;      ///< Vector of all indices of the earliest hit in each candidate.
                                               ///< The indices are based off #vSortedT_ToF.
 
-        std::vector<std::vector<float>> *vHitRawTimes, ///< Vector of residual hit times. [Size: #nCandidates]
+        // Hits of each candidate, filled from the sorted hit vectors in NTagEventInfo::ExtractCandidateVariables
+        std::vector<std::vector<float>> *vHitRawTimes, ///< Vector of raw hit times. [Size: #nCandidates]
                                         *vHitResTimes; ///< Vector of residual hit times. [Size: #nCandidates]
         std::vector<std::vector<int>>   *vHitCableIDs, ///< Vector of hit cable IDs. [Size: #nCandidates]
                                         *vHitSigFlags; ///< Vector of signal flags. (0: bkg, 1: sig) [Size: #nCandidates]
+        std::vector<std::vector<float>> fSpareFloatVectors; ///< Cleared float hit vectors kept for reuse.
+        std::vector<std::vector<int>>   fSpareIntVectors;   ///< Cleared integer hit vectors kept for reuse.
 
         int nTotalHits;    ///< Number of total hits, including unrecorded hits.
         int nTotalSigHits; ///< Number of total signal hits, including unrecorded signal hits.
         int nFoundSigHits; ///< Number of registered signal hits.
         int nRemovedHits;  ///< Number of removed hits due to RBN reduction.
+        float sigMatchTime; ///< CPU time taken by the hit loop of NTagEventInfo::AppendRawHitInfo with signal hit
+                            ///< matching, excluding NTagEventInfo::IndexSignalHits. [ms]
 
 
 
@@ -686,9 +1039,23 @@ class NTagEventInfo
         FVecMap fCandidateVarMap; /*!< A map from feature variable name to vectors of
                                        float feature variables of all saved candidates. */
 
+        std::array<std::vector<int>*, nIVariables>   iCandidateVectors; /*!< Vectors of #iCandidateVarMap
+                                                                             indexed by IVariable,
+                                                                             or \c nullptr if not saved. */
+        std::array<std::vector<float>*, nFVariables> fCandidateVectors; /*!< Vectors of #fCandidateVarMap
+                                                                             indexed by FVariable,
+                                                                             or \c nullptr if not saved. */
+        std::array<std::vector<int>*, nIVariables>   iTMVAVectors;      /*!< Event vectors of NTagTMVAVariables
+                                                                             indexed by IVariable,
+                                                                             or \c nullptr if not in TMVA. */
+        std::array<std::vector<float>*, nFVariables> fTMVAVectors;      /*!< Event vectors of NTagTMVAVariables
+                                                                             indexed by FVariable,
+                                                                             or \c nullptr if not in TMVA. */
+
         /************************************************************************************************/
 
     friend class NTagCandidate;
+    friend class NTagIO;
 };
 
 #endif
@@ -9,7 +9,13 @@
 #ifndef NTAGIO_HH
 #define NTAGIO_HH 1
 
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "NTagEventInfo.hh"
+#include "NTagQueue.hh"
 
 /********************************************************
  * @brief The class in charge of SK data I/O.
@@ -31,6 +37,11 @@
  * NTagIO::ReadDataEvent, NTagIO::ReadSHEEvent,
  * and NTagIO::ReadAFTEvent for data events, for the
  * event-wise instructions applied to the input file.
+ *
+ * With NTagEventInfo::SetNumberOfWorkers, the events
+ * are tagged in worker threads while this class keeps
+ * reading and writing events in the main thread.
+ * See NTagIO::StartPipeline.
  *******************************************************/
 class NTagIO : public NTagEventInfo
 {
@@ -111,10 +122,30 @@ class NTagIO : public NTagEventInfo
              * \c skread is called and all data variables copied to the SK fortran common blocks
              * are read by the member functions of NTagEventInfo if the read status of the event
              * is normal. For MC, events with prompt vertices within PMTs are skipped.
+             * Only the entries in the range set by NTagIO::SetEntryRange are read, except for an AFT
+             * right after the range, which is tagged with the last SHE of the range.
+             * An AFT at the start of the range is skipped, as it is tagged with its SHE by the previous range.
              * @see NTagIO::ReadEvent
              */
             virtual void ReadFile();
 
+            /**
+             * @brief Skips input entries so that the next \c skread reads the entry \p nSkip.
+             * @details Reads through the skipped entries with \c skread without processing them.
+             * Overridden for formats that can seek to an entry.
+             * @param nSkip Number of entries to skip.
+             * @return \c false if the input has no more than \p nSkip entries.
+             * @see NTagROOT::SkipEntries
+             */
+            virtual bool SkipEntries(int nSkip);
+
+            /**
+             * @brief Gets the number of entries of the input, if the input can seek to an entry.
+             * @return -1, as ZBS has no index. Overridden for formats that can seek to an entry.
+             * @see NTagROOT::GetNumberOfInputEntries
+             */
+            virtual int GetNumberOfInputEntries() { return -1; }
+
             /**
              * @brief Calls NTagIO::ReadMCEvent for MC and NTagIO::ReadDataEvent for data events.
              */
@@ -167,6 +198,13 @@ class NTagIO : public NTagEventInfo
              */
             virtual void ReadAFTEvent();
 
+            /**
+             * @brief Tags the event read so far and fills the trees.
+             * @details Calls NTagEventInfo::ProcessHits and NTagIO::FillTrees if #NWORKERS is 0,
+             * otherwise hands the event to the worker threads with NTagIO::SubmitEvent.
+             */
+            virtual void TagEvent();
+
             /** @brief Creates output file and write trees.
              * #truthTree is written only if the input file is MC.
              */
@@ -219,6 +257,58 @@ class NTagIO : public NTagEventInfo
         virtual void FillTrees();
 
 
+        //////////////////////
+        // Tagging pipeline //
+        //////////////////////
+
+        /**
+         * @brief Starts #NWORKERS worker threads that tag events read by the main thread.
+         * @details The main thread reads events from the SK common blocks, swaps each event into
+         * a free event slot with NTagIO::SubmitEvent, and pushes the slot to #fTagQueue.
+         * Each worker thread pops a slot, calls NTagEventInfo::ProcessHits on it, and pushes it to
+         * #fDoneQueue. The main thread writes the tagged events in the input order with
+         * NTagIO::WriteTaggedEvents. Twice as many slots as workers are made, which bounds the
+         * number of events in memory.
+         * @note BONSAI and the SK libraries are called with NTagEventInfo::fFortranMutex locked.
+         * The main thread holds it while reading each entry, lets the waiting workers take it first
+         * between entries, and releases it while writing or waiting for the workers. The workers tag
+         * each event with its run state, saved by NTagEventInfo::SaveRunState, and share #fBonsaiPool.
+         * The events are written in the same order as without worker threads.
+         */
+        void StartPipeline();
+
+        /**
+         * @brief Writes all tagged events, and stops and joins the worker threads.
+         */
+        void StopPipeline();
+
+        /**
+         * @brief Moves the event read so far to a free event slot and hands it to the worker threads.
+         * @details If no slot is free, waits until the oldest event is tagged and written.
+         * The run state of the event is saved in the slot with NTagEventInfo::SaveRunState.
+         */
+        void SubmitEvent();
+
+        /**
+         * @brief Writes tagged events in the input order until at most \p maxInFlight events are left
+         * unwritten, waiting for the worker threads if needed.
+         * @param maxInFlight Number of submitted events to leave unwritten.
+         */
+        void WriteTaggedEvents(int maxInFlight);
+
+        /**
+         * @brief Swaps the event state of a tagged \p slot in, fills the trees, and frees the slot.
+         * @param slot An event slot tagged by a worker thread.
+         */
+        void WriteEvent(NTagEventInfo* slot);
+
+        /**
+         * @brief The loop of each worker thread: pops an event slot from #fTagQueue, tags it,
+         * and pushes it to #fDoneQueue, until it pops \c nullptr.
+         */
+        void RunWorker();
+
+
         ////////////
         // Others //
         ////////////
@@ -234,11 +324,66 @@ class NTagIO : public NTagEventInfo
          */
         virtual void CheckMC();
 
+        /**
+         * @brief Makes this instance one of \p nJobs jobs tagging the same input file.
+         * @details If the input can seek to an entry (NTagIO::GetNumberOfInputEntries), the job tags
+         * the \p iJob-th of \p nJobs contiguous parts of the range set by NTagIO::SetEntryRange,
+         * jumping to the start of its part. Otherwise, the job tags the blocks \p iJob, \p iJob + \p nJobs,
+         * \p iJob + 2 \p nJobs, ... of #JOBBLOCKSIZE events, counted from the start of the range,
+         * and only counts the other events, reading no more of them than the trigger time for TDiff.
+         * Either way, the outputs of all jobs can be merged with NTagIO::MergeJobOutputs.
+         * @param iJob Index of this job, from 0 to \p nJobs-1.
+         * @param nJobs Number of jobs.
+         */
+        inline void SetJob(int iJob, int nJobs) { fJobIndex = iJob; fNJobs = nJobs; }
+
+        /**
+         * @brief Checks if the event being read is tagged by this job. @see NTagIO::SetJob
+         */
+        inline bool IsEventOfThisJob() const
+        { return fIsJobRange || ((nProcessedEvents - fNSkipEntries) / JOBBLOCKSIZE) % fNJobs == fJobIndex; }
+
+        /**
+         * @brief Checks if an SHE is read and waits for its AFT to be tagged.
+         */
+        inline bool IsSHEPending() { return !IsRawHitVectorEmpty() || fIsOtherJobSHEPending; }
+
+        /**
+         * @brief Sets the range of input entries to read.
+         * @details Consecutive ranges tag every event once, with an SHE and its AFT tagged
+         * in the range of the SHE. The last two skipped entries are read to set TDiff
+         * of the first event in the range. @see NTagIO::ReadFile
+         * @param nSkip Number of entries to skip from the start of the input.
+         * @param nEntries Number of entries to read after the skipped entries. Set -1 to read to the end.
+         */
+        inline void SetEntryRange(int nSkip, int nEntries=-1) { fNSkipEntries = nSkip; fNEntries = nEntries; }
+
+        /**
+         * @brief Merges the outputs of jobs set by NTagIO::SetJob into a single output
+         * with the events in the input order.
+         * @details The trees \c ntvar, \c truth, and \c restq are merged. The candidate variable
+         * branches of a job that found no candidate are filled with empty vectors.
+         * @param outFileName Output file name.
+         * @param jobFileNames Output file names of the jobs, in the order of the job index.
+         * @param areJobsInterleaved \c true if the jobs tagged blocks of #JOBBLOCKSIZE events in turn,
+         * \c false if they tagged contiguous ranges of entries. @see NTagIO::SetJob
+         */
+        static void MergeJobOutputs(const char* outFileName, const std::vector<std::string>& jobFileNames,
+                                    bool areJobsInterleaved=true);
+
+        static const int JOBBLOCKSIZE = 100; ///< Number of consecutive events tagged by each job. @see NTagIO::SetJob
+
     protected:
         const char* fInFileName;
         const char* fOutFileName;
         int         lun;
         bool        candidateVariablesAdded;
+        int         fJobIndex,  ///< Index of this job. @see NTagIO::SetJob
+                    fNJobs;     ///< Number of jobs tagging the input file. @see NTagIO::SetJob
+        bool        fIsJobRange; ///< \c true if this job tags a contiguous range of entries. @see NTagIO::SetJob
+        int         fNSkipEntries, ///< Number of input entries to skip. @see NTagIO::SetEntryRange
+                    fNEntries;     ///< Number of input entries to read, or -1 for all. @see NTagIO::SetEntryRange
+        bool        fIsOtherJobSHEPending; ///< \c true if an SHE of the other jobs is read, whose hits are not read.
 
         TFile*      outFile;
         TTree*      truthTree; /*!< A tree of member variables. (created for MC inputs only)
@@ -250,6 +395,17 @@ class NTagIO : public NTagEventInfo
         TTree*      restqTree; /*!< A tree of Residual TQ hit vectors. (#vSortedT, #vSortedQ, and #vSortedPMTID)
                                     @see: NTagIO::CreateBranchesToResTQTree */
 
+        // Tagging pipeline
+        std::vector<NTagEventInfo*>       fEventSlots;   ///< Events being tagged. @see NTagIO::StartPipeline
+        std::vector<NTagEventInfo*>       fFreeSlots;    ///< Slots of #fEventSlots that hold no event.
+        NTagQueue<NTagEventInfo*>*        fTagQueue;     ///< Slots to be tagged by the worker threads.
+        NTagQueue<NTagEventInfo*>*        fDoneQueue;    ///< Slots tagged by the worker threads.
+        std::vector<NTagEventInfo*>       fTaggedSlots;  ///< Tagged slots waiting for an earlier event.
+        std::vector<std::thread>          fWorkers;      ///< Worker threads. @see NTagIO::RunWorker
+        std::vector<int>                  fSubmittedEvents; ///< Indices of the submitted events not yet written,
+                                                            ///< in the input order. At most one per slot.
+        std::unique_lock<std::mutex>      fFortranLock;  ///< The main thread's lock on NTagEventInfo::fFortranMutex.
+
     private:
         static NTagIO* instance;
 };
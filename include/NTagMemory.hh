@@ -0,0 +1,24 @@
+/*******************************************
+*
+* @file NTagMemory.hh
+*
+* @brief Defines #GetNHeapAllocations.
+*
+********************************************/
+
+#ifndef NTAGMEMORY_HH
+#define NTAGMEMORY_HH 1
+
+/**
+ * @brief Gets the number of heap allocations made so far by the process.
+ * @details Counted only if NTag is built with `make NTAG_COUNT_ALLOCATIONS=1`.
+ * Each call to the global `operator new` (including the array and
+ * `std::nothrow` forms) is then counted. These operators are replaced in NTagMemory.cc
+ * with ones that count and then call `malloc`.
+ * @return The number of heap allocations since the start of the process, or 0 if not counted.
+ * @see NTagIO::FillTrees, where the number of allocations in each event
+ * is printed with #pDEBUG verbosity.
+ */
+unsigned long GetNHeapAllocations();
+
+#endif
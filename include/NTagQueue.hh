@@ -0,0 +1,159 @@
+/*******************************************
+*
+* @file NTagQueue.hh
+*
+* @brief Defines NTagQueue.
+*
+********************************************/
+
+#ifndef NTAGQUEUE_HH
+#define NTAGQUEUE_HH 1
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+/********************************************************
+ * @brief A bounded lock-free queue for many producer
+ * and many consumer threads.
+ *
+ * Each slot of the ring buffer has a sequence number
+ * that tells producers and consumers whether the slot
+ * is free to write or ready to read, so that pushing
+ * and popping take one compare-and-swap on the shared
+ * position and no lock. (D. Vyukov's bounded MPMC queue)
+ *
+ * NTagQueue::TryPush and NTagQueue::TryPop return
+ * \c false if the queue is full or empty. NTagQueue::Push
+ * and NTagQueue::Pop wait until they succeed, yielding
+ * and then sleeping between tries.
+ *
+ * @see NTagIO::StartPipeline
+ *******************************************************/
+template <typename T>
+class NTagQueue
+{
+    public:
+        /**
+         * @brief Constructor of NTagQueue.
+         * @param capacity Maximum number of items in the queue. Rounded up to a power of 2.
+         */
+        explicit NTagQueue(std::size_t capacity)
+        : fMask(RoundUpToPowerOf2(capacity) - 1), fCells(new Cell[fMask + 1]),
+          fPushPosition(0), fPopPosition(0)
+        {
+            for (std::size_t i = 0; i <= fMask; i++)
+                fCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Pushes \p item to the end of the queue if the queue is not full.
+         * @return \c true if \p item is pushed.
+         */
+        bool TryPush(const T& item)
+        {
+            std::size_t position = fPushPosition.load(std::memory_order_relaxed);
+
+            while (true) {
+                Cell& cell = fCells[position & fMask];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                long diff = (long)sequence - (long)position;
+
+                // Free: take the position
+                if (diff == 0) {
+                    if (fPushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        cell.data = item;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                // Not yet popped: full
+                else if (diff < 0) return false;
+                // Taken by another producer
+                else position = fPushPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Pops the first item of the queue to \p item if the queue is not empty.
+         * @return \c true if \p item is popped.
+         */
+        bool TryPop(T& item)
+        {
+            std::size_t position = fPopPosition.load(std::memory_order_relaxed);
+
+            while (true) {
+                Cell& cell = fCells[position & fMask];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                long diff = (long)sequence - (long)(position + 1);
+
+                // Ready: take the position
+                if (diff == 0) {
+                    if (fPopPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        item = cell.data;
+                        cell.sequence.store(position + fMask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                // Not yet pushed: empty
+                else if (diff < 0) return false;
+                // Taken by another consumer
+                else position = fPopPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Pushes \p item, waiting while the queue is full.
+         */
+        void Push(const T& item)
+        {
+            for (int nTries = 0; !TryPush(item); nTries++) Wait(nTries);
+        }
+
+        /**
+         * @brief Pops the first item to \p item, waiting while the queue is empty.
+         */
+        void Pop(T& item)
+        {
+            for (int nTries = 0; !TryPop(item); nTries++) Wait(nTries);
+        }
+
+        /**
+         * @brief Waits before the next try: yields for the first tries, then sleeps for 100 &mu;s.
+         * @param nTries Number of failed tries so far.
+         */
+        static void Wait(int nTries)
+        {
+            if (nTries < 64) std::this_thread::yield();
+            else             std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence;
+            T                        data;
+        };
+
+        static std::size_t RoundUpToPowerOf2(std::size_t n)
+        {
+            std::size_t size = 2;
+            while (size < n) size *= 2;
+            return size;
+        }
+
+        const std::size_t        fMask;
+        std::unique_ptr<Cell[]>  fCells;
+
+        // Kept on separate cache lines, as producers and consumers update them independently.
+        // Padded rather than aligned, as C++11 new does not align beyond max_align_t.
+        char                     fPad0[64];
+        std::atomic<std::size_t> fPushPosition;
+        char                     fPad1[64];
+        std::atomic<std::size_t> fPopPosition;
+        char                     fPad2[64];
+};
+
+#endif
@@ -36,6 +36,20 @@ class NTagROOT : public NTagIO
         void OpenFile();  ///< @brief Opens SKROOT file.
         void CloseFile(); ///< @brief Closes SKROOT file.
 
+        /**
+         * @brief Seeks to the entry \p nSkip of the input tree, instead of reading the skipped entries.
+         * @details Jumps to the entry \p nSkip - 1, as the next \c skread reads the entry after it.
+         * \c scripts/check_ranges.sh checks that the ranges read after seeking match a read-through.
+         * @see NTagIO::SkipEntries
+         */
+        bool SkipEntries(int nSkip);
+
+        /**
+         * @brief Gets the number of entries of the input tree, so that jobs can jump to their ranges.
+         * @see NTagIO::GetNumberOfInputEntries
+         */
+        int GetNumberOfInputEntries();
+
         /// @brief Specifies how to read secondary bank.
         void ReadSecondaries();
 
@@ -0,0 +1,99 @@
+/*******************************************
+*
+* @file NTagThreadPool.hh
+*
+* @brief Defines NTagThreadPool.
+*
+********************************************/
+
+#ifndef NTAGTHREADPOOL_HH
+#define NTAGTHREADPOOL_HH 1
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/********************************************************
+ * @brief A fixed set of threads that run indexed tasks.
+ *
+ * NTagThreadPool::Start hands out the task indices
+ * 0, 1, ... to the pool threads in ascending order, each
+ * thread taking the next index as soon as it is free,
+ * so that threads that finish early take over the
+ * remaining tasks. The calling thread is free while the
+ * tasks run, and can wait for a single task with
+ * NTagThreadPool::WaitForTask, or for all tasks with
+ * NTagThreadPool::Wait.
+ *
+ * The threads live as long as the pool, so that their
+ * `thread_local` buffers are reused across calls.
+ *
+ * @see NTagEventInfo::SetCandidateFeatures
+ *******************************************************/
+class NTagThreadPool
+{
+    public:
+        /**
+         * @brief Constructor of NTagThreadPool. Starts the threads.
+         * @param nThreads Number of threads in the pool.
+         */
+        NTagThreadPool(int nThreads);
+        /**
+         * @brief Destructor of NTagThreadPool. Waits for the running tasks and joins the threads.
+         */
+        ~NTagThreadPool();
+
+        /**
+         * @brief Starts running \c task(i) for \c i from 0 to \p nTasks-1 on the pool threads.
+         * @details Returns immediately. Call NTagThreadPool::Wait before starting new tasks.
+         * @param nTasks Number of tasks.
+         * @param task Function to call with each task index.
+         */
+        void Start(int nTasks, std::function<void(int)> task);
+
+        /**
+         * @brief Waits until \c task(iTask) of the last NTagThreadPool::Start has returned.
+         * @param iTask Task index.
+         */
+        void WaitForTask(int iTask);
+
+        /**
+         * @brief Waits until all tasks of the last NTagThreadPool::Start have returned.
+         */
+        void Wait();
+
+        /**
+         * @brief Gets the number of threads in the pool.
+         */
+        int GetNThreads() const { return static_cast<int>(fThreads.size()); }
+
+        /**
+         * @brief Gets the CPU time used by the pool threads since they started. [s]
+         * @details The threads use no CPU time while they wait for tasks,
+         * so the difference over a call of NTagThreadPool::Start is the CPU time of its tasks.
+         */
+        double GetCPUTime();
+
+    private:
+        /**
+         * @brief The loop of each pool thread: takes the next task index and runs the task, until the pool is destroyed.
+         */
+        void RunThread();
+
+        std::vector<std::thread> fThreads;
+
+        std::mutex               fMutex;
+        std::condition_variable  fTaskReady,  ///< Notified when tasks are started or the pool is destroyed.
+                                 fTaskDone;   ///< Notified when a task returns.
+
+        std::function<void(int)> fTask;
+        int                      fNTasks,     ///< Number of tasks of the last NTagThreadPool::Start.
+                                 fNextTask,   ///< Index of the next task to hand out.
+                                 fNDoneTasks; ///< Number of tasks that have returned.
+        std::vector<char>        fIsTaskDone; ///< Flags of tasks that have returned.
+        bool                     fStop;       ///< Set \c true to end the pool threads.
+};
+
+#endif
@@ -0,0 +1,222 @@
+/*******************************************
+*
+* @file NTagToFTable.hh
+*
+* @brief Defines NTagToFTable.
+*
+********************************************/
+
+#ifndef NTAGTOFTABLE_HH
+#define NTAGTOFTABLE_HH 1
+
+#include <vector>
+
+/********************************************************
+ * @brief The class for computing the time-of-flight (ToF)
+ * of photons from a vertex to PMTs.
+ *
+ * All PMT coordinates are kept in an aligned
+ * structure-of-arrays copy of `geopmt_.xyzpm`, shared
+ * by all instances and filled once by
+ * NTagToFTable::SetPMTGeometry after `geoset_`.
+ * The ToF kernels run on 8 PMTs at a time with AVX2 if
+ * NTag is built with `make NTAG_AVX2=1`, otherwise on
+ * one PMT at a time. Both give the same ToF, bit by bit,
+ * as NTagEventInfo::GetToF.
+ *
+ * An instance holds a table of ToF from one vertex
+ * (e.g., the prompt vertex of an event) to all PMTs,
+ * set by NTagToFTable::SetVertex. Residual hit times
+ * from that vertex are then a gather-and-subtract
+ * over the table with NTagToFTable::SubtractToF.
+ * For a vertex that is used only once, such as a grid
+ * point in NTagCandidate::MinimizeTRMS, use the static
+ * NTagToFTable::SubtractToF with the vertex given,
+ * which computes ToF for the hit PMTs only. TRMS at
+ * many such vertices is computed 8 vertices at a time
+ * with the vertex-parallel NTagToFTable::GetTRMS.
+ *******************************************************/
+class NTagToFTable
+{
+    public:
+        NTagToFTable();
+        ~NTagToFTable();
+
+        /**
+         * @brief Copies the PMT coordinates in `geopmt_.xyzpm` to the aligned arrays used by the kernels.
+         * @note Call after `geoset_`. NTagIO::SKInitialize calls this function.
+         */
+        static void SetPMTGeometry();
+
+        /**
+         * @brief Fills the ToF table with ToF from \p vertex to all PMTs.
+         * @param vertex A size-3 array of vertex coordinates. [cm]
+         */
+        void SetVertex(const float vertex[3]);
+
+        /**
+         * @brief Gets ToF from the vertex of the table to a PMT.
+         * @param pmtID Cable ID of a PMT minus 1, same as NTagEventInfo::GetToF.
+         * @return ToF [ns] from the vertex given in NTagToFTable::SetVertex to the PMT.
+         */
+        inline float GetToF(int pmtID) const { return fToF[pmtID]; }
+
+        /**
+         * @brief Subtracts ToF from the vertex of the table from each hit time.
+         * @param T An array of PMT hit times. [ns]
+         * @param cableID An array of PMT cable IDs corresponding to each hit in \p T.
+         * @param nHits Number of hits.
+         * @param t_ToF Output array of ToF-subtracted hit times. [ns] May be the same as \p T.
+         */
+        void SubtractToF(const float* T, const int* cableID, int nHits, float* t_ToF) const;
+
+        /**
+         * @brief Subtracts ToF from \p vertex from each hit time, without using a table.
+         * @param T An array of PMT hit times. [ns]
+         * @param cableID An array of PMT cable IDs corresponding to each hit in \p T.
+         * @param nHits Number of hits.
+         * @param vertex A size-3 array of vertex coordinates. [cm]
+         * @param t_ToF Output array of ToF-subtracted hit times. [ns] May be the same as \p T.
+         */
+        static void SubtractToF(const float* T, const int* cableID, int nHits,
+                                const float vertex[3], float* t_ToF);
+
+        /**
+         * @brief Gets the RMS of ToF-subtracted hit times from \p vertex, without allocation or sorting.
+         * @details ToF is subtracted in chunks of 8 hits (with the same kernel as NTagToFTable::SubtractToF),
+         * and the variance is accumulated in one pass in double precision with Welford's algorithm,
+         * which does not depend on the order of the hits. The result agrees with ::GetTRMS of the sorted
+         * ToF-subtracted hit times to float rounding.
+         * @param T An array of PMT hit times. [ns]
+         * @param cableID An array of PMT cable IDs corresponding to each hit in \p T.
+         * @param nHits Number of hits.
+         * @param vertex A size-3 array of vertex coordinates. [cm]
+         * @return The RMS [ns] of the ToF-subtracted hit times.
+         */
+        static float GetTRMS(const float* T, const int* cableID, int nHits, const float vertex[3]);
+
+        /**
+         * @brief Gets the RMS of ToF-subtracted hit times from each of many vertices.
+         * @details Vertices are processed 8 at a time, one vertex per SIMD lane, so that each hit
+         * PMT position is loaded once for all vertices in a batch. The Welford state of each lane stays
+         * in registers over the hits, and each batch is reduced once, with no buffer or sort. The result for each vertex is the
+         * same as the static NTagToFTable::GetTRMS of that vertex, bit by bit.
+         * @param T An array of PMT hit times. [ns]
+         * @param cableID An array of PMT cable IDs corresponding to each hit in \p T.
+         * @param nHits Number of hits.
+         * @param vertices An array of vertex coordinates [cm], as x, y, z of the first vertex, then
+         * x, y, z of the second vertex, and so on.
+         * @param nVertices Number of vertices.
+         * @param tRMS Output array of the RMS [ns] of the ToF-subtracted hit times from each vertex.
+         */
+        static void GetTRMS(const float* T, const int* cableID, int nHits,
+                            const float* vertices, int nVertices, float* tRMS);
+
+        /**
+         * @brief Gets the RMS of ToF-subtracted hit times from the vertex of the table.
+         * @details Same as the static NTagToFTable::GetTRMS with the vertex of the table, bit by bit,
+         * with ToF gathered from the table.
+         * @param T An array of PMT hit times. [ns]
+         * @param cableID An array of PMT cable IDs corresponding to each hit in \p T.
+         * @param nHits Number of hits.
+         * @return The RMS [ns] of the ToF-subtracted hit times.
+         */
+        float GetTRMS(const float* T, const int* cableID, int nHits) const;
+
+        /**
+         * @brief Gets the memory [MB] taken by one table.
+         */
+        static float GetTableSizeInMB();
+
+    private:
+        std::vector<float> fToF; ///< ToF [ns] from the vertex to each PMT, indexed by cable ID minus 1.
+};
+
+/********************************************************
+ * @brief The class for precomputed ToF tables of
+ * the coarse grid points in NTagCandidate::MinimizeTRMS.
+ *
+ * The first iterations of the Neut-fit grid search visit
+ * the same grid points for every candidate: the first
+ * level is centered at the tank center, and each
+ * following level is centered at one of the points of
+ * the previous levels. This class holds an NTagToFTable
+ * for each of those points, so that the TRMS at a grid
+ * point becomes a gather from the table plus a variance.
+ *
+ * The tables are built once with
+ * NTagGridToFTable::Build, with the grid search settings
+ * #NTagEventInfo::VTXSRCRANGE and
+ * #NTagEventInfo::MINGRIDWIDTH. The number of levels
+ * to tabulate sets the resolution of the table: each
+ * additional level halves the grid width, and takes
+ * about 8 times more memory than the previous level.
+ * Levels that exceed the given memory limit are not
+ * tabulated, and the grid search computes ToF directly
+ * for those levels.
+ *
+ * A grid point is looked up by the level, the table row
+ * of the grid origin of that level, and its grid indices.
+ *
+ * @see NTagCandidate::MinimizeTRMS
+ *******************************************************/
+class NTagGridToFTable
+{
+    public:
+        NTagGridToFTable();
+        ~NTagGridToFTable();
+
+        /**
+         * @brief Builds ToF tables for the first \p nLevels levels of the grid search.
+         * @param maxSearchRange Vertex search range. [cm] Same as #NTagEventInfo::VTXSRCRANGE.
+         * @param minGridWidth Minimum grid width. [cm] Same as #NTagEventInfo::MINGRIDWIDTH.
+         * @param nLevels Number of grid levels to tabulate.
+         * @param maxMemory Memory limit [MB] of the tables.
+         * @return Number of levels tabulated, which can be smaller than \p nLevels
+         * if the memory limit is reached or the grid search ends before.
+         */
+        int Build(float maxSearchRange, float minGridWidth, int nLevels, float maxMemory);
+
+        /**
+         * @brief Gets the table row of a grid point.
+         * @param level Grid level, starting from 0.
+         * @param originRow The table row of the grid origin of \p level. Not used for level 0.
+         * @param iGridX Grid index in X.
+         * @param iGridY Grid index in Y.
+         * @param iGridZ Grid index in Z.
+         * @return The table row of the grid point, or -1 if the grid point is not tabulated.
+         */
+        inline int GetRow(int level, int originRow, int iGridX, int iGridY, int iGridZ) const
+        {
+            if (level >= fNLevels) return -1;
+            if (level > 0 && (originRow < 0 || originRow >= fNRowsBeforeLevel[level])) return -1;
+            int key = (level > 0) ? originRow : 0;
+            return fPointIndex[level][((key*fNGridsInR + iGridX)*fNGridsInR + iGridY)*fNGridsInZ + iGridZ];
+        }
+
+        /**
+         * @brief Gets the ToF table of a table row.
+         * @param row A table row from NTagGridToFTable::GetRow.
+         */
+        inline const NTagToFTable& GetTable(int row) const { return fTables[row]; }
+
+        /**
+         * @brief Gets the number of tabulated grid levels.
+         */
+        inline int GetNLevels() const { return fNLevels; }
+
+        /**
+         * @brief Gets the number of tabulated grid points.
+         */
+        inline int GetNRows() const { return fTables.size(); }
+
+    private:
+        int fNLevels;                                ///< Number of tabulated grid levels.
+        int fNGridsInR,                              ///< Number of grids in X and Y.
+            fNGridsInZ;                              ///< Number of grids in Z.
+        std::vector<int> fNRowsBeforeLevel;          ///< Number of table rows from the levels before each level.
+        std::vector<std::vector<int>> fPointIndex;   ///< Table rows of grid points, per level.
+        std::vector<NTagToFTable> fTables;           ///< ToF tables, one for each table row.
+};
+
+#endif
@@ -22,6 +22,7 @@ extern "C" {
     int  skread_(int*);
     void skclosef_(int*);
     void skroot_init_(int*);
+    void skroot_jump_to_entry_(int*, int*, int*);
 }
 
 // data control
@@ -39,8 +40,8 @@ extern "C" {
 // BONSAI
 extern "C" {
     void bonsai_ini_();
-    void bonsai_fit_(int*, float*, float*, float*, int*, int*, float*, float*, float*,
-                     float*, float*, float*, float*, float*, float*);
+    void bonsai_fit_(int*, float*, float*, float*, float*, float*, float*, float*, float*,
+                     float*, float*);
     void bonsai_end_();
 }
 
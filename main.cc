@@ -1,5 +1,11 @@
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
 #include <iostream>
+#include <new>
+#include <vector>
 
 #include <TROOT.h>
 #include <TString.h>
@@ -10,6 +16,7 @@
 #include "NTagTMVA.hh"
 #include "NTagArgParser.hh"
 #include "NTagMessage.hh"
+#include "NTagBenchmark.hh"
 #include "NTagZBSTQReader.hh"
 #include "apmringC.h"
 
@@ -19,6 +26,9 @@ void PrintNTag();
 void PrintVersion();
 
 void ProcessSKFile(NTagIO* nt, NTagArgParser& parser);
+void TagSKFile(const std::string& outName, NTagArgParser& parser, Verbosity verbose, int iJob=0, int nJobs=1,
+               CascadeStats* cascadeStats=nullptr);
+void TagSKFileInJobs(NTagArgParser& parser, Verbosity verbose, int nJobs);
 
 static std::string inputName, outputName, weightName, methodName;
 static std::string installPath = GetENV("NTAGPATH");
@@ -53,7 +63,8 @@ int main(int argc, char** argv)
     if (GetCWD() != installPath)
         msg.Print(Form("Using NTag in $NTAGPATH: ") + installPath);
 
-    if (inputName.empty())  msg.Print("Please specify input file name: NTag -in [input file] ...", pERROR);
+    if (inputName.empty() && !parser.OptionExists("-benchmark"))
+        msg.Print("Please specify input file name: NTag -in [input file] ...", pERROR);
     if (weightName.empty()) weightName = installPath + "weights/MLP_Gd0.02p.xml";
     if (methodName.empty()) methodName = "MLP";
 
@@ -61,8 +72,18 @@ int main(int argc, char** argv)
     /* Main application */
     /********************/
 
+    // Benchmark NTag routines with synthetic events
+    if (parser.OptionExists("-benchmark")) {
+
+        msg.PrintBlock("Benchmark mode", pMAIN, pDEFAULT, false);
+
+        NTagBenchmark nt(100, pVERBOSE);
+        nt.Run();
+
+    }
+
     // Train with MC-based NTag output and generate new weights
-    if (parser.OptionExists("-train")) {
+    else if (parser.OptionExists("-train")) {
 
         if (outputName.empty())
             outputName = installPath + "weights/new/NTagTMVA_TestResults.root";
@@ -132,37 +153,111 @@ int main(int argc, char** argv)
 
         if (outputName.empty()) outputName = installPath + "out/NTagOut.root";
 
-        // Process SKROOT with TQREAL filled
-        if (TString(inputName).EndsWith(".root")) {
+        msg.PrintBlock("Tag mode", pMAIN, pDEFAULT, false);
+        msg.Print("Input file  : " + inputName);
+        msg.Print("Output file : " + outputName);
+
+        // Split the input file into forked jobs
+        const std::string &jobs = parser.GetOption("-jobs");
+        int nJobs = jobs.empty() ? 1 : std::stoi(jobs);
 
-            msg.PrintBlock("Tag mode", pMAIN, pDEFAULT, false);
-            msg.Print("Input file  : " + inputName);
-            msg.Print("Output file : " + outputName);
+        if (nJobs > 1) TagSKFileInJobs(parser, pVERBOSE, nJobs);
+        else           TagSKFile(outputName, parser, pVERBOSE);
 
-            NTagROOT* nt = new NTagROOT(inputName.c_str(), outputName.c_str(), pVERBOSE);
-            ProcessSKFile(nt, parser);
+        msg.Print(Form("NTag output with new TMVA output saved in: ") + outputName);
+    }
 
-            msg.Print(Form("NTag output with new TMVA output saved in: ") + outputName);
-            delete nt;
-        }
+    return 0;
+}
 
-        // Process ZBS
-        else {
+void TagSKFile(const std::string& outName, NTagArgParser& parser, Verbosity verbose, int iJob, int nJobs,
+               CascadeStats* cascadeStats)
+{
+    NTagIO* nt;
+
+    // Process SKROOT with TQREAL filled
+    if (TString(inputName).EndsWith(".root"))
+        nt = new NTagROOT(inputName.c_str(), outName.c_str(), verbose);
+
+    // Process ZBS
+    else
+        nt = new NTagZBS(inputName.c_str(), outName.c_str(), verbose);
 
-            msg.PrintBlock("Tag mode", pMAIN, pDEFAULT, false);
-            msg.Print("Input file  : " + inputName);
-            msg.Print("Output file : " + outputName);
+    nt->SetJob(iJob, nJobs);
+    ProcessSKFile(nt, parser);
+    if (cascadeStats) *cascadeStats = nt->GetCascadeStats();
 
-            NTagZBS* nt = new NTagZBS(inputName.c_str(), outputName.c_str(), pVERBOSE);
-            ProcessSKFile(nt, parser);
+    delete nt;
+}
+
+void TagSKFileInJobs(NTagArgParser& parser, Verbosity verbose, int nJobs)
+{
+    NTagMessage msg("");
 
-            msg.Print(Form("NTag output with new TMVA output saved in: ") + outputName);
-            delete nt;
+    std::vector<std::string> jobOutputNames;
+    std::vector<pid_t> jobPIDs;
+
+    // SKROOT jobs jump to contiguous ranges of entries, and ZBS jobs read the whole input taking turns
+    bool areJobsInterleaved = !TString(inputName).EndsWith(".root");
+    if (areJobsInterleaved)
+        msg.Print(Form("Tagging with %d jobs taking turns of %d events...", nJobs, NTagIO::JOBBLOCKSIZE));
+    else
+        msg.Print(Form("Tagging with %d jobs on contiguous ranges of entries...", nJobs));
+
+    // Cascade counters of each job, summed by this process
+    size_t jobStatsSize = nJobs * sizeof(CascadeStats);
+    void* jobStatsMemory = mmap(NULL, jobStatsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (jobStatsMemory == MAP_FAILED)
+        msg.Print(Form("Failed to map %lu bytes of shared memory!", jobStatsSize), pERROR);
+    CascadeStats* jobStats = static_cast<CascadeStats*>(jobStatsMemory);
+    for (int iJob = 0; iJob < nJobs; iJob++)
+        new (jobStats + iJob) CascadeStats();
+
+    // Flush before forking, so that the jobs don't print the buffered output again
+    std::cout << std::flush;
+
+    for (int iJob = 0; iJob < nJobs; iJob++) {
+        jobOutputNames.push_back(outputName + Form(".job%d", iJob));
+
+        pid_t pid = fork();
+        if (pid < 0)
+            msg.Print("Failed to fork a job!", pERROR);
+
+        // Job: tag and exit
+        if (pid == 0) {
+            TagSKFile(jobOutputNames.back(), parser, verbose, iJob, nJobs, jobStats + iJob);
+            std::cout << std::flush;
+            _exit(0);
         }
 
+        jobPIDs.push_back(pid);
     }
 
-    return 0;
+    bool isJobFailed = false;
+    for (int iJob = 0; iJob < nJobs; iJob++) {
+        int status;
+        waitpid(jobPIDs[iJob], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            msg.Print(Form("Job %d failed!", iJob), pWARNING);
+            isJobFailed = true;
+        }
+    }
+    if (isJobFailed)
+        msg.Print("Not merging job outputs. Job outputs are kept in: " + outputName + ".job*", pERROR);
+
+    msg.Print("Merging job outputs...");
+    NTagIO::MergeJobOutputs(outputName.c_str(), jobOutputNames, areJobsInterleaved);
+
+    if (!parser.GetOption("-cascade").empty()) {
+        CascadeStats cascadeStats;
+        for (int iJob = 0; iJob < nJobs; iJob++)
+            cascadeStats += jobStats[iJob];
+        NTagEventInfo::PrintCascadeStats(cascadeStats, msg);
+    }
+    munmap(jobStatsMemory, jobStatsSize);
+
+    for (auto const& jobOutputName: jobOutputNames)
+        std::remove(jobOutputName.c_str());
 }
 
 void ProcessSKFile(NTagIO* nt, NTagArgParser& parser)
@@ -221,6 +316,77 @@ void ProcessSKFile(NTagIO* nt, NTagArgParser& parser)
         nt->SetMinGridWidth(std::stof(MINGRIDWIDTH));
     }
 
+    // Set Neut-fit minimizer
+    const std::string &NEUTFITMODE = parser.GetOption("-NEUTFITMODE");
+    if (!NEUTFITMODE.empty()) {
+        if (NEUTFITMODE == "grid")    nt->SetNeutFitMode(mGRID);
+        else if (NEUTFITMODE == "lm") nt->SetNeutFitMode(mLM);
+        else if (NEUTFITMODE == "bnb") nt->SetNeutFitMode(mBNB);
+        else msg.Print("Unknown Neut-fit mode " + NEUTFITMODE + ": use grid, lm or bnb.", pERROR);
+    }
+
+    // Set number of Neut-fit grid levels to seed the LM minimizer with
+    const std::string &LMSEEDLEVELS = parser.GetOption("-LMSEEDLEVELS");
+    if (!LMSEEDLEVELS.empty()) {
+        nt->SetLMSeedLevels(std::stoi(LMSEEDLEVELS));
+    }
+
+    // Set number of Neut-fit grid levels to precompute ToF tables for
+    const std::string &GRIDTABLELEVELS = parser.GetOption("-GRIDTABLELEVELS");
+    if (!GRIDTABLELEVELS.empty()) {
+        nt->SetGridTableLevels(std::stoi(GRIDTABLELEVELS));
+    }
+
+    // Set memory limit of Neut-fit grid ToF tables
+    const std::string &GRIDTABLEMEM = parser.GetOption("-GRIDTABLEMEM");
+    if (!GRIDTABLEMEM.empty()) {
+        nt->SetGridTableMemory(std::stof(GRIDTABLEMEM));
+    }
+
+    // Set maximum number of hit triplets for opening angle statistics
+    const std::string &ANGLESAMPLE = parser.GetOption("-ANGLESAMPLE");
+    if (!ANGLESAMPLE.empty()) {
+        nt->SetOpeningAngleSample(std::stoi(ANGLESAMPLE));
+    }
+
+    // Set number of threads for candidate features
+    const std::string &threads = parser.GetOption("-threads");
+    if (!threads.empty()) {
+        nt->SetNumberOfThreads(std::stoi(threads));
+    }
+
+    // Set number of worker threads tagging events
+    const std::string &workers = parser.GetOption("-workers");
+    if (!workers.empty()) {
+        nt->SetNumberOfWorkers(std::stoi(workers));
+    }
+
+    // Set number of processes running BONSAI fits
+    const std::string &bonsaiprocs = parser.GetOption("-bonsaiprocs");
+    if (!bonsaiprocs.empty()) {
+        nt->SetNumberOfBonsaiProcesses(std::stoi(bonsaiprocs));
+    }
+
+    // Set range of input entries
+    const std::string &skip    = parser.GetOption("-skip");
+    const std::string &nevents = parser.GetOption("-nevents");
+    if (!skip.empty() || !nevents.empty()) {
+        nt->SetEntryRange(skip.empty() ? 0 : std::stoi(skip), nevents.empty() ? -1 : std::stoi(nevents));
+    }
+
+    // Set cascade cuts on the cheap features, e.g., "TRMS:0:5,N200:0:50"
+    TString cascadeCuts = TString(parser.GetOption("-cascade"));
+    if (!cascadeCuts.IsNull()) {
+        TObjArray* cutArray = cascadeCuts.Tokenize(",");
+        for (int i = 0; i < cutArray->GetEntries(); i++) {
+            TString cut = ((TObjString *)(cutArray->At(i)))->String();
+            char key[64]; float low, up;
+            if (sscanf(cut.Data(), "%63[^:]:%f:%f", key, &low, &up) != 3)
+                msg.Print("Invalid cascade cut " + cut + ": use Key:low:up.", pERROR);
+            nt->SetCascadeCutRange(key, low, up);
+        }
+    }
+
     // Set prompt vertex resolution
     const std::string &PVXRES = parser.GetOption("-PVXRES");
     if (!PVXRES.empty()) {
@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Checks that -skip, -nevents and -jobs tag an input as a single NTag run does:
+#   1. NTag -in (input)                         : reference
+#   2. NTag -in (input) -nevents (skip)
+#      NTag -in (input) -skip (skip)            : the two ranges chained must equal 1
+#   3. NTag -in (input) -jobs (jobs)            : must equal 1
+#   4. NTag -in (input) -skip (skip) -jobs (jobs) : must equal the second range of 2
+# The trees ntvar, truth and restq are compared branch by branch, value by value.
+#
+# Usage: scripts/check_ranges.sh (input) [skip, default 250] [jobs, default 3] [other NTag options]
+
+if [ $# -lt 1 ]; then
+    echo "[NTag] Usage: $0 (input) [skip] [jobs] [other NTag options]"
+    exit 1
+fi
+
+input=$1
+skip=${2:-250}
+jobs=${3:-3}
+shift $(( $# < 3 ? $# : 3 ))
+options="$@"
+
+dir=$(mktemp -d)
+trap "rm -rf $dir" EXIT
+
+run() {
+    local out=$1; shift
+    NTag -in $input -out $dir/$out $options "$@" > $dir/$out.log 2>&1 \
+    || { echo "[NTag] NTag $* failed, see below."; tail -n 20 $dir/$out.log; exit 1; }
+}
+
+run ref.root
+run first.root  -nevents $skip
+run second.root -skip $skip
+run jobs.root   -jobs $jobs
+run skipjobs.root -skip $skip -jobs $jobs
+
+cat > $dir/compare.C << 'EOF'
+// Returns the number of branches that differ between the chains of files refFiles and testFiles
+int compare(const char* refFiles, const char* testFiles)
+{
+    int nDiffs = 0;
+
+    for (const char* treeName: {"ntvar", "truth", "restq"}) {
+        TChain ref(treeName), test(treeName);
+        std::unique_ptr<TObjArray> refNames(TString(refFiles).Tokenize(" "));
+        std::unique_ptr<TObjArray> testNames(TString(testFiles).Tokenize(" "));
+        for (auto name: *refNames)  ref.Add(name->GetName());
+        for (auto name: *testNames) test.Add(name->GetName());
+
+        if (ref.GetEntries() != test.GetEntries()) {
+            std::cout << "[NTag] " << treeName << ": " << ref.GetEntries() << " entries, but "
+                      << test.GetEntries() << " in " << testFiles << std::endl;
+            nDiffs++;
+            continue;
+        }
+        if (ref.GetEntries() == 0) continue;
+
+        ref.SetEstimate(-1);
+        test.SetEstimate(-1);
+        ref.LoadTree(0);
+
+        for (auto branch: *ref.GetListOfBranches()) {
+            const char* branchName = branch->GetName();
+            Long64_t nRef  = ref.Draw(branchName, "", "goff");
+            Long64_t nTest = test.Draw(branchName, "", "goff");
+
+            bool isSame = nRef == nTest;
+            for (Long64_t i = 0; isSame && i < nRef; i++) {
+                double a = ref.GetV1()[i], b = test.GetV1()[i];
+                isSame = a == b || (std::isnan(a) && std::isnan(b));
+            }
+            if (!isSame) {
+                std::cout << "[NTag] " << treeName << "/" << branchName << " differs in " << testFiles << std::endl;
+                nDiffs++;
+            }
+        }
+    }
+    return nDiffs;
+}
+EOF
+
+check() {
+    root -l -b -q "$dir/compare.C(\"$1\", \"$2\")" > $dir/compare.log 2>&1
+    local nDiffs=$(grep -c "differs\|entries, but" $dir/compare.log)
+    if [ $nDiffs -eq 0 ] && grep -q "(int) 0" $dir/compare.log; then
+        echo "[NTag] $3: same as a single run."
+    else
+        cat $dir/compare.log
+        echo "[NTag] $3: DIFFERS from a single run!"
+        failed=1
+    fi
+}
+
+failed=0
+check "$dir/ref.root"    "$dir/first.root $dir/second.root" "-nevents $skip + -skip $skip"
+check "$dir/ref.root"    "$dir/jobs.root"                   "-jobs $jobs"
+check "$dir/second.root" "$dir/skipjobs.root"               "-skip $skip -jobs $jobs"
+exit $failed
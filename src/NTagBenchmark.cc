@@ -0,0 +1,846 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+#include <TMath.h>
+
+#include <geotnkC.h>
+#include <skheadC.h>
+#include <sktqC.h>
+
+#include "SKLibs.hh"
+#include "NTagCalculator.hh"
+#include "NTagEventInfo.hh"
+#include "NTagBenchmark.hh"
+
+NTagBenchmark::NTagBenchmark(int nEvents, Verbosity verbose)
+: fNEvents(nEvents), fRandom(4357), msg("Benchmark", verbose) {}
+NTagBenchmark::~NTagBenchmark() {}
+
+void NTagBenchmark::Run()
+{
+    // SK geometry for PMT positions
+    skheadg_.sk_geometry = 5; geoset_();
+    NTagToFTable::SetPMTGeometry();
+
+    msg.Print(Form("Generating %d synthetic events per benchmark...", fNEvents));
+
+    BenchmarkHitWindow();
+    BenchmarkTRMSKernel();
+    BenchmarkBatchedTRMS();
+    BenchmarkNeutFitGrid();
+    BenchmarkOpeningAngleStats();
+    BenchmarkBetaArray();
+    BenchmarkHitSort();
+    BenchmarkBlockSort();
+    BenchmarkNeutFitLM();
+    BenchmarkNeutFitPruned();
+
+    // BONSAI for the BONSAI benchmarks
+    msg.Print("Initializing BONSAI...");
+    kzinit_();
+    bonsai_ini_();
+
+    BenchmarkBonsaiHits();
+    BenchmarkBonsaiPool();
+}
+
+void NTagBenchmark::BenchmarkHitWindow()
+{
+    float tWidth = 14.;
+    float refTime = 0., newTime = 0.;
+    std::vector<float> sortedT, Q;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateAFTHits(sortedT, Q);
+        int nHits = sortedT.size();
+
+        std::vector<int> refNHits(nHits), newNHits(nHits);
+        std::vector<double> newQSum(nHits);
+
+        // Reference: build a time vector for every hit
+        std::clock_t tStart = std::clock();
+        for (int iHit = 0; iHit < nHits; iHit++)
+            refNHits[iHit] = GetVectorFromStartIndex(sortedT, iHit, tWidth).size();
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: slide a window over all hits
+        tStart = std::clock();
+        HitWindow window;
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            SlideHitWindow(window, sortedT, Q, iHit, tWidth);
+            newNHits[iHit] = window.nHits;
+            newQSum[iHit] = window.qSum;
+        }
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            double qSum = 0.;
+            for (int jHit = iHit; jHit < iHit + refNHits[iHit]; jHit++)
+                qSum += Q[jHit];
+
+            if (newNHits[iHit] != refNHits[iHit] || fabs(newQSum[iHit] - qSum) > 1e-6 * (1. + qSum))
+                msg.Print(Form("HitWindow mismatch in event %d at hit %d: NHits %d (ref: %d), QSum %f (ref: %f)",
+                               iEvent, iHit, newNHits[iHit], refNHits[iHit], newQSum[iHit], qSum), pERROR);
+        }
+    }
+
+    PrintResult("HitWindow", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkTRMSKernel()
+{
+    float refTime = 0., newTime = 0.;
+    float maxRelDiff = 0.;
+    std::vector<float> T, t_ToF;
+    std::vector<int> cableID;
+    std::vector<std::array<float, 3>> gridPoints;
+    GetDefaultGridPoints(gridPoints);
+    int nPoints = gridPoints.size();
+    std::vector<float> refTRMS(nPoints), newTRMS(nPoints);
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateCaptureHits(50, T, cableID);
+        int nHits = T.size();
+
+        // Reference: subtract ToF as NTagEventInfo::GetToF, sort, and take two-pass RMS
+        std::clock_t tStart = std::clock();
+        for (int iPoint = 0; iPoint < nPoints; iPoint++) {
+            t_ToF.resize(nHits);
+            for (int iHit = 0; iHit < nHits; iHit++)
+                t_ToF[iHit] = T[iHit] - GetDistance(NTagConstant::PMTXYZ[cableID[iHit]-1], gridPoints[iPoint].data())
+                                        / NTagConstant::C_WATER;
+            std::sort(t_ToF.begin(), t_ToF.end());
+            refTRMS[iPoint] = GetTRMS(t_ToF);
+        }
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: fused kernel
+        tStart = std::clock();
+        for (int iPoint = 0; iPoint < nPoints; iPoint++)
+            newTRMS[iPoint] = NTagToFTable::GetTRMS(T.data(), cableID.data(), nHits, gridPoints[iPoint].data());
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: the reference accumulates in float, within the rounding margin of the pruned search
+        for (int iPoint = 0; iPoint < nPoints; iPoint++) {
+            float relDiff = fabs(newTRMS[iPoint] - refTRMS[iPoint]) / refTRMS[iPoint];
+            maxRelDiff = std::max(maxRelDiff, relDiff);
+            if (relDiff > 1e-5)
+                msg.Print(Form("TRMS mismatch in event %d at grid point %d: %f (ref: %f)",
+                               iEvent, iPoint, newTRMS[iPoint], refTRMS[iPoint]), pERROR);
+        }
+    }
+
+    msg.Print(Form("TRMS kernel: max. relative difference from reference %e", maxRelDiff));
+    PrintResult("TRMSKernel", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkBatchedTRMS()
+{
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T;
+    std::vector<int> cableID;
+    std::vector<std::array<float, 3>> gridPoints;
+    GetDefaultGridPoints(gridPoints);
+    int nPoints = gridPoints.size();
+    std::vector<float> refTRMS(nPoints), newTRMS(nPoints);
+
+    // Grid point coordinates, 3 per grid point
+    std::vector<float> points;
+    for (const auto& gridPoint: gridPoints)
+        points.insert(points.end(), gridPoint.begin(), gridPoint.end());
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateCaptureHits(50, T, cableID);
+        int nHits = T.size();
+
+        // Reference: single-vertex kernel for each grid point
+        std::clock_t tStart = std::clock();
+        for (int iPoint = 0; iPoint < nPoints; iPoint++)
+            refTRMS[iPoint] = NTagToFTable::GetTRMS(T.data(), cableID.data(), nHits, gridPoints[iPoint].data());
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: all grid points at once
+        tStart = std::clock();
+        NTagToFTable::GetTRMS(T.data(), cableID.data(), nHits, points.data(), nPoints, newTRMS.data());
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: both kernels should give the same TRMS, bit by bit
+        for (int iPoint = 0; iPoint < nPoints; iPoint++) {
+            if (newTRMS[iPoint] != refTRMS[iPoint])
+                msg.Print(Form("Batched TRMS mismatch in event %d at grid point %d: %f (ref: %f)",
+                               iEvent, iPoint, newTRMS[iPoint], refTRMS[iPoint]), pERROR);
+        }
+    }
+
+    PrintResult("BatchedTRMS", refTime, newTime);
+}
+
+// Opening angle statistics from all hit triplets, one TVector3 triplet at a time
+static std::array<float, 4> GetOpeningAngleStatsReference(const std::vector<int>& PMTID, float v[3])
+{
+    std::vector<float> openingAngles;
+    int nHits = PMTID.size();
+    int hit[3];
+
+    for (        hit[0] = 0;        hit[0] < nHits-2; hit[0]++) {
+        for (    hit[1] = hit[0]+1; hit[1] < nHits-1; hit[1]++) {
+            for (hit[2] = hit[1]+1; hit[2] < nHits;   hit[2]++) {
+                TVector3 u[3];
+                for (int i = 0; i < 3; i++) {
+                    // PMT lookup of the old loop, which read PMTID[-1] for the first hit:
+                    // the upper half of the heap chunk size before the vector, 0
+                    int pmt = hit[i] > 0 ? PMTID[hit[i]-1] : 0;
+                    float i_th_vec[3];
+                    for (int dim = 0; dim < 3; dim++)
+                        i_th_vec[dim] = NTagConstant::PMTXYZ[pmt][dim] - v[dim];
+                    u[i] = TVector3(i_th_vec).Unit();
+                }
+                openingAngles.push_back(GetOpeningAngle(u[0], u[1], u[2]));
+            }
+        }
+    }
+
+    return std::array<float, 4>{GetMean(openingAngles), GetMedian(openingAngles),
+                                GetTRMS(openingAngles), GetSkew(openingAngles)};
+}
+
+// Nested grid search of NTagCandidate::MinimizeTRMS before the TRMS kernels, with the default settings:
+// ::GetTRMS of the sorted ToF-subtracted hit times at each grid point
+static float MinimizeTRMSReference(NTagEventInfo& event, const std::vector<float>& T, const std::vector<int>& PMTID,
+                                   float rmsFitVertex[3])
+{
+    float maxSearchRange = NTagDefault::VTXSRCRANGE;
+    float gridWidth;
+    (maxSearchRange > 200) ? gridWidth = 500 : gridWidth = maxSearchRange / 2.;
+    std::vector<float> t_ToF;
+
+    int nGridsInZ = (int)(2*ZPINTK / gridWidth);
+    int nGridsInR = (int)(2*RINTK / gridWidth);
+
+    std::array<float, 3> gridOrigin = {0., 0., 0.};
+    std::array<float, 3> minGridPoint = {0., 0., 0.};
+    std::array<float, 3> gridPoint;
+
+    float minTRMS = 9999.;
+    float tRMS;
+
+    while (gridWidth > NTagDefault::MINGRIDWIDTH) {
+        for (int iGridX = 0; iGridX < nGridsInR; iGridX++) {
+            gridPoint[0] = gridOrigin[0] + (iGridX - nGridsInR/2.) * gridWidth ;
+            for (int iGridY = 0; iGridY < nGridsInR; iGridY++) {
+                gridPoint[1] = gridOrigin[1] + (iGridY - nGridsInR/2.) * gridWidth;
+                if (sqrt(gridPoint[0]*gridPoint[0] + gridPoint[1]*gridPoint[1]) > RINTK) continue;
+                for (int iGridZ = 0; iGridZ < nGridsInZ; iGridZ++) {
+                    gridPoint[2] = gridOrigin[2] + (iGridZ - nGridsInZ/2.) * gridWidth;
+                    if (gridPoint[2] > ZPINTK || gridPoint[2] < -ZPINTK) continue;
+                    if (GetDistance(gridOrigin.data(), gridPoint.data()) > maxSearchRange) continue;
+
+                    event.GetToFSubtracted(T, PMTID, gridPoint.data(), t_ToF, true);
+                    tRMS = GetTRMS(t_ToF);
+
+                    if (tRMS < minTRMS) {
+                        minTRMS = tRMS;
+                        minGridPoint = gridPoint;
+                    }
+                }
+            }
+        }
+        gridOrigin = minGridPoint;
+        gridWidth = gridWidth / 2.;
+    }
+
+    for (int i = 0; i < 3; i++) rmsFitVertex[i] = gridOrigin[i];
+
+    return minTRMS;
+}
+
+void NTagBenchmark::BenchmarkNeutFitGrid()
+{
+    // Neut-fit with the default settings and grid ToF table
+    NTagEventInfo event(pWARNING);
+    event.BuildGridToFTable();
+    event.SetNeutFitMode(mGRID);
+    NTagCandidate candidate(0, &event);
+
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T;
+    std::vector<int> cableID;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // Clusters of the size of the 50 ns window, with a single hit now and then
+        GenerateCaptureHits(iEvent % 10 ? 50 : 1, T, cableID);
+        float refVertex[3], newVertex[3];
+
+        // Reference: grid search with sorting and ::GetTRMS at each grid point
+        std::clock_t tStart = std::clock();
+        float refTRMS = MinimizeTRMSReference(event, T, cableID, refVertex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: grid search with the ToF tables and the TRMS kernels
+        tStart = std::clock();
+        float newTRMS = candidate.MinimizeTRMS(T, cableID, newVertex);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: the same MinTRMS and vertex, bit by bit
+        if (memcmp(&newTRMS, &refTRMS, sizeof(float)) || memcmp(newVertex, refVertex, sizeof(refVertex)))
+            msg.Print(Form("Neut-fit grid mismatch in event %d: TRMS %.9g (ref: %.9g), "
+                           "vertex (%f, %f, %f) (ref: (%f, %f, %f))",
+                           iEvent, newTRMS, refTRMS, newVertex[0], newVertex[1], newVertex[2],
+                           refVertex[0], refVertex[1], refVertex[2]), pERROR);
+    }
+
+    PrintResult("NeutFitGrid", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkOpeningAngleStats()
+{
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T;
+    std::vector<int> cableID;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateCaptureHits(NTagDefault::NHITSMX, T, cableID);
+        float vertex[3] = {(float)fRandom.Uniform(-1000., 1000.), (float)fRandom.Uniform(-1000., 1000.),
+                           (float)fRandom.Uniform(-1500., 1500.)};
+
+        // Reference: loop over all triplets with TVector3
+        std::clock_t tStart = std::clock();
+        auto refStats = GetOpeningAngleStatsReference(cableID, vertex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: precomputed unit vectors and triangle sides
+        tStart = std::clock();
+        auto newStats = GetOpeningAngleStats(HitGeometry(cableID, vertex));
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: same angles, so the same mean and median;
+        // the reference accumulates stdev and skewness in float
+        bool isMatched = (newStats[0] == refStats[0] && newStats[1] == refStats[1]);
+        for (int i = 2; i < 4; i++)
+            isMatched = isMatched && fabs(newStats[i] - refStats[i]) < 1e-4 * (fabs(refStats[i]) + 0.1);
+
+        // Same PMT hit twice gives NaN in both
+        if (std::isnan(refStats[0]) && std::isnan(newStats[0]))
+            isMatched = true;
+
+        if (!isMatched)
+            msg.Print(Form("Opening angle stats mismatch in event %d: "
+                           "mean %f (ref: %f), median %f (ref: %f), stdev %f (ref: %f), skewness %f (ref: %f)",
+                           iEvent, newStats[0], refStats[0], newStats[1], refStats[1],
+                           newStats[2], refStats[2], newStats[3], refStats[3]), pERROR);
+    }
+
+    PrintResult("OpeningAngleStats", refTime, newTime);
+}
+
+// Beta values from the sum over all hit pairs
+static std::array<float, 6> GetBetaArrayReference(const std::vector<int>& PMTID, float v[3])
+{
+    std::array<float, 6> beta = {0., 0., 0., 0., 0., 0};
+    int nHits = PMTID.size();
+    if (nHits == 0) return beta;
+
+    std::vector<float> uvx(nHits), uvy(nHits), uvz(nHits);
+    for (int iHit = 0; iHit < nHits; iHit++) {
+        float vecFromVertexToPMT[3];
+        for (int dim = 0; dim < 3; dim++)
+            vecFromVertexToPMT[dim] = NTagConstant::PMTXYZ[PMTID[iHit]-1][dim] - v[dim];
+        float distFromVertexToPMT = Norm(vecFromVertexToPMT);
+        uvx[iHit] = vecFromVertexToPMT[0] / distFromVertexToPMT;
+        uvy[iHit] = vecFromVertexToPMT[1] / distFromVertexToPMT;
+        uvz[iHit] = vecFromVertexToPMT[2] / distFromVertexToPMT;
+    }
+
+    for (int i = 0; i < nHits-1; i++) {
+        for (int j = i+1; j < nHits; j++) {
+            float cosTheta = uvx[i]*uvx[j] + uvy[i]*uvy[j] + uvz[i]*uvz[j];
+            for (int k = 1; k <= 5; k++)
+                beta[k] += GetLegendreP(k, cosTheta);
+        }
+    }
+
+    for (int k = 1; k <= 5; k++)
+        beta[k] = 2.*beta[k] / float(nHits) / float(nHits-1);
+
+    return beta;
+}
+
+void NTagBenchmark::BenchmarkBetaArray()
+{
+    float refTime = 0., newTime = 0.;
+    float maxDiff = 0.;
+    std::vector<float> T;
+    std::vector<int> cableID;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateCaptureHits(NTagDefault::NHITSMX, T, cableID);
+        float vertex[3] = {(float)fRandom.Uniform(-1000., 1000.), (float)fRandom.Uniform(-1000., 1000.),
+                           (float)fRandom.Uniform(-1500., 1500.)};
+
+        // Reference: Legendre polynomials of all hit pairs
+        std::clock_t tStart = std::clock();
+        auto refBeta = GetBetaArrayReference(cableID, vertex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: spherical harmonic moments
+        tStart = std::clock();
+        auto newBeta = GetBetaArray(HitGeometry(cableID, vertex));
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: the reference accumulates in float
+        for (int k = 1; k <= 5; k++) {
+            float diff = fabs(newBeta[k] - refBeta[k]);
+            maxDiff = std::max(maxDiff, diff);
+            if (diff > 1e-4)
+                msg.Print(Form("Beta%d mismatch in event %d: %f (ref: %f)", k, iEvent, newBeta[k], refBeta[k]), pERROR);
+        }
+    }
+
+    msg.Print(Form("Beta array: max. difference from reference %e", maxDiff));
+    PrintResult("BetaArray", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkHitSort()
+{
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T, Q;
+    std::vector<int> refIndex, newIndex;
+    std::vector<bool> isSorted;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // ToF-subtracted hit times: raw hit times in order, minus ToF up to ~200 ns
+        GenerateAFTHits(T, Q);
+        int nHits = T.size();
+        for (int iHit = 0; iHit < nHits; iHit++)
+            T[iHit] -= fRandom.Uniform(0., 200.);
+
+        refIndex.resize(nHits);
+
+        // Reference: comparison sort
+        std::clock_t tStart = std::clock();
+        TMath::Sort(nHits, T.data(), refIndex.data(), false);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: radix sort
+        tStart = std::clock();
+        GetSortedIndex(T.data(), nHits, newIndex);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: same sorted times, and each hit appears once
+        isSorted.assign(nHits, false);
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            int index = newIndex[iHit];
+            if (index < 0 || index >= nHits || isSorted[index] || T[index] != T[refIndex[iHit]]) {
+                msg.Print(Form("HitSort mismatch in event %d at sorted hit %d: T %f (ref: %f)",
+                               iEvent, iHit, T[index], T[refIndex[iHit]]), pERROR);
+                break;
+            }
+            isSorted[index] = true;
+        }
+    }
+
+    PrintResult("HitSort", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkBlockSort()
+{
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T, Q;
+    std::vector<int> refIndex, newIndex, blockStart;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // SHE block up to 35 us, and AFT block after
+        GenerateAFTHits(T, Q);
+        int nHits = T.size();
+        blockStart.assign(1, 0);
+        blockStart.push_back(std::lower_bound(T.begin(), T.end(), 35000.) - T.begin());
+
+        // ToF-subtracted hit times: raw hit times in order, minus ToF up to ~200 ns
+        for (int iHit = 0; iHit < nHits; iHit++)
+            T[iHit] -= fRandom.Uniform(0., 200.);
+
+        // Reference: radix sort of all hits
+        std::clock_t tStart = std::clock();
+        GetSortedIndex(T.data(), nHits, refIndex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: insertion sort of each block and merge
+        tStart = std::clock();
+        GetSortedIndexOfBlocks(T.data(), nHits, blockStart, newIndex);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: both sorts are stable
+        if (newIndex != refIndex) {
+            int iHit = std::mismatch(newIndex.begin(), newIndex.end(), refIndex.begin()).first - newIndex.begin();
+            msg.Print(Form("BlockSort mismatch in event %d at sorted hit %d: T %f (ref: %f)",
+                           iEvent, iHit, T[newIndex[iHit]], T[refIndex[iHit]]), pERROR);
+        }
+    }
+
+    PrintResult("BlockSort", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkNeutFitLM()
+{
+    // Neut-fit with the default settings and grid ToF table
+    NTagEventInfo event(pWARNING);
+    event.BuildGridToFTable();
+    NTagCandidate candidate(0, &event);
+
+    float refTime = 0., newTime = 0.;
+    float minGridWidth = NTagDefault::MINGRIDWIDTH;
+    std::vector<float> T, distances;
+    std::vector<int> cableID;
+    int nLowerTRMS = 0, nWithinGridWidth = 0;
+    long nRefEval = 0, nNewEval = 0;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        GenerateCaptureHits(40, T, cableID);
+        float refVertex[3], newVertex[3], seedVertex[3];
+
+        // Reference: nested grid search
+        event.SetNeutFitMode(mGRID);
+        std::clock_t tStart = std::clock();
+        float refTRMS = candidate.MinimizeTRMS(T, cableID, refVertex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+        nRefEval += candidate.nFitEvaluations;
+
+        // New: Levenberg-Marquardt from the coarsest grid levels
+        event.SetNeutFitMode(mLM);
+        tStart = std::clock();
+        float newTRMS = candidate.MinimizeTRMS(T, cableID, newVertex);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+        nNewEval += candidate.nFitEvaluations;
+
+        // Check results: the minimizer must not end above its seed
+        float seedTRMS = candidate.SearchTRMSGrid(T, cableID, seedVertex, NTagDefault::LMSEEDLEVELS);
+        if (!std::isfinite(newTRMS) || newTRMS > seedTRMS * (1 + 1e-5))
+            msg.Print(Form("Neut-fit LM TRMS in event %d is above its seed: %f (seed: %f, grid: %f)",
+                           iEvent, newTRMS, seedTRMS, refTRMS), pERROR);
+
+        float distance = GetDistance(refVertex, newVertex);
+        distances.push_back(distance);
+        if (distance < minGridWidth) nWithinGridWidth++;
+        if (newTRMS <= refTRMS) nLowerTRMS++;
+    }
+
+    msg.Print(Form("Neut-fit LM vs. grid: vertex distance mean %.1f cm, median %.1f cm, "
+                   "%d/%d within %.0f cm; TRMS equal or lower in %d/%d; TRMS evaluations %.0f (grid: %.0f) per event",
+                   GetMean(distances), GetMedian(distances), nWithinGridWidth, fNEvents, minGridWidth,
+                   nLowerTRMS, fNEvents, nNewEval / (float)fNEvents, nRefEval / (float)fNEvents));
+    PrintResult("NeutFitLM", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkNeutFitPruned()
+{
+    // Neut-fit with the default settings and grid ToF table
+    NTagEventInfo event(pWARNING);
+    event.BuildGridToFTable();
+    NTagCandidate candidate(0, &event);
+
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T;
+    std::vector<int> cableID;
+    long nRefEval = 0, nPruned = 0;
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // Clusters with a single hit, whose TRMS bounds nothing, now and then
+        GenerateCaptureHits(iEvent % 10 ? 40 : 1, T, cableID);
+        float refVertex[3], newVertex[3];
+
+        // Reference: nested grid search
+        event.SetNeutFitMode(mGRID);
+        std::clock_t tStart = std::clock();
+        float refTRMS = candidate.MinimizeTRMS(T, cableID, refVertex);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+        nRefEval += candidate.nFitEvaluations;
+
+        // New: the same search, skipping blocks of grid points by a TRMS bound
+        event.SetNeutFitMode(mBNB);
+        tStart = std::clock();
+        float newTRMS = candidate.MinimizeTRMS(T, cableID, newVertex);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+        nPruned += candidate.nFitPruned;
+
+        // Check results: the same vertex and TRMS, bit by bit
+        if (memcmp(&newTRMS, &refTRMS, sizeof(float)) || memcmp(newVertex, refVertex, sizeof(refVertex)))
+            msg.Print(Form("Neut-fit pruned mismatch in event %d: TRMS %f (grid: %f), "
+                           "vertex (%f, %f, %f) (grid: (%f, %f, %f))",
+                           iEvent, newTRMS, refTRMS, newVertex[0], newVertex[1], newVertex[2],
+                           refVertex[0], refVertex[1], refVertex[2]), pERROR);
+    }
+
+    msg.Print(Form("Neut-fit pruned vs. grid: %.0f of %.0f grid points skipped per event",
+                   nPruned / (float)fNEvents, nRefEval / (float)fNEvents));
+    PrintResult("NeutFitPruned", refTime, newTime);
+}
+
+// BONSAI input hits as set by the hit loop of bonsai.F before NTagBonsaiPool::Fit
+static void SetBonsaiHitsReference(float reconCT, const std::vector<float>& T, const std::vector<float>& Q,
+                                   const std::vector<int>& cableID)
+{
+    // 1-based, as in Fortran
+    float* tisk  = skt_.tisk - 1;
+    float* qisk  = skq_.qisk - 1;
+    int*   ihcab = skchnl_.ihcab - 1;
+
+    std::fill(skt_.tisk, skt_.tisk + MAXPM, 0.f);
+    std::fill(skq_.qisk, skq_.qisk + MAXPM, 0.f);
+    std::fill(skchnl_.ihcab, skchnl_.ihcab + MAXPM, 0);
+
+    skq_.nqisk  = 0;
+    skq_.mxqisk = 0;
+    float mxq   = 0;
+
+    int nHits = T.size();
+    for (int i = 1; i <= nHits; i++) {
+        int dupID = 0;
+        for (int j = 1; j < i; j++)
+            if (cableID[i-1] == cableID[j-1]) dupID = j;
+
+        if (dupID) {
+            if (ihcab[dupID]) qisk[ihcab[dupID]] += Q[i-1];
+            else {
+                // qisk(0), out of bounds: the word before qisk in /SKQ/
+                char* qisk0 = reinterpret_cast<char*>(skq_.qisk) - sizeof(float);
+                float value;
+                memcpy(&value, qisk0, sizeof(float));
+                value += Q[i-1];
+                memcpy(qisk0, &value, sizeof(float));
+            }
+        }
+        else {
+            ihcab[i] = cableID[i-1];
+            tisk[ihcab[i]] = T[i-1] - reconCT + 1000;
+            qisk[ihcab[i]] = Q[i-1];
+            skq_.nqisk++;
+
+            if (qisk[ihcab[i]] > mxq) {
+                mxq = qisk[ihcab[i]];
+                skq_.mxqisk = ihcab[i];
+            }
+        }
+    }
+}
+
+void NTagBenchmark::BenchmarkBonsaiHits()
+{
+    float refTime = 0., newTime = 0.;
+    std::vector<float> T, Q;
+    std::vector<int> cableID;
+    std::vector<float> refT(MAXPM), refQ(MAXPM);
+    std::vector<int> refCable(MAXPM);
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // Many hits from a capture and dark noise, some PMTs hit more than once
+        GenerateCaptureHits(2000, T, cableID);
+        int nHits = T.size();
+        Q.resize(nHits);
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            T[iHit] += fRandom.Uniform(-500., 500.);
+            Q[iHit] = fRandom.Uniform(0.5, 1.5);
+        }
+        float reconCT = fRandom.Uniform(1000., 1100.);
+        bool isData = iEvent % 2;
+
+        // Hits of other events left in the common blocks, e.g., by skread
+        if (iEvent % 10 == 0) {
+            for (int iPMT = 0; iPMT < MAXPM; iPMT++) {
+                skt_.tisk[iPMT] = fRandom.Uniform(0., 2000.);
+                skq_.qisk[iPMT] = fRandom.Uniform(0., 10.);
+                skchnl_.ihcab[iPMT] = fRandom.Integer(MAXPM) + 1;
+            }
+            NTagBonsaiPool::SetHitsOverwritten();
+        }
+
+        // Reference: the O(nHits^2) hit loop of bonsai.F
+        std::clock_t tStart = std::clock();
+        SetBonsaiHitsReference(reconCT, T, Q, cableID);
+        int bData = isData ? 1 : 0;
+        NTagBonsaiFit refFit;
+        bonsai_fit_(&bData, &reconCT,
+                    &refFit.energy, &refFit.vx, &refFit.vy, &refFit.vz, &refFit.t,
+                    &refFit.good, &refFit.dirks, &refFit.patlik, &refFit.ovaq);
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        int refNHits = skq_.nqisk, refMaxQCable = skq_.mxqisk;
+        std::copy(skt_.tisk, skt_.tisk + MAXPM, refT.begin());
+        std::copy(skq_.qisk, skq_.qisk + MAXPM, refQ.begin());
+        std::copy(skchnl_.ihcab, skchnl_.ihcab + MAXPM, refCable.begin());
+
+        // New: NTagBonsaiPool::Fit, which clears only the hits of the last fit.
+        // The reference has set the same hits as this fit, so that nothing else is left to clear.
+        tStart = std::clock();
+        NTagBonsaiFit newFit = NTagBonsaiPool::Fit(isData, reconCT, T.data(), Q.data(), cableID.data(), nHits);
+        newTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // Check results: the same hits in all PMTs, bit by bit, and the same fit
+        bool isHitMatched = skq_.nqisk == refNHits && skq_.mxqisk == refMaxQCable
+                            && std::equal(refT.begin(), refT.end(), skt_.tisk)
+                            && std::equal(refQ.begin(), refQ.end(), skq_.qisk)
+                            && std::equal(refCable.begin(), refCable.end(), skchnl_.ihcab);
+
+        if (!isHitMatched || memcmp(&newFit, &refFit, sizeof(NTagBonsaiFit)))
+            msg.Print(Form("BONSAI fit mismatch in event %d: hits %s, energy %f (ref: %f), "
+                           "vertex (%f, %f, %f) (ref: (%f, %f, %f))",
+                           iEvent, isHitMatched ? "matched" : "mismatched", newFit.energy, refFit.energy,
+                           newFit.vx, newFit.vy, newFit.vz, refFit.vx, refFit.vy, refFit.vz), pERROR);
+    }
+
+    PrintResult("BonsaiHits", refTime, newTime);
+}
+
+void NTagBenchmark::BenchmarkBonsaiPool()
+{
+    const int nProcesses = 2, nCandidates = 8;
+    float refTime = 0., newTime = 0.;
+    std::vector<std::vector<float>> T(nCandidates), Q(nCandidates);
+    std::vector<std::vector<int>> cableID(nCandidates);
+    std::vector<float> reconCT(nCandidates);
+
+    // Forked with the run state of the first run
+    skhead_.nrunsk = 85000;
+    NTagBonsaiPool pool(nProcesses, pWARNING);
+
+    for (int iEvent = 0; iEvent < fNEvents; iEvent++) {
+
+        // Events of other runs, read after the fork
+        skhead_.nrunsk = 85000 + 1000 * (iEvent % 5);
+        skhead_.nevsk  = iEvent;
+        bool isData = iEvent % 2;
+
+        for (int iCandidate = 0; iCandidate < nCandidates; iCandidate++) {
+            GenerateCaptureHits(50, T[iCandidate], cableID[iCandidate]);
+            Q[iCandidate].resize(T[iCandidate].size());
+            for (auto& q: Q[iCandidate]) q = fRandom.Uniform(0.5, 1.5);
+            reconCT[iCandidate] = fRandom.Uniform(1000., 1100.);
+        }
+
+        // Reference: fits in this process
+        std::vector<NTagBonsaiFit> refFits;
+        std::clock_t tStart = std::clock();
+        for (int iCandidate = 0; iCandidate < nCandidates; iCandidate++)
+            refFits.push_back(NTagBonsaiPool::Fit(isData, reconCT[iCandidate], T[iCandidate].data(),
+                                                  Q[iCandidate].data(), cableID[iCandidate].data(),
+                                                  T[iCandidate].size()));
+        refTime += (std::clock() - tStart) / (float) CLOCKS_PER_SEC;
+
+        // New: fits in the pool processes, submitted from two threads sharing the pool as the worker threads do,
+        // timed in wall-clock time
+        std::vector<NTagBonsaiFit> newFits(nCandidates);
+        auto submitAndGet = [&](int iFirst) {
+            std::vector<int> jobIDs;
+            for (int iCandidate = iFirst; iCandidate < nCandidates; iCandidate += 2)
+                jobIDs.push_back(pool.Submit(isData, reconCT[iCandidate], T[iCandidate], Q[iCandidate], cableID[iCandidate]));
+            for (int iCandidate = iFirst; iCandidate < nCandidates; iCandidate += 2)
+                newFits[iCandidate] = pool.GetFit(jobIDs[iCandidate/2]);
+        };
+        timespec wallStart, wallEnd;
+        clock_gettime(CLOCK_MONOTONIC, &wallStart);
+        std::thread otherThread(submitAndGet, 1);
+        submitAndGet(0);
+        otherThread.join();
+        clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+        newTime += (wallEnd.tv_sec - wallStart.tv_sec) + 1e-9 * (wallEnd.tv_nsec - wallStart.tv_nsec);
+
+        // Check results: the pool processes fit with the run state of the event, so the fits are the same
+        for (int iCandidate = 0; iCandidate < nCandidates; iCandidate++) {
+            const NTagBonsaiFit& newFit = newFits[iCandidate];
+            const NTagBonsaiFit& refFit = refFits[iCandidate];
+            if (memcmp(&newFit, &refFit, sizeof(NTagBonsaiFit)))
+                msg.Print(Form("BONSAI pool fit mismatch in event %d, candidate %d: energy %f (ref: %f), "
+                               "vertex (%f, %f, %f) (ref: (%f, %f, %f))",
+                               iEvent, iCandidate, newFit.energy, refFit.energy,
+                               newFit.vx, newFit.vy, newFit.vz, refFit.vx, refFit.vy, refFit.vz), pERROR);
+        }
+    }
+
+    PrintResult("BonsaiPool", refTime, newTime);
+}
+
+void NTagBenchmark::GenerateAFTHits(std::vector<float>& sortedT, std::vector<float>& Q)
+{
+    sortedT.clear(); Q.clear();
+
+    // Dark noise: about 11,000 PMTs at ~5 kHz over 535 us
+    int nNoiseHits = fRandom.Poisson(30000);
+    for (int iHit = 0; iHit < nNoiseHits; iHit++)
+        sortedT.push_back(fRandom.Uniform(0., 535000.));
+
+    // Capture-like clusters of hits within ~10 ns
+    int nClusters = fRandom.Poisson(3);
+    for (int iCluster = 0; iCluster < nClusters; iCluster++) {
+        float t0 = fRandom.Uniform(5000., 535000.);
+        int nClusterHits = fRandom.Poisson(25);
+        for (int iHit = 0; iHit < nClusterHits; iHit++)
+            sortedT.push_back(t0 + fRandom.Gaus(0., 3.));
+    }
+
+    std::sort(sortedT.begin(), sortedT.end());
+
+    for (unsigned int iHit = 0; iHit < sortedT.size(); iHit++)
+        Q.push_back(fRandom.Uniform(0.5, 1.5));
+}
+
+void NTagBenchmark::GenerateCaptureHits(int nHits, std::vector<float>& T, std::vector<int>& cableID)
+{
+    T.clear(); cableID.clear();
+
+    // Random vertex inside the tank
+    float r   = (RINTK - 200.) * sqrt(fRandom.Rndm());
+    float phi = fRandom.Uniform(0., 2*M_PI);
+    float vertex[3] = {r * (float)cos(phi), r * (float)sin(phi), (float)fRandom.Uniform(-ZPINTK + 200., ZPINTK - 200.)};
+
+    NTagToFTable tofTable;
+    tofTable.SetVertex(vertex);
+
+    for (int iHit = 0; iHit < nHits; iHit++) {
+        int pmtID = fRandom.Integer(MAXPM);
+        cableID.push_back(pmtID + 1);
+        T.push_back(1000. + tofTable.GetToF(pmtID) + fRandom.Gaus(0., 3.));
+    }
+}
+
+void NTagBenchmark::GetDefaultGridPoints(std::vector<std::array<float, 3>>& gridPoints)
+{
+    // Same grid as the first iteration of NTagCandidate::MinimizeTRMS
+    float gridWidth = 500.;
+    int nGridsInZ = (int)(2*ZPINTK / gridWidth);
+    int nGridsInR = (int)(2*RINTK / gridWidth);
+
+    gridPoints.clear();
+    for (int iGridX = 0; iGridX < nGridsInR; iGridX++) {
+        for (int iGridY = 0; iGridY < nGridsInR; iGridY++) {
+            for (int iGridZ = 0; iGridZ < nGridsInZ; iGridZ++) {
+                std::array<float, 3> gridPoint = {(float)((iGridX - nGridsInR/2.) * gridWidth),
+                                                  (float)((iGridY - nGridsInR/2.) * gridWidth),
+                                                  (float)((iGridZ - nGridsInZ/2.) * gridWidth)};
+                if (sqrt(gridPoint[0]*gridPoint[0] + gridPoint[1]*gridPoint[1]) > RINTK) continue;
+                if (gridPoint[2] > ZPINTK || gridPoint[2] < -ZPINTK) continue;
+                gridPoints.push_back(gridPoint);
+            }
+        }
+    }
+}
+
+void NTagBenchmark::PrintResult(const char* name, float refTime, float newTime)
+{
+    msg.Print(Form("%-20s reference: %10.3f ms/event, new: %10.3f ms/event, speedup: %6.1fx",
+                   name, 1e3 * refTime / fNEvents, 1e3 * newTime / fNEvents,
+                   newTime > 0 ? refTime / newTime : 0.));
+}
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#undef MAXPM
+#undef MAXPMA
+#include <skparmC.h>
+#include <sktqC.h>
+
+#include "SKLibs.hh"
+#include "NTagBonsaiPool.hh"
+
+NTagBonsaiPool::NTagBonsaiPool(int nProcesses, Verbosity verbose)
+: msg("BonsaiPool", verbose), fNSubmitted(nProcesses, 0), fNReceived(nProcesses, 0),
+  fNextJobID(0), fIsReceiving(false)
+{
+    // Shared by the pool processes: a semaphore followed by the job rings
+    fSharedMemorySize = sizeof(sem_t) + nProcesses * sizeof(Channel);
+    fSharedMemory = mmap(NULL, fSharedMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (fSharedMemory == MAP_FAILED)
+        msg.Print(Form("Failed to map %lu bytes of shared memory!", fSharedMemorySize), pERROR);
+
+    fAnyDone  = static_cast<sem_t*>(fSharedMemory);
+    fChannels = reinterpret_cast<Channel*>(fAnyDone + 1);
+
+    sem_init(fAnyDone, 1, 0);
+    for (int iProcess = 0; iProcess < nProcesses; iProcess++) {
+        sem_init(&fChannels[iProcess].requested, 1, 0);
+        sem_init(&fChannels[iProcess].done, 1, 0);
+    }
+
+    // Flush before forking, so that the pool processes don't print the buffered output again
+    std::cout << std::flush;
+
+    for (int iProcess = 0; iProcess < nProcesses; iProcess++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            msg.Print("Failed to fork a BONSAI process!", pERROR);
+        if (pid == 0)
+            RunProcess(iProcess);
+        fPIDs.push_back(pid);
+    }
+
+    msg.Print(Form("Started %d BONSAI processes", nProcesses), pDEBUG);
+}
+
+NTagBonsaiPool::~NTagBonsaiPool()
+{
+    // Receive the unclaimed fits, so that each ring has a free job for the stop request
+    std::unique_lock<std::mutex> lock(fMutex);
+    for (int iProcess = 0; iProcess < GetNProcesses(); iProcess++)
+        while (fNReceived[iProcess] < fNSubmitted[iProcess])
+            ReceiveFit(lock);
+
+    for (int iProcess = 0; iProcess < GetNProcesses(); iProcess++) {
+        Channel& channel = fChannels[iProcess];
+        channel.jobs[fNSubmitted[iProcess] % DEPTH].nHits = -1;
+        sem_post(&channel.requested);
+    }
+    for (auto& pid: fPIDs)
+        waitpid(pid, NULL, 0);
+
+    for (int iProcess = 0; iProcess < GetNProcesses(); iProcess++) {
+        sem_destroy(&fChannels[iProcess].requested);
+        sem_destroy(&fChannels[iProcess].done);
+    }
+    sem_destroy(fAnyDone);
+    munmap(fSharedMemory, fSharedMemorySize);
+}
+
+int NTagBonsaiPool::Submit(bool isData, float reconCT,
+                           const std::vector<float>& t, const std::vector<float>& q, const std::vector<int>& cab)
+{
+    int nHits = t.size();
+    if (nHits > MAXJOBHITS) return -1;
+
+    std::unique_lock<std::mutex> lock(fMutex);
+
+    // The least busy pool process, waiting for a fit if all are full
+    int iProcess = 0;
+    while (true) {
+        for (int i = 1; i < GetNProcesses(); i++)
+            if (fNSubmitted[i] - fNReceived[i] < fNSubmitted[iProcess] - fNReceived[iProcess])
+                iProcess = i;
+        if (fNSubmitted[iProcess] - fNReceived[iProcess] < DEPTH) break;
+        ReceiveFit(lock);
+    }
+
+    Channel& channel = fChannels[iProcess];
+    Job& job = channel.jobs[fNSubmitted[iProcess] % DEPTH];
+    int jobID   = fNextJobID++;
+    job.jobID   = jobID;
+    job.isData  = isData ? 1 : 0;
+    job.reconCT = reconCT;
+    job.nHits   = nHits;
+    job.header  = skhead_;
+    job.badChannels = skbadc_;
+    std::copy(t.begin(), t.end(), job.t);
+    std::copy(q.begin(), q.end(), job.q);
+    std::copy(cab.begin(), cab.end(), job.cab);
+
+    fNSubmitted[iProcess]++;
+    sem_post(&channel.requested);
+
+    return jobID;
+}
+
+NTagBonsaiFit NTagBonsaiPool::GetFit(int jobID, float* cpuTime)
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    auto isJob = [jobID](const std::tuple<int, NTagBonsaiFit, float>& f) { return std::get<0>(f) == jobID; };
+    auto it = std::find_if(fFits.begin(), fFits.end(), isJob);
+    while (it == fFits.end()) {
+        ReceiveFit(lock);
+        it = std::find_if(fFits.begin(), fFits.end(), isJob);
+    }
+
+    NTagBonsaiFit fit = std::get<1>(*it);
+    if (cpuTime) *cpuTime = std::get<2>(*it);
+    fFits.erase(it);
+    return fit;
+}
+
+void NTagBonsaiPool::ReceiveFit(std::unique_lock<std::mutex>& lock)
+{
+    // Another thread waits for the pool processes
+    if (fIsReceiving) {
+        fFitReceived.wait(lock);
+        return;
+    }
+    fIsReceiving = true;
+    lock.unlock();
+
+    // Wait for any fit, checking every second that the pool processes are alive
+    while (true) {
+        timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_sec += 1;
+
+        if (sem_timedwait(fAnyDone, &timeout) == 0) break;
+        if (errno == EINTR) continue;
+
+        for (auto& pid: fPIDs) {
+            if (waitpid(pid, NULL, WNOHANG) == pid)
+                msg.Print(Form("BONSAI process %d has died!", pid), pERROR);
+        }
+    }
+
+    lock.lock();
+    fIsReceiving = false;
+    fFitReceived.notify_all();
+
+    // Fits of each process finish in the submitted order
+    for (int iProcess = 0; iProcess < GetNProcesses(); iProcess++) {
+        Channel& channel = fChannels[iProcess];
+        if (fNReceived[iProcess] < fNSubmitted[iProcess] && sem_trywait(&channel.done) == 0) {
+            const Job& job = channel.jobs[fNReceived[iProcess] % DEPTH];
+            fFits.emplace_back(job.jobID, job.fit, job.cpuTime);
+            fNReceived[iProcess]++;
+            return;
+        }
+    }
+}
+
+void NTagBonsaiPool::RunProcess(int iProcess)
+{
+    // Stopped by the parent only, or killed if the parent dies
+    signal(SIGINT, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    Channel& channel = fChannels[iProcess];
+
+    for (long iJob = 0; ; iJob++) {
+        while (sem_wait(&channel.requested) != 0) {}
+
+        Job& job = channel.jobs[iJob % DEPTH];
+        if (job.nHits < 0) break;
+
+        // Run state of the event, which changed in the parent after the fork
+        skhead_ = job.header;
+        skbadc_ = job.badChannels;
+
+        timespec startTime, endTime;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &startTime);
+        job.fit = Fit(job.isData, job.reconCT, job.t, job.q, job.cab, job.nHits);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &endTime);
+        job.cpuTime = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) * 1.e-9;
+
+        sem_post(&channel.done);
+        sem_post(fAnyDone);
+    }
+
+    // Leave the parent's files and buffers as they are
+    _exit(0);
+}
+
+// bonsai.F added the charges of the third and later hits on a cable to qisk(0), out of bounds:
+// the word before qisk in /SKQ/, which is mxqisk
+static_assert(offsetof(skq_common, qisk) == offsetof(skq_common, mxqisk) + sizeof(int),
+              "mxqisk must be the word before qisk in /SKQ/");
+
+static void AddToQisk0(float q)
+{
+    float qisk0;
+    memcpy(&qisk0, &skq_.mxqisk, sizeof(float));
+    qisk0 += q;
+    memcpy(&skq_.mxqisk, &qisk0, sizeof(float));
+}
+
+bool NTagBonsaiPool::fAreHitsOverwritten = true;
+
+void NTagBonsaiPool::SetHitsOverwritten()
+{
+    fAreHitsOverwritten = true;
+}
+
+NTagBonsaiFit NTagBonsaiPool::Fit(bool isData, float reconCT, const float* t, const float* q, const int* cab, int nHits)
+{
+    // Index of the last hit on each cable, reset after use at the touched cables only
+    static std::vector<int> lastHitOnCable(MAXPM+1, 0);
+    // Cables and number of hits set by the last fit, cleared before the next fit
+    static std::vector<int> lastCables;
+    static int lastNHits = 0;
+
+    // 1-based, as in Fortran
+    float* tisk  = skt_.tisk - 1;
+    float* qisk  = skq_.qisk - 1;
+    int*   ihcab = skchnl_.ihcab - 1;
+
+    // Start from zeroed hits as bonsai.F did, clearing all only if others have written them
+    if (fAreHitsOverwritten) {
+        std::fill(skt_.tisk, skt_.tisk + MAXPM, 0.f);
+        std::fill(skq_.qisk, skq_.qisk + MAXPM, 0.f);
+        std::fill(skchnl_.ihcab, skchnl_.ihcab + MAXPM, 0);
+        fAreHitsOverwritten = false;
+    }
+    else {
+        for (auto& cable: lastCables)
+            tisk[cable] = qisk[cable] = 0;
+        std::fill(skchnl_.ihcab, skchnl_.ihcab + lastNHits, 0);
+    }
+    lastCables.clear();
+    lastNHits = nHits;
+
+    skq_.nqisk  = 0;
+    skq_.mxqisk = 0;
+    float mxq   = 0;
+
+    for (int i = 1; i <= nHits; i++) {
+        int cable = cab[i-1];
+        int dupID = lastHitOnCable[cable];
+        lastHitOnCable[cable] = i;
+
+        // Charge of the second hit on a cable is added to the first hit on the cable.
+        // From the third hit on, ihcab(dupID) is 0 and the charge goes to qisk(0) as in bonsai.F.
+        if (dupID) {
+            if (ihcab[dupID]) qisk[ihcab[dupID]] += q[i-1];
+            else              AddToQisk0(q[i-1]);
+        }
+        else {
+            ihcab[i] = cable;
+            tisk[cable] = t[i-1] - reconCT + 1000;
+            qisk[cable] = q[i-1];
+            skq_.nqisk++;
+            lastCables.push_back(cable);
+
+            if (qisk[cable] > mxq) {
+                mxq = qisk[cable];
+                skq_.mxqisk = cable;
+            }
+        }
+    }
+
+    for (int i = 0; i < nHits; i++)
+        lastHitOnCable[cab[i]] = 0;
+
+    int bData = isData ? 1 : 0;
+    NTagBonsaiFit fit;
+    bonsai_fit_(&bData, &reconCT,
+                &fit.energy, &fit.vx, &fit.vy, &fit.vz, &fit.t,
+                &fit.good, &fit.dirks, &fit.patlik, &fit.ovaq);
+
+    return fit;
+}
@@ -1,6 +1,13 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <numeric>
+#include <random>
 #include <string>
 
 #include <geotnkC.h>
@@ -53,9 +60,89 @@ float GetLegendreP(int i, float& x)
     return result;
 }
 
+// Coefficients of the m-th derivatives of Legendre polynomials,
+// d^m P_l(z) / dz^m = sum_k coef[l][m][k] z^k for l, m, k = 0...5
+struct LegendreDerivatives
+{
+    double coef[6][6][6];
+
+    LegendreDerivatives()
+    {
+        static const double P[6][6] = {{1.},
+                                       {0., 1.},
+                                       {-1/2., 0., 3/2.},
+                                       {0., -3/2., 0., 5/2.},
+                                       {3/8., 0., -30/8., 0., 35/8.},
+                                       {0., 15/8., 0., -70/8., 0., 63/8.}};
+        for (int l = 0; l <= 5; l++) {
+            for (int k = 0; k <= 5; k++)
+                coef[l][0][k] = P[l][k];
+            for (int m = 1; m <= 5; m++)
+                for (int k = 0; k <= 5; k++)
+                    coef[l][m][k] = (k < 5) ? (k+1) * coef[l][m-1][k+1] : 0.;
+        }
+    }
+};
+
+std::array<float, 6> GetBetaArray(const HitGeometry& geometry)
+{
+    static const LegendreDerivatives legendre;
+
+    std::array<float, 6> beta = {0., 0., 0., 0., 0., 0};
+    int nHits = geometry.GetNHits();
+    if (nHits == 0) return beta;
+
+    // Spherical harmonic moments of the hit directions, up to normalization:
+    // sum over hits of P_l^(m)(z) * Re, Im of (x + iy)^m
+    double momentRe[6][6] = {{0.}}, momentIm[6][6] = {{0.}};
+
+    for (int iHit = 0; iHit < nHits; iHit++) {
+
+        double x = geometry.ux[iHit], y = geometry.uy[iHit], z = geometry.uz[iHit];
+
+        // (x + iy)^m = sin^m(theta) * exp(i m phi)
+        double re[6] = {1.}, im[6] = {0.};
+        for (int m = 1; m <= 5; m++) {
+            re[m] = re[m-1]*x - im[m-1]*y;
+            im[m] = re[m-1]*y + im[m-1]*x;
+        }
+
+        for (int l = 1; l <= 5; l++) {
+            for (int m = 0; m <= l; m++) {
+                const double* c = legendre.coef[l][m];
+                double dP = ((((c[5]*z + c[4])*z + c[3])*z + c[2])*z + c[1])*z + c[0];
+                momentRe[l][m] += dP * re[m];
+                momentIm[l][m] += dP * im[m];
+            }
+        }
+    }
+
+    for (int l = 1; l <= 5; l++) {
+
+        // Addition theorem: sum over all (i, j) of P_l(u_i.u_j)
+        double sumAllPairs = 0.;
+        double norm = 1.; // (l-m)! / (l+m)!
+        for (int m = 0; m <= l; m++) {
+            if (m > 0) norm /= (l+m) * (l-m+1);
+            sumAllPairs += (m ? 2. : 1.) * norm * (momentRe[l][m]*momentRe[l][m] + momentIm[l][m]*momentIm[l][m]);
+        }
+
+        // Remove i = j, where P_l(1) = 1, and count each pair once
+        double sumPairs = (nHits > 1) ? (sumAllPairs - nHits) / 2. : 0.;
+        beta[l] = 2.*sumPairs / float(nHits) / float(nHits-1);
+    }
+
+    // Return calculated beta array
+    return beta;
+}
+
 float GetTRMS(const std::vector<float>& T)
 {
-    int   nHits  = T.size();
+    return GetTRMS(T.data(), T.size());
+}
+
+float GetTRMS(const float* T, int nHits)
+{
     float tMean = 0.;
     float tVar  = 0.;
 
@@ -82,68 +169,301 @@ std::vector<float> GetVectorFromStartIndex(const std::vector<float>& sortedT, in
     return selectedT;
 }
 
+void SlideHitWindow(HitWindow& window, const std::vector<float>& sortedT, const std::vector<float>& Q,
+                    int startIndex, float tWidth)
+{
+    int nAllHits = static_cast<int>(sortedT.size());
+
+    // Drop hits that are now earlier than the window start
+    for (; window.startIndex < startIndex; window.startIndex++) {
+        if (window.startIndex < window.endIndex)
+            window.qSum -= Q[window.startIndex];
+    }
+
+    // Window start has passed the previous window end: start over
+    if (window.endIndex <= window.startIndex) {
+        window.endIndex = window.startIndex;
+        window.qSum = 0.;
+    }
+
+    // Extend the window end, always including the start hit
+    while (window.endIndex < nAllHits &&
+           (window.endIndex == window.startIndex ||
+            sortedT[window.endIndex] - sortedT[window.startIndex] < tWidth)) {
+        window.qSum += Q[window.endIndex];
+        window.endIndex++;
+    }
+
+    window.nHits = window.endIndex - window.startIndex;
+}
+
 int GetNhitsFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth)
 {
-    std::vector<float> selectedT = GetVectorFromStartIndex(sortedT, startIndex, tWidth);
-    return selectedT.size();
+    int nAllHits = static_cast<int>(sortedT.size());
+    int searchIndex = startIndex + 1;
+
+    while (searchIndex < nAllHits && sortedT[searchIndex] - sortedT[startIndex] < tWidth)
+        searchIndex++;
+
+    return searchIndex - startIndex;
+}
+
+int GetEndIndexFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth)
+{
+    float t0 = sortedT[startIndex];
+
+    // Same condition as GetVectorFromStartIndex, which is monotonic in sorted T
+    auto end = std::partition_point(sortedT.begin() + startIndex + 1, sortedT.end(),
+                                    [t0, tWidth](float t) { return t - t0 < tWidth; });
+
+    return end - sortedT.begin();
+}
+
+// Maps a float to an unsigned integer with the same order
+static inline unsigned int GetRadixKey(float t)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &t, sizeof(bits));
+
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+void GetSortedIndex(const float* T, int nHits, std::vector<int>& sortedIndex)
+{
+    sortedIndex.resize(nHits);
+
+    // Insertion sort for short arrays
+    if (nHits < 64) {
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            int jHit = iHit;
+            while (jHit > 0 && T[sortedIndex[jHit-1]] > T[iHit]) {
+                sortedIndex[jHit] = sortedIndex[jHit-1];
+                jHit--;
+            }
+            sortedIndex[jHit] = iHit;
+        }
+        return;
+    }
+
+    const int nBits = 11, nBuckets = 1 << nBits, nPasses = 3;
+
+    // Buffers reused across calls
+    static thread_local std::vector<unsigned int> keys, tmpKeys;
+    static thread_local std::vector<int> tmpIndex, count;
+    keys.resize(nHits); tmpKeys.resize(nHits); tmpIndex.resize(nHits);
+    count.assign(nPasses * nBuckets, 0);
+
+    // Histograms of all passes in one scan
+    for (int iHit = 0; iHit < nHits; iHit++) {
+        unsigned int key = GetRadixKey(T[iHit]);
+        keys[iHit] = key;
+        sortedIndex[iHit] = iHit;
+        for (int pass = 0; pass < nPasses; pass++)
+            count[pass*nBuckets + ((key >> (pass*nBits)) & (nBuckets-1))]++;
+    }
+
+    unsigned int *srcKeys = keys.data(), *dstKeys = tmpKeys.data();
+    int *srcIndex = sortedIndex.data(), *dstIndex = tmpIndex.data();
+
+    for (int pass = 0; pass < nPasses; pass++) {
+        int* passCount = &count[pass*nBuckets];
+        int shift = pass*nBits;
+
+        // Skip if all keys have the same digit
+        if (passCount[(srcKeys[0] >> shift) & (nBuckets-1)] == nHits) continue;
+
+        // Bucket offsets
+        int offset = 0;
+        for (int iBucket = 0; iBucket < nBuckets; iBucket++) {
+            int nInBucket = passCount[iBucket];
+            passCount[iBucket] = offset;
+            offset += nInBucket;
+        }
+
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            int pos = passCount[(srcKeys[iHit] >> shift) & (nBuckets-1)]++;
+            dstKeys[pos] = srcKeys[iHit];
+            dstIndex[pos] = srcIndex[iHit];
+        }
+
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcIndex, dstIndex);
+    }
+
+    if (srcIndex != sortedIndex.data())
+        std::copy(srcIndex, srcIndex + nHits, sortedIndex.begin());
+}
+
+int GetSortedIndexOfBlocks(const float* T, int nHits, const std::vector<int>& blockStart,
+                           std::vector<int>& sortedIndex, int maxDisplacement, int maxMeanDisplacement)
+{
+    sortedIndex.resize(nHits);
+
+    // Sorted hit times are kept next to the indices to avoid indirect access
+    static thread_local std::vector<float> sortedT, mergedT;
+    static thread_local std::vector<int> blockIndex, mergedIndex;
+    sortedT.resize(nHits);
+
+    int nBlocks = blockStart.empty() ? 1 : blockStart.size();
+    int nInsertionSorted = 0;
+
+    for (int iBlock = 0; iBlock < nBlocks; iBlock++) {
+        int first = blockStart.empty() ? 0 : blockStart[iBlock];
+        int last  = (iBlock + 1 < nBlocks) ? blockStart[iBlock+1] : nHits;
+
+        // Insertion sort with bounded displacement:
+        // give up once the hits have moved more than the radix sort would cost
+        bool isNearlySorted = true;
+        long nMoves = 0;
+        for (int iHit = first; iHit < last && isNearlySorted; iHit++) {
+            float t = T[iHit];
+            int jHit = iHit;
+            while (jHit > first && sortedT[jHit-1] > t) {
+                if (++nMoves > (long)maxMeanDisplacement * (iHit - first) + maxDisplacement) {
+                    isNearlySorted = false; break;
+                }
+                sortedT[jHit] = sortedT[jHit-1];
+                sortedIndex[jHit] = sortedIndex[jHit-1];
+                jHit--;
+            }
+            sortedT[jHit] = t;
+            sortedIndex[jHit] = iHit;
+        }
+
+        // Fall back to the radix sort of the block
+        if (!isNearlySorted) {
+            GetSortedIndex(T + first, last - first, blockIndex);
+            for (int iHit = first; iHit < last; iHit++) {
+                sortedIndex[iHit] = blockIndex[iHit - first] + first;
+                sortedT[iHit] = T[sortedIndex[iHit]];
+            }
+        }
+        else nInsertionSorted++;
+
+        if (iBlock == 0 || first == last) continue;
+
+        // Merge with the previous blocks, which come first for equal times.
+        // Only the hits in the time range where the blocks overlap have to move.
+        // Nothing to merge if the previous blocks end before this block, or are empty
+        int mergeStart = std::upper_bound(sortedT.begin(), sortedT.begin() + first, sortedT[first]) - sortedT.begin();
+        if (mergeStart == first) continue;
+        int mergeEnd   = std::lower_bound(sortedT.begin() + first, sortedT.begin() + last, sortedT[first-1]) - sortedT.begin();
+
+        mergedT.clear(); mergedIndex.clear();
+        int i = mergeStart, j = first;
+        while (i < first && j < mergeEnd) {
+            if (sortedT[j] < sortedT[i]) { mergedT.push_back(sortedT[j]); mergedIndex.push_back(sortedIndex[j]); j++; }
+            else                         { mergedT.push_back(sortedT[i]); mergedIndex.push_back(sortedIndex[i]); i++; }
+        }
+        for (; i < first; i++)    { mergedT.push_back(sortedT[i]); mergedIndex.push_back(sortedIndex[i]); }
+        for (; j < mergeEnd; j++) { mergedT.push_back(sortedT[j]); mergedIndex.push_back(sortedIndex[j]); }
+
+        std::copy(mergedT.begin(), mergedT.end(), sortedT.begin() + mergeStart);
+        std::copy(mergedIndex.begin(), mergedIndex.end(), sortedIndex.begin() + mergeStart);
+    }
+
+    return nInsertionSorted;
 }
 
 float GetQSumFromStartIndex(const std::vector<float>& sortedT, const std::vector<float>& Q, int startIndex, float tWidth)
 {
-    std::vector<float> selectedT = GetVectorFromStartIndex(sortedT, startIndex, tWidth);
-    float sumQ      = 0.;
+    int endIndex = GetEndIndexFromStartIndex(sortedT, startIndex, tWidth);
+    float sumQ   = 0.;
 
-    for (unsigned int iHit = 0; iHit < selectedT.size(); iHit++) {
+    for (int iHit = startIndex; iHit < endIndex; iHit++)
         sumQ += Q[iHit];
-    }
 
     return sumQ;
 }
 
 float GetTRMSFromStartIndex(const std::vector<float>& sortedT, int startIndex, float tWidth)
 {
-    std::vector<float> selectedT = GetVectorFromStartIndex(sortedT, startIndex, tWidth);
-
-    return GetTRMS(selectedT);
+    return GetTRMS(sortedT.data() + startIndex, GetNhitsFromStartIndex(sortedT, startIndex, tWidth));
 }
 
 int GetNhitsFromCenterTime(const std::vector<float>& T, float centerTime, float tWidth)
 {
-    int NXX = 0;
+    double tLow  = centerTime - tWidth/2.;
+    double tHigh = centerTime + tWidth/2.;
 
-    for (const auto& t: T) {
-        if (t < centerTime - tWidth/2.) continue;
-        if (t > centerTime + tWidth/2.) break;
-        NXX++;
-    }
+    // First hit with t >= tLow, and first hit with t > tHigh
+    auto first = std::lower_bound(T.begin(), T.end(), tLow,
+                                  [](float t, double edge) { return t < edge; });
+    auto last  = std::upper_bound(first, T.end(), tHigh,
+                                  [](double edge, float t) { return edge < t; });
 
-    return NXX;
+    return last - first;
 }
 
-TVector3 GetMeanDirection(const std::vector<int>& PMTID, float v[3])
+HitGeometry::HitGeometry(const std::vector<int>& PMTID, const float v[3])
 {
-    int nHits = PMTID.size();
-    TVector3 u(0, 0, 0);
+    Set(PMTID.data(), PMTID.size(), v);
+}
+
+HitGeometry::HitGeometry(const int* PMTID, int nHits, const float v[3])
+{
+    Set(PMTID, nHits, v);
+}
+
+void HitGeometry::Set(const int* PMTID, int nHits, const float v[3])
+{
+    meanDir = {0., 0., 0.};
+    ux.resize(nHits); uy.resize(nHits); uz.resize(nHits);
+    dist.resize(nHits);
+    angleUx.resize(nHits); angleUy.resize(nHits); angleUz.resize(nHits);
+
+    for (int dim = 0; dim < 3; dim++)
+        vertex[dim] = v[dim];
+
+    // Vector to the hit PMT as filled so far in the mean direction of the old GetMeanDirection,
+    // with the other components left from the previous hit
+    float oldVec[3] = {0., 0., 0.};
 
-    // Calculate mean direction
+    // Unit vectors from vertex to each hit PMT, same as TVector3::Unit
     for (int iHit = 0; iHit < nHits; iHit++) {
-        float distFromVertexToPMT;
-        float vecFromVertexToPMT[3];
+        float vec[3];
+        for (int dim = 0; dim < 3; dim++)
+            vec[dim] = NTagConstant::PMTXYZ[PMTID[iHit]-1][dim] - v[dim];
+
+        double mag2 = (double)vec[0]*vec[0] + (double)vec[1]*vec[1] + (double)vec[2]*vec[2];
+        double invMag = (mag2 > 0) ? 1.0/sqrt(mag2) : 1.0;
+        ux[iHit] = vec[0]*invMag; uy[iHit] = vec[1]*invMag; uz[iHit] = vec[2]*invMag;
+        dist[iHit] = sqrt(mag2);
+
+        // Same sum as the old GetMeanDirection, which took the norm per component
         for (int dim = 0; dim < 3; dim++) {
-            vecFromVertexToPMT[dim] = NTagConstant::PMTXYZ[PMTID[iHit]-1][dim] - v[dim];
-            distFromVertexToPMT = Norm(vecFromVertexToPMT);
-            u[dim] += vecFromVertexToPMT[dim] / distFromVertexToPMT;
+            oldVec[dim] = vec[dim];
+            meanDir[dim] += oldVec[dim] / Norm(oldVec);
         }
+
+        // Same PMT lookup as the old triplet loop of GetOpeningAngleStats
+        int anglePMT = iHit > 0 ? PMTID[iHit-1] : 0;
+        for (int dim = 0; dim < 3; dim++)
+            vec[dim] = NTagConstant::PMTXYZ[anglePMT][dim] - v[dim];
+
+        mag2 = (double)vec[0]*vec[0] + (double)vec[1]*vec[1] + (double)vec[2]*vec[2];
+        invMag = (mag2 > 0) ? 1.0/sqrt(mag2) : 1.0;
+        angleUx[iHit] = vec[0]*invMag; angleUy[iHit] = vec[1]*invMag; angleUz[iHit] = vec[2]*invMag;
     }
 
-    return u.Unit();
+    // Normalize mean direction
+    double mag2 = meanDir[0]*meanDir[0] + meanDir[1]*meanDir[1] + meanDir[2]*meanDir[2];
+    if (mag2 > 0) {
+        double invMag = 1.0/sqrt(mag2);
+        for (int dim = 0; dim < 3; dim++)
+            meanDir[dim] *= invMag;
+    }
+}
+
+TVector3 GetMeanDirection(const HitGeometry& geometry)
+{
+    return TVector3(geometry.meanDir.data());
 }
 
-float GetDWallInMeanDirection(const std::vector<int>& PMTID, float v[3])
+float GetDWallInMeanDirection(const HitGeometry& geometry)
 {
-    float dWall;
-    int nHits = PMTID.size();
-    TVector3 u = GetMeanDirection(PMTID, v);
+    const auto& u = geometry.meanDir;
+    const float* v = geometry.vertex;
 
     float dot = u[0]*v[0] + u[1]*v[1];
     float uSq = u[0]*u[0] + u[1]*u[1];
@@ -157,21 +477,19 @@ float GetDWallInMeanDirection(const std::vector<int>& PMTID, float v[3])
     return distR < distZ ? distR : distZ;
 }
 
-float GetMeanAngleInMeanDirection(const std::vector<int>& PMTID, float v[3])
+float GetMeanAngleInMeanDirection(const HitGeometry& geometry)
 {
-    int nHits = PMTID.size();
-    TVector3 meanDir = GetMeanDirection(PMTID, v);
-    std::vector<float> angles;
+    int nHits = geometry.GetNHits();
+    const auto& meanDir = geometry.meanDir;
+    double angleSum = 0.;
 
     for (int iHit = 0; iHit < nHits; iHit++) {
-        TVector3 u(NTagConstant::PMTXYZ[PMTID[iHit]-1][0] - v[0],
-                   NTagConstant::PMTXYZ[PMTID[iHit]-1][1] - v[1],
-                   NTagConstant::PMTXYZ[PMTID[iHit]-1][2] - v[2]);
-        //angles.push_back((180/M_PI)*meanDir.Angle(u.Unit()));
-        angles.push_back((180/M_PI)*meanDir.Angle(u));
+        double cosAngle = meanDir[0]*geometry.ux[iHit] + meanDir[1]*geometry.uy[iHit] + meanDir[2]*geometry.uz[iHit];
+        cosAngle = std::max(-1., std::min(1., cosAngle));
+        angleSum += (180/M_PI) * acos(cosAngle);
     }
 
-    return GetMean(angles);
+    return angleSum / (float)nHits;
 }
 
 float GetOpeningAngle(TVector3 uA, TVector3 uB, TVector3 uC)
@@ -190,40 +508,129 @@ float GetOpeningAngle(TVector3 uA, TVector3 uB, TVector3 uC)
         return (180./M_PI) * asin(r);
 }
 
-std::array<float, 4> GetOpeningAngleStats(const std::vector<int>& PMTID, float v[3])
+// Circumradius of the triangle with sides a, b, c, same as GetOpeningAngle
+static inline double GetCircumradius(double a, double b, double c)
 {
-    std::vector<float> openingAngles;
-    int nHits = PMTID.size();
-    int hit[3];
-
-    // Pick 3 hits without repetition
-    for (        hit[0] = 0;        hit[0] < nHits-2; hit[0]++) {
-        for (    hit[1] = hit[0]+1; hit[1] < nHits-1; hit[1]++) {
-            for (hit[2] = hit[1]+1; hit[2] < nHits;   hit[2]++) {
-
-                // Define an array of three unit vectors
-                TVector3 u[3];
-                for (int i = 0; i < 3; i++) {
-
-                    // Fill i-th vector from vertex to the hit PMT
-                    float i_th_vec[3];
-                    for (int dim = 0; dim < 3; dim++) {
-                        i_th_vec[dim] = NTagConstant::PMTXYZ[PMTID[hit[i]-1]][dim] - v[dim];
-                    }
-
-                    // Get i-th unit vector
-                    u[i] = TVector3(i_th_vec).Unit();
+    return a*b*c / sqrt((a+b+c)*(-a+b+c)*(a-b+c)*(a+b-c));
+}
+
+static inline float GetOpeningAngleFromCircumradius(double r)
+{
+    if (r >= 1)
+        return 90.; // prevents NaN
+    else
+        return (180./M_PI) * asin(r);
+}
+
+std::array<float, 4> GetOpeningAngleStats(const HitGeometry& geometry, int maxTriplets)
+{
+    int nHits = geometry.GetNHits();
+    long nTriplets = (long)nHits * (nHits-1) * (nHits-2) / 6;
+
+    if (nTriplets <= 0)
+        return std::array<float, 4>{0., 0., 0., 0.};
+
+    const std::vector<double>& ux = geometry.angleUx;
+    const std::vector<double>& uy = geometry.angleUy;
+    const std::vector<double>& uz = geometry.angleUz;
+
+    // Buffers reused across calls, so that they are not allocated for every candidate
+    static thread_local std::vector<double> side, r;
+    static thread_local std::vector<float> openingAngles;
+
+    // Distances between all pairs of unit vectors: sides of the triangles
+    side.assign(nHits*nHits, 0.);
+    for (int iHit = 0; iHit < nHits; iHit++) {
+        for (int jHit = iHit+1; jHit < nHits; jHit++) {
+            double dx = ux[iHit] - ux[jHit], dy = uy[iHit] - uy[jHit], dz = uz[iHit] - uz[jHit];
+            side[iHit*nHits + jHit] = side[jHit*nHits + iHit] = sqrt(dx*dx + dy*dy + dz*dz);
+        }
+    }
+
+    openingAngles.clear();
+
+    if (maxTriplets > 0 && nTriplets > maxTriplets) {
+        // Sample triplets with a fixed seed, so that the output is reproducible
+        openingAngles.reserve(maxTriplets);
+        std::mt19937 generator(nHits);
+        std::uniform_int_distribution<int> pick(0, nHits-1);
+
+        for (int iTriplet = 0; iTriplet < maxTriplets; iTriplet++) {
+            int hit[3];
+            hit[0] = pick(generator);
+            do hit[1] = pick(generator); while (hit[1] == hit[0]);
+            do hit[2] = pick(generator); while (hit[2] == hit[0] || hit[2] == hit[1]);
+            std::sort(hit, hit+3);
+
+            double r = GetCircumradius(side[hit[0]*nHits + hit[1]],
+                                       side[hit[2]*nHits + hit[0]],
+                                       side[hit[1]*nHits + hit[2]]);
+            openingAngles.push_back(GetOpeningAngleFromCircumradius(r));
+        }
+    }
+    else {
+        // All triplets without repetition, in the order of hit indices
+        openingAngles.reserve(nTriplets);
+        r.resize(nHits);
+
+        for (int iHit = 0; iHit < nHits-2; iHit++) {
+            const double* sideI = &side[iHit*nHits];
+            for (int jHit = iHit+1; jHit < nHits-1; jHit++) {
+                const double* sideJ = &side[jHit*nHits];
+                double a = sideI[jHit];
+                int kHit = jHit+1;
+
+                // Circumradii of the triangles (i, j, k) for all k at once
+#ifdef __AVX2__
+                const __m256d va = _mm256_set1_pd(a);
+                for (; kHit + 4 <= nHits; kHit += 4) {
+                    __m256d vb = _mm256_loadu_pd(sideI + kHit);
+                    __m256d vc = _mm256_loadu_pd(sideJ + kHit);
+                    __m256d abc = _mm256_mul_pd(_mm256_mul_pd(va, vb), vc);
+                    __m256d s0 = _mm256_add_pd(_mm256_add_pd(va, vb), vc);
+                    __m256d s1 = _mm256_add_pd(_mm256_sub_pd(vb, va), vc);
+                    __m256d s2 = _mm256_add_pd(_mm256_sub_pd(va, vb), vc);
+                    __m256d s3 = _mm256_sub_pd(_mm256_add_pd(va, vb), vc);
+                    __m256d prod = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(s0, s1), s2), s3);
+                    _mm256_storeu_pd(&r[kHit], _mm256_div_pd(abc, _mm256_sqrt_pd(prod)));
                 }
-                openingAngles.push_back(GetOpeningAngle(u[0], u[1], u[2]));
+#endif
+                for (; kHit < nHits; kHit++)
+                    r[kHit] = GetCircumradius(a, sideI[kHit], sideJ[kHit]);
+
+                for (kHit = jHit+1; kHit < nHits; kHit++)
+                    openingAngles.push_back(GetOpeningAngleFromCircumradius(r[kHit]));
             }
         }
     }
 
-    float mean     = GetMean(openingAngles);
-    float median   = GetMedian(openingAngles);
-    float stdev    = GetTRMS(openingAngles);
-    float skewness = GetSkew(openingAngles);
-
+    int N = openingAngles.size();
+
+    // Mean, variance, and third central moment in one pass,
+    // with sums shifted by the first angle to avoid cancellation
+    double shift = openingAngles[0];
+    double sum = 0., sum1 = 0., sum2 = 0., sum3 = 0.;
+    for (int i = 0; i < N; i++) {
+        double x = openingAngles[i] - shift;
+        sum  += openingAngles[i];
+        sum1 += x;
+        sum2 += x*x;
+        sum3 += x*x*x;
+    }
+    double m1 = sum1 / N;
+    double centralSum2 = sum2 - sum1*m1;
+    double centralSum3 = sum3 - 3*m1*sum2 + 2*m1*m1*sum1;
+
+    float mean     = sum / (float)N;
+    float stdev    = sqrt(centralSum2 / (N-1));
+    float skewness = (centralSum3 / N) / pow(stdev, 1.5);
+
+    // Median by partial sorting
+    auto middle = openingAngles.begin() + N/2;
+    std::nth_element(openingAngles.begin(), middle, openingAngles.end());
+    float median = *middle;
+    if (N % 2 == 0)
+        median = (*std::max_element(openingAngles.begin(), middle) + *middle) / 2.;
 
     return std::array<float, 4>{mean, median, stdev, skewness};
 }
@@ -1,63 +1,176 @@
 #include <algorithm>
 #include <cassert>
+#include <limits>
 #include <numeric>
 
 #include <geotnkC.h>
 
 #include "SKLibs.hh"
+#include "NTagBonsaiPool.hh"
 #include "NTagCalculator.hh"
 #include "NTagCandidate.hh"
 #include "NTagEventInfo.hh"
 
+#define NTAG_VARIABLE_NAME(name) #name,
+const char* const NTagCandidate::iVariableNames[nIVariables] = { NTAG_INT_VARIABLES(NTAG_VARIABLE_NAME) };
+const char* const NTagCandidate::fVariableNames[nFVariables] = { NTAG_FLOAT_VARIABLES(NTAG_VARIABLE_NAME) };
+#undef NTAG_VARIABLE_NAME
+
 NTagCandidate::NTagCandidate(int id, NTagEventInfo* eventInfo)
 :fVerbosity(eventInfo->fVerbosity), currentEvent(eventInfo)
 {
     candidateID = id;
+    bCascadeRejected = false;
+    iVars.fill(0);
+    fVars.fill(0.);
     msg = NTagMessage("Candidate", fVerbosity);
     TWIDTH = currentEvent->TWIDTH;
 }
 
 NTagCandidate::~NTagCandidate() {}
 
-void NTagCandidate::SetHitInfo(const std::vector<float>& rawT,
-                               const std::vector<float>& resT,
-                               const std::vector<float>& pmtQ,
-                               const std::vector<int>& cabI,
-                               const std::vector<int>& sigF)
+const float* NTagCandidate::GetHitResTimes() const { return currentEvent->vSortedT_ToF.data() + firstHitID; }
+const float* NTagCandidate::GetHitChargePE() const { return currentEvent->vSortedQ.data() + firstHitID; }
+const int*   NTagCandidate::GetHitCableIDs() const { return currentEvent->vSortedPMTID.data() + firstHitID; }
+
+const int* NTagCandidate::GetHitSigFlags() const
+{
+    if (currentEvent->vSortedSigFlag.empty()) return nullptr;
+    else return currentEvent->vSortedSigFlag.data() + firstHitID;
+}
+
+float NTagCandidate::GetHitRawTime(int iHit) const
+{
+    return currentEvent->vTISKZ[ currentEvent->sortedIndex[firstHitID + iHit] ];
+}
+
+float NTagCandidate::GetReconCT() const
 {
-    vHitRawTimes = rawT;
-    vHitResTimes = resT;
-    vHitChargePE = pmtQ;
-    vHitCableIDs = cabI;
-    vHitSigFlags = sigF;
+    const float* resT = GetHitResTimes();
+    return (resT[nHits-1] + resT[0]) / 2.;
 }
 
 void NTagCandidate::SetVariables()
 {
-    iVarMap["NHits"] = vHitResTimes.size();
-    iVarMap["N200"] = GetNhitsFromCenterTime(currentEvent->vSortedT_ToF, vHitResTimes[0]+TWIDTH/2., 200.);
-    fVarMap["TRMS"] = GetTRMS(vHitResTimes);
-    fVarMap["QSum"] = std::accumulate(vHitChargePE.begin(), vHitChargePE.end(), 0.);
-    fVarMap["ReconCT"] = (vHitResTimes.back() + vHitResTimes[0]) / 2.;
-    fVarMap["TSpread"] = (vHitResTimes.back() - vHitResTimes[0]);
+    SetFeatureVariables();
+    SetFortranVariables();
+
+    if (currentEvent->bUseTMVA) {
+        SetNNVariables();
+        SetTMVAOutput();
+    }
+}
 
+void NTagCandidate::SetCascadeVariables()
+{
     float pv[3] = {currentEvent->pvx, currentEvent->pvy, currentEvent->pvz};
-    auto beta_10 = GetBetaArray(vHitCableIDs, pv);
-    fVarMap["Beta1"] = beta_10[1];
-    fVarMap["Beta2"] = beta_10[2];
-    fVarMap["Beta3"] = beta_10[3];
-    fVarMap["Beta4"] = beta_10[4];
-    fVarMap["Beta5"] = beta_10[5];
-
-    fVarMap["DWall"] = wallsk_(pv);
-    fVarMap["DWallMeanDir"] = GetDWallInMeanDirection(vHitCableIDs, pv);
-    fVarMap["ThetaMeanDir"] = GetMeanAngleInMeanDirection(vHitCableIDs, pv);
-
-    const auto& openingAngleStats = GetOpeningAngleStats(vHitCableIDs, pv);
-    fVarMap["AngleMean"]   = openingAngleStats[0];
-    fVarMap["AngleMedian"] = openingAngleStats[1];
-    fVarMap["AngleStdev"]  = openingAngleStats[2];
-    fVarMap["AngleSkew"]   = openingAngleStats[3];
+    static thread_local HitGeometry promptGeometry;
+    promptGeometry.Set(GetHitCableIDs(), nHits, pv);
+
+    SetCascadeVariables(promptGeometry);
+}
+
+void NTagCandidate::SetCascadeVariables(const HitGeometry& promptGeometry)
+{
+    const float* resT = GetHitResTimes();
+    const float* pmtQ = GetHitChargePE();
+
+    Set(iNHits, nHits);
+    Set(iN200, GetNhitsFromCenterTime(currentEvent->vSortedT_ToF, resT[0]+TWIDTH/2., 200.));
+    Set(fTRMS, GetTRMS(resT, nHits));
+    Set(fQSum, std::accumulate(pmtQ, pmtQ + nHits, 0.));
+    Set(fReconCT, GetReconCT());
+    Set(fTSpread, (resT[nHits-1] - resT[0]));
+
+    auto beta_10 = GetBetaArray(promptGeometry);
+    Set(fBeta1, beta_10[1]);
+    Set(fBeta2, beta_10[2]);
+    Set(fBeta3, beta_10[3]);
+    Set(fBeta4, beta_10[4]);
+    Set(fBeta5, beta_10[5]);
+}
+
+void NTagCandidate::SetCascadeRejectedVariables(const std::bitset<nIVariables>& iMask,
+                                                const std::bitset<nFVariables>& fMask)
+{
+    bCascadeRejected = true;
+
+    if (!currentEvent->bData)  SetTrueInfo();
+
+    for (int key = 0; key < nIVariables; key++) {
+        if (iMask[key] && !iVarIsSet[key]) Set((IVariable)key, -9999);
+    }
+    for (int key = 0; key < nFVariables; key++) {
+        if (fMask[key] && !fVarIsSet[key]) Set((FVariable)key, -9999.);
+    }
+}
+
+void NTagCandidate::GetFeatureVariableMask(const NTagEventInfo& event, std::bitset<nIVariables>& iMask,
+                                           std::bitset<nFVariables>& fMask)
+{
+    iMask.reset();
+    fMask.reset();
+
+    // SetCascadeVariables
+    for (auto key: {iNHits, iN200}) iMask.set(key);
+    for (auto key: {fTRMS, fQSum, fReconCT, fTSpread, fBeta1, fBeta2, fBeta3, fBeta4, fBeta5}) fMask.set(key);
+
+    // SetFeatureVariables
+    for (auto key: {fDWallMeanDir, fThetaMeanDir, fAngleMean, fAngleMedian, fAngleStdev, fAngleSkew}) fMask.set(key);
+
+    if (event.bUseNeutFit) {
+        iMask.set(event.bUseResidual ? iN50 : iN200Raw);
+        iMask.set(iNHits_n);
+        fMask.set(event.bUseResidual ? fMinTRMS50_n : fMinTRMS30_n);
+        for (auto key: {fnvx, fnvy, fnvz, fBeta1_n, fBeta2_n, fBeta3_n, fBeta4_n, fBeta5_n, fDWallMeanDir_n,
+                        fAngleMean_n, fAngleMedian_n, fAngleStdev_n, fAngleSkew_n, fReconCT_n, fTRMS_n})
+            fMask.set(key);
+        if (event.bUseResidual) fMask.set(fprompt_nfit);
+
+        // MinimizeTRMS
+        if (event.fNeutFitMode != mGRID) {
+            iMask.set(iNFitIter);
+            iMask.set(iNFitEval);
+        }
+        if (event.fNeutFitMode == mBNB) iMask.set(iNFitPruned);
+    }
+
+    if (!event.bData) {
+        iMask.set(iCaptureType);
+        iMask.set(iTrueCaptureID);
+    }
+
+    // SetFortranVariables
+    iMask.set(iN1300);
+    for (auto key: {fDWall, fBSenergy, fbsvx, fbsvy, fbsvz, fBSReconCT, fBSgood, fBSdirks, fBSovaq, fBSpatlik,
+                    fprompt_bonsai})
+        fMask.set(key);
+    if (event.bUseNeutFit) {
+        fMask.set(fDWall_n);
+        fMask.set(fbonsai_nfit);
+    }
+
+    // SetTMVAOutput
+    if (event.bUseTMVA) fMask.set(fTMVAOutput);
+}
+
+void NTagCandidate::SetFeatureVariables()
+{
+    float pv[3] = {currentEvent->pvx, currentEvent->pvy, currentEvent->pvz};
+    static thread_local HitGeometry promptGeometry;
+    promptGeometry.Set(GetHitCableIDs(), nHits, pv);
+
+    // Already set by NTagEventInfo::ApplyCascade if the cascade is used
+    if (!IsSet(iNHits)) SetCascadeVariables(promptGeometry);
+
+    Set(fDWallMeanDir, GetDWallInMeanDirection(promptGeometry));
+    Set(fThetaMeanDir, GetMeanAngleInMeanDirection(promptGeometry));
+
+    const auto& openingAngleStats = GetOpeningAngleStats(promptGeometry, currentEvent->ANGLESAMPLE);
+    Set(fAngleMean, openingAngleStats[0]);
+    Set(fAngleMedian, openingAngleStats[1]);
+    Set(fAngleStdev, openingAngleStats[2]);
+    Set(fAngleSkew, openingAngleStats[3]);
 
     if (currentEvent->bUseNeutFit) {
         if (currentEvent->bUseResidual)
@@ -66,21 +179,40 @@ void NTagCandidate::SetVariables()
             SetVariablesForMode(tNEUTFIT_RAW);
     }
 
-    SetVariablesForMode(tBONSAI);
-    if (currentEvent->bUseNeutFit)
-        fVarMap["bonsai_nfit"] = Norm(fVarMap["bsvx"] - fVarMap["nvx"],
-                                      fVarMap["bsvy"] - fVarMap["nvy"],
-                                      fVarMap["bsvz"] - fVarMap["nvz"]);
-
     if (!currentEvent->bData)  SetTrueInfo();
+}
 
-    if (currentEvent->bUseTMVA) {
-        SetNNVariables();
-        SetTMVAOutput();
+int NTagCandidate::SubmitBonsaiFit(NTagBonsaiPool& pool)
+{
+    static thread_local std::vector<int>   cabiz;
+    static thread_local std::vector<float> tiskz, qiskz;
+    GetRawHitsInWindow(tBONSAI, cabiz, tiskz, qiskz);
+
+    Set(iN1300, tiskz.size());
+    return pool.Submit(currentEvent->bData, GetReconCT(), tiskz, qiskz, cabiz);
+}
+
+void NTagCandidate::SetFortranVariables(const NTagBonsaiFit* fit)
+{
+    float pv[3] = {currentEvent->pvx, currentEvent->pvy, currentEvent->pvz};
+    Set(fDWall, wallsk_(pv));
+
+    if (currentEvent->bUseNeutFit) {
+        float nv[3] = {Get(fnvx), Get(fnvy), Get(fnvz)};
+        Set(fDWall_n, wallsk_(nv));
     }
+
+    if (fit) SetBonsaiVariables(*fit);
+    else     SetVariablesForMode(tBONSAI);
+
+    if (currentEvent->bUseNeutFit)
+        Set(fbonsai_nfit, Norm(Get(fbsvx) - Get(fnvx),
+                               Get(fbsvy) - Get(fnvy),
+                               Get(fbsvz) - Get(fnvz)));
 }
 
-void NTagCandidate::SetVariablesForMode(ExtractionMode tWindow)
+void NTagCandidate::GetRawHitsInWindow(ExtractionMode tWindow, std::vector<int>& cabiz,
+                                       std::vector<float>& tiskz, std::vector<float>& qiskz)
 {
     float leftEdge = 0;
     float rightEdge = 0;
@@ -95,111 +227,123 @@ void NTagCandidate::SetVariablesForMode(ExtractionMode tWindow)
         leftEdge = -tBONSAI*0.4; rightEdge = +tBONSAI*0.6;
     }
     else {
-        msg.Print("In function NTagCandidate::SetVariablesForMode", pWARNING);
+        msg.Print("In function NTagCandidate::GetRawHitsInWindow", pWARNING);
         msg.Print(Form("Input time window %d is not compatible.", tWindow), pERROR);
     }
 
-    std::vector<int>    index, cabiz;
-    std::vector<float>  tiskz, qiskz;
+    static thread_local std::vector<int> index;
+    cabiz.clear(); tiskz.clear(); qiskz.clear();
 
     // Save hit indices within time window from reconstructed capture time
-    for (int iHit = 0; iHit < currentEvent->nqiskz; iHit++) {
-        if (currentEvent->vUnsortedT_ToF[iHit] > fVarMap["ReconCT"] + leftEdge
-        &&  currentEvent->vUnsortedT_ToF[iHit] < fVarMap["ReconCT"] + rightEdge) {
-            index.push_back(iHit);
-        }
-    }
+    float reconCT = GetReconCT();
+    currentEvent->GetRawHitIndicesInWindow(reconCT + leftEdge, reconCT + rightEdge, index);
 
     for (unsigned int iHit = 0; iHit < index.size(); iHit++) {
         cabiz.push_back( currentEvent->vCABIZ[ index[iHit] ] );
         tiskz.push_back( currentEvent->vTISKZ[ index[iHit] ] );
         qiskz.push_back( currentEvent->vQISKZ[ index[iHit] ] );
     }
+}
+
+void NTagCandidate::SetVariablesForMode(ExtractionMode tWindow)
+{
+    // Buffers reused across candidates, so that they are not allocated for every candidate
+    static thread_local std::vector<int>    cabiz;
+    static thread_local std::vector<float>  tiskz, qiskz, tiskz_ToF;
+    static thread_local HitGeometry         fitGeometry;
+    GetRawHitsInWindow(tWindow, cabiz, tiskz, qiskz);
 
     // 50 ns window
     if (tWindow == tNEUTFIT) {
-        iVarMap["N50"] = tiskz.size();
+        Set(iN50, tiskz.size());
 
         float nv[3];
-        fVarMap["MinTRMS50_n"] = MinimizeTRMS(tiskz, cabiz, nv);
-        fVarMap["nvx"] = nv[0]; fVarMap["nvy"] = nv[1]; fVarMap["nvz"] = nv[2];
+        Set(fMinTRMS50_n, MinimizeTRMS(tiskz, cabiz, nv));
+        Set(fnvx, nv[0]); Set(fnvy, nv[1]); Set(fnvz, nv[2]);
 
-        auto beta_n = GetBetaArray(vHitCableIDs, nv);
-        fVarMap["Beta1_n"] = beta_n[1];
-        fVarMap["Beta2_n"] = beta_n[2];
-        fVarMap["Beta3_n"] = beta_n[3];
-        fVarMap["Beta4_n"] = beta_n[4];
-        fVarMap["Beta5_n"] = beta_n[5];
+        fitGeometry.Set(GetHitCableIDs(), nHits, nv);
+        auto beta_n = GetBetaArray(fitGeometry);
+        Set(fBeta1_n, beta_n[1]);
+        Set(fBeta2_n, beta_n[2]);
+        Set(fBeta3_n, beta_n[3]);
+        Set(fBeta4_n, beta_n[4]);
+        Set(fBeta5_n, beta_n[5]);
 
-        fVarMap["DWall_n"] = wallsk_(nv);
-        fVarMap["DWallMeanDir_n"] = GetDWallInMeanDirection(vHitCableIDs, nv);
+        Set(fDWallMeanDir_n, GetDWallInMeanDirection(fitGeometry));
 
-        const auto& openingAngleStats = GetOpeningAngleStats(vHitCableIDs, nv);
-        fVarMap["AngleMean_n"]   = openingAngleStats[0];
-        fVarMap["AngleMedian_n"] = openingAngleStats[1];
-        fVarMap["AngleStdev_n"]  = openingAngleStats[2];
-        fVarMap["AngleSkew_n"]   = openingAngleStats[3];
+        const auto& openingAngleStats = GetOpeningAngleStats(fitGeometry, currentEvent->ANGLESAMPLE);
+        Set(fAngleMean_n, openingAngleStats[0]);
+        Set(fAngleMedian_n, openingAngleStats[1]);
+        Set(fAngleStdev_n, openingAngleStats[2]);
+        Set(fAngleSkew_n, openingAngleStats[3]);
 
-        auto tiskz50_ToF = currentEvent->GetToFSubtracted(tiskz, cabiz, nv, true);
+        currentEvent->GetToFSubtracted(tiskz, cabiz, nv, tiskz_ToF, true);
 
         int NHitsn_iHit, tmpBestNHitsn = 0;
 
         // Search for a new best NHits (NHitsn) from these new ToF corrected hits
         int bestIndex = 0;
-        for (int iHit = 0; iHit < iVarMap["N50"]; iHit++) {
-            NHitsn_iHit = GetNhitsFromStartIndex(tiskz50_ToF, iHit, TWIDTH);
+        for (int iHit = 0; iHit < Get(iN50); iHit++) {
+            NHitsn_iHit = GetNhitsFromStartIndex(tiskz_ToF, iHit, TWIDTH);
             if (NHitsn_iHit > tmpBestNHitsn) {
                 tmpBestNHitsn = NHitsn_iHit; bestIndex = iHit;
-                iVarMap["NHits_n"] = tmpBestNHitsn;
-                fVarMap["ReconCT_n"] = (tiskz50_ToF[iHit] + tiskz50_ToF[iHit+tmpBestNHitsn-1]) / 2.;
+                Set(iNHits_n, tmpBestNHitsn);
+                Set(fReconCT_n, (tiskz_ToF[iHit] + tiskz_ToF[iHit+tmpBestNHitsn-1]) / 2.);
             }
         }
-        fVarMap["TRMS_n"] = GetTRMSFromStartIndex(tiskz50_ToF, bestIndex, TWIDTH);
+        Set(fTRMS_n, GetTRMSFromStartIndex(tiskz_ToF, bestIndex, TWIDTH));
 
-        fVarMap["prompt_nfit"] = Norm(currentEvent->pvx - fVarMap["nvx"],
-                                      currentEvent->pvy - fVarMap["nvy"],
-                                      currentEvent->pvz - fVarMap["nvz"]);
+        Set(fprompt_nfit, Norm(currentEvent->pvx - Get(fnvx),
+                               currentEvent->pvy - Get(fnvy),
+                               currentEvent->pvz - Get(fnvz)));
     }
 
     // 200 ns window
     else if (tWindow == tNEUTFIT_RAW) {
-        iVarMap["N200Raw"] = tiskz.size();
+        Set(iN200Raw, tiskz.size());
 
         float nv[3];
-        fVarMap["MinTRMS30_n"] = MinimizeTRMS(vHitRawTimes, vHitCableIDs, nv);
-        fVarMap["nvx"] = nv[0]; fVarMap["nvy"] = nv[1]; fVarMap["nvz"] = nv[2];
-
-        auto beta_100 = GetBetaArray(vHitCableIDs, nv);
-        fVarMap["Beta1_n"] = beta_100[1];
-        fVarMap["Beta2_n"] = beta_100[2];
-        fVarMap["Beta3_n"] = beta_100[3];
-        fVarMap["Beta4_n"] = beta_100[4];
-        fVarMap["Beta5_n"] = beta_100[5];
-
-        fVarMap["DWall_n"] = wallsk_(nv);
-        fVarMap["DWallMeanDir_n"] = GetDWallInMeanDirection(vHitCableIDs, nv);
-
-        const auto& openingAngleStats = GetOpeningAngleStats(vHitCableIDs, nv);
-        fVarMap["AngleMean_n"]   = openingAngleStats[0];
-        fVarMap["AngleMedian_n"] = openingAngleStats[1];
-        fVarMap["AngleStdev_n"]  = openingAngleStats[2];
-        fVarMap["AngleSkew_n"]   = openingAngleStats[3];
-
-        auto tiskz200_ToF = currentEvent->GetToFSubtracted(tiskz, cabiz, nv, true);
+        static thread_local std::vector<float> rawT;
+        static thread_local std::vector<int>   cabI;
+        rawT.resize(nHits);
+        cabI.assign(GetHitCableIDs(), GetHitCableIDs() + nHits);
+        for (int iHit = 0; iHit < nHits; iHit++)
+            rawT[iHit] = GetHitRawTime(iHit);
+
+        Set(fMinTRMS30_n, MinimizeTRMS(rawT, cabI, nv));
+        Set(fnvx, nv[0]); Set(fnvy, nv[1]); Set(fnvz, nv[2]);
+
+        fitGeometry.Set(GetHitCableIDs(), nHits, nv);
+        auto beta_100 = GetBetaArray(fitGeometry);
+        Set(fBeta1_n, beta_100[1]);
+        Set(fBeta2_n, beta_100[2]);
+        Set(fBeta3_n, beta_100[3]);
+        Set(fBeta4_n, beta_100[4]);
+        Set(fBeta5_n, beta_100[5]);
+
+        Set(fDWallMeanDir_n, GetDWallInMeanDirection(fitGeometry));
+
+        const auto& openingAngleStats = GetOpeningAngleStats(fitGeometry, currentEvent->ANGLESAMPLE);
+        Set(fAngleMean_n, openingAngleStats[0]);
+        Set(fAngleMedian_n, openingAngleStats[1]);
+        Set(fAngleStdev_n, openingAngleStats[2]);
+        Set(fAngleSkew_n, openingAngleStats[3]);
+
+        currentEvent->GetToFSubtracted(tiskz, cabiz, nv, tiskz_ToF, true);
 
         int NHitsn_iHit, tmpBestNHitsn = 0;
 
         // Search for a new best NHits (NHitsn) from these new ToF corrected hits
         int bestIndex = 0;
-        for (int iHit = 0; iHit < iVarMap["N200Raw"]; iHit++) {
-            NHitsn_iHit = GetNhitsFromStartIndex(tiskz200_ToF, iHit, TWIDTH);
+        for (int iHit = 0; iHit < Get(iN200Raw); iHit++) {
+            NHitsn_iHit = GetNhitsFromStartIndex(tiskz_ToF, iHit, TWIDTH);
             if (NHitsn_iHit > tmpBestNHitsn) {
                 tmpBestNHitsn = NHitsn_iHit; bestIndex = iHit;
-                iVarMap["NHits_n"] = tmpBestNHitsn;
-                fVarMap["ReconCT_n"] = (tiskz200_ToF[iHit] + tiskz200_ToF[iHit+tmpBestNHitsn-1]) / 2.;
+                Set(iNHits_n, tmpBestNHitsn);
+                Set(fReconCT_n, (tiskz_ToF[iHit] + tiskz_ToF[iHit+tmpBestNHitsn-1]) / 2.);
             }
         }
-        fVarMap["TRMS_n"] = GetTRMSFromStartIndex(tiskz200_ToF, bestIndex, TWIDTH);
+        Set(fTRMS_n, GetTRMSFromStartIndex(tiskz_ToF, bestIndex, TWIDTH));
     }
 
     // 1300 ns window
@@ -207,63 +351,69 @@ void NTagCandidate::SetVariablesForMode(ExtractionMode tWindow)
         if (currentEvent->nProcessedEvents == 0 && candidateID == 0)
             msg.PrintBlock("Initializing BONSAI lfallfit...", pSUBEVENT);
 
-        iVarMap["N1300"] = tiskz.size();
-        int isData = 0; if (currentEvent->bData) isData = 1;
-
-        bonsai_fit_(&isData, &fVarMap["ReconCT"], tiskz.data(), qiskz.data(), cabiz.data(), &iVarMap["N1300"],
-                    &fVarMap["BSenergy"], &fVarMap["bsvx"], &fVarMap["bsvy"], &fVarMap["bsvz"],
-                    &fVarMap["BSReconCT"], &fVarMap["BSgood"], &fVarMap["BSdirks"], &fVarMap["BSpatlik"], &fVarMap["BSovaq"]);
-
-        // Fix bsPatlik->-inf bug
-        if (fVarMap["BSpatlik"] < -9999.) fVarMap["BSpatlik"] = -9999.;
-
-        fVarMap["prompt_bonsai"] = Norm(currentEvent->pvx - fVarMap["bsvx"],
-                                        currentEvent->pvy - fVarMap["bsvy"],
-                                        currentEvent->pvz - fVarMap["bsvz"]);
+        Set(iN1300, tiskz.size());
+        NTagBonsaiFit fit = NTagBonsaiPool::Fit(currentEvent->bData, Get(fReconCT),
+                                                tiskz.data(), qiskz.data(), cabiz.data(), tiskz.size());
+        SetBonsaiVariables(fit);
     }
 }
 
+void NTagCandidate::SetBonsaiVariables(const NTagBonsaiFit& fit)
+{
+    Set(fBSenergy, fit.energy);
+    Set(fbsvx, fit.vx); Set(fbsvy, fit.vy); Set(fbsvz, fit.vz);
+    Set(fBSReconCT, fit.t);
+    Set(fBSgood, fit.good);
+    Set(fBSdirks, fit.dirks);
+    Set(fBSovaq, fit.ovaq);
+
+    // Fix bsPatlik->-inf bug
+    Set(fBSpatlik, fit.patlik < -9999. ? -9999. : fit.patlik);
+
+    Set(fprompt_bonsai, Norm(currentEvent->pvx - Get(fbsvx),
+                             currentEvent->pvy - Get(fbsvy),
+                             currentEvent->pvz - Get(fbsvz)));
+}
+
 void NTagCandidate::SetTrueInfo()
 {
     // Default: not a capture
-    iVarMap["CaptureType"] = 0;
-    iVarMap["TrueCaptureID"] = -1;
+    Set(iCaptureType, 0);
+    Set(iTrueCaptureID, -1);
 
     // Search for matching capture time within true capture vector of current event
     for (int iCapture = 0; iCapture < currentEvent->nTrueCaptures; iCapture++) {
-        if (fabs(currentEvent->vTrueCT[iCapture] + currentEvent->trgOffset - fVarMap["ReconCT"])
+        if (fabs(currentEvent->vTrueCT[iCapture] + currentEvent->trgOffset - Get(fReconCT))
             < currentEvent->TMATCHWINDOW ) {
-            iVarMap["TrueCaptureID"] = iCapture;
-            if (currentEvent->vTotGammaE[iCapture] > 6.) iVarMap["CaptureType"] = 2; // Gd
-            else                                         iVarMap["CaptureType"] = 1; // H
+            Set(iTrueCaptureID, iCapture);
+            if (currentEvent->vTotGammaE[iCapture] > 6.) Set(iCaptureType, 2); // Gd
+            else                                         Set(iCaptureType, 1); // H
         }
     }
 }
 
 void NTagCandidate::SetNNVariables()
 {
-    // Set TMVA integer variable map
-    for (auto const& pair: iVarMap) {
-        if (currentEvent->TMVATools.fVariables.IsTMVAVariable(pair.first)) {
-            currentEvent->TMVATools.fVariables.PushBack(pair.first, pair.second);
-        }
+    // Set TMVA integer variables bound in NTagEventInfo::BindTMVAVariables
+    for (int key = 0; key < nIVariables; key++) {
+        if (iVarIsSet[key] && currentEvent->iTMVAVectors[key])
+            currentEvent->iTMVAVectors[key]->push_back(iVars[key]);
     }
 
-    // Set TMVA float variable map
-    for (auto const& pair: fVarMap) {
-        if (currentEvent->TMVATools.fVariables.IsTMVAVariable(pair.first)) {
-            currentEvent->TMVATools.fVariables.PushBack(pair.first, pair.second);
-        }
+    // Set TMVA float variables
+    for (int key = 0; key < nFVariables; key++) {
+        if (fVarIsSet[key] && currentEvent->fTMVAVectors[key])
+            currentEvent->fTMVAVectors[key]->push_back(fVars[key]);
     }
 
     if (currentEvent->bUseTMVA) {
-        currentEvent->TMVATools.fVariables.SetCaptureType(iVarMap["CaptureType"]);
+        currentEvent->TMVATools.fVariables.SetCaptureType(Get(iCaptureType));
     }
 }
 
 void NTagCandidate::SetTMVAOutput()
 {
-    fVarMap["TMVAOutput"] = currentEvent->TMVATools.GetOutputFromCandidate(candidateID);
+    Set(fTMVAOutput, currentEvent->TMVATools.GetOutputFromCandidate(candidateID));
 }
 
 void NTagCandidate::DumpHitInfo()
@@ -272,13 +422,15 @@ void NTagCandidate::DumpHitInfo()
     msg.Print("RawHitT [ns]   ResHitT [ns]   Q [p.e.]       PMT ID         IsSignalHit?   ");
     msg.Print("---------------------------------------------------------------------------");
 
-    for (unsigned int iHit = 0; iHit < vHitRawTimes.size(); iHit++) {
+    const int* sigF = GetHitSigFlags();
+
+    for (int iHit = 0; iHit < nHits; iHit++) {
         msg.Print("", pDEFAULT, false);
-        std::cout << std::left << std::setw(15) << vHitRawTimes[iHit];
-        std::cout << std::left << std::setw(15) << vHitResTimes[iHit];
-        std::cout << std::left << std::setw(15) << vHitChargePE[iHit];
-        std::cout << std::left << std::setw(15) << vHitCableIDs[iHit];
-        if (!vHitSigFlags.empty()) std::cout << std::left << std::setw(15) << vHitSigFlags[iHit];
+        std::cout << std::left << std::setw(15) << GetHitRawTime(iHit);
+        std::cout << std::left << std::setw(15) << GetHitResTimes()[iHit];
+        std::cout << std::left << std::setw(15) << GetHitChargePE()[iHit];
+        std::cout << std::left << std::setw(15) << GetHitCableIDs()[iHit];
+        if (sigF) std::cout << std::left << std::setw(15) << sigF[iHit];
         std::cout << std::endl;
     }
 }
@@ -293,64 +445,59 @@ void NTagCandidate::DumpVariables()
     msg.Print("Variable       : Value            ");
     msg.Print("----------------------------------");
 
-    for (auto const& pair: iVarMap) {
+    for (int key = 0; key < nIVariables; key++) {
+        if (!iVarIsSet[key]) continue;
         msg.Print("", pDEFAULT, false);
-        std::cout << std::left << std::setw(15) << pair.first << ": " << pair.second << std::endl;
+        std::cout << std::left << std::setw(15) << iVariableNames[key] << ": " << iVars[key] << std::endl;
     }
-    for (auto const& pair: fVarMap) {
+    for (int key = 0; key < nFVariables; key++) {
+        if (!fVarIsSet[key]) continue;
         msg.Print("", pDEFAULT, false);
-        std::cout << std::left << std::setw(15) << pair.first << ": " << pair.second << std::endl;
+        std::cout << std::left << std::setw(15) << fVariableNames[key] << ": " << fVars[key] << std::endl;
     }
 
     std::cout << "\n" << std::endl;
 }
 
-std::array<float, 6> NTagCandidate::GetBetaArray(const std::vector<int>& PMTID, float v[3])
+float NTagCandidate::MinimizeTRMS(const std::vector<float>& T, const std::vector<int>& PMTID, float rmsFitVertex[])
 {
-    std::array<float, 6> beta = {0., 0., 0., 0., 0., 0};
-    int nHits = PMTID.size();
-    if (nHits == 0) return beta;
-
-    // direction vector from vertex to each hit PMT
-    float uvx[nHits], uvy[nHits], uvz[nHits];
-
-    for (int iHit = 0; iHit < nHits; iHit++) {
-        float distFromVertexToPMT;
-        float vecFromVertexToPMT[3];
-        for (int dim = 0; dim < 3; dim++)
-            vecFromVertexToPMT[dim] = NTagConstant::PMTXYZ[PMTID[iHit]-1][dim] - v[dim];
-        distFromVertexToPMT = Norm(vecFromVertexToPMT);
-        uvx[iHit] = vecFromVertexToPMT[0] / distFromVertexToPMT;
-        uvy[iHit] = vecFromVertexToPMT[1] / distFromVertexToPMT;
-        uvz[iHit] = vecFromVertexToPMT[2] / distFromVertexToPMT;
+    float minTRMS;
+    nFitIterations = 0;
+    nFitEvaluations = 0;
+    nFitPruned = 0;
+
+    // The default grid mode writes no fit statistics, so that its output stays the same
+    if (currentEvent->fNeutFitMode == mGRID) {
+        minTRMS = SearchTRMSGrid(T, PMTID, rmsFitVertex, std::numeric_limits<int>::max());
+        return GetGridFitTRMS(T, PMTID, rmsFitVertex, minTRMS);
     }
 
-    for (int i = 0; i < nHits-1; i++) {
-        for (int j = i+1; j < nHits; j++) {
-            // cosine angle between two consecutive uv vectors
-            float cosTheta = uvx[i]*uvx[j] + uvy[i]*uvy[j] + uvz[i]*uvz[j];
-            for (int k = 1; k <= 5; k++)
-                beta[k] += GetLegendreP(k, cosTheta);
-        }
+    if (currentEvent->fNeutFitMode == mLM) {
+        // Seed with the coarsest grid levels
+        SearchTRMSGrid(T, PMTID, rmsFitVertex, currentEvent->LMSEEDLEVELS);
+        minTRMS = MinimizeTRMSWithLM(T, PMTID, rmsFitVertex);
+    }
+    else {
+        minTRMS = SearchTRMSGridPruned(T, PMTID, rmsFitVertex);
+        minTRMS = GetGridFitTRMS(T, PMTID, rmsFitVertex, minTRMS);
+        Set(iNFitPruned, nFitPruned);
     }
 
-    for (int k = 1; k <= 5; k++)
-        beta[k] = 2.*beta[k] / float(nHits) / float(nHits-1);
+    Set(iNFitIter, nFitIterations);
+    Set(iNFitEval, nFitEvaluations);
 
-    // Return calculated beta array
-    return beta;
+    return minTRMS;
 }
 
-float NTagCandidate::MinimizeTRMS(const std::vector<float>& T, const std::vector<int>& PMTID, float rmsFitVertex[])
+float NTagCandidate::SearchTRMSGrid(const std::vector<float>& T, const std::vector<int>& PMTID, float rmsFitVertex[],
+                                     int maxLevels)
 {
     float maxSearchRange = currentEvent->VTXSRCRANGE;
     float gridWidth;
-    bool doSort = true;
     int nHits = static_cast<int>(T.size());
     assert(nHits == static_cast<int>(PMTID.size()));
 
     (maxSearchRange > 200) ? gridWidth = 500 : gridWidth = maxSearchRange / 2.;
-    std::vector<float>  t_ToF;
 
     int nGridsInR, nGridsInZ;
     nGridsInZ = (int)(2*ZPINTK / gridWidth);
@@ -362,10 +509,22 @@ float NTagCandidate::MinimizeTRMS(const std::vector<float>& T, const std::vector
     std::array<float, 3> gridPoint;                       // point in grid to find TRMS
 
     float minTRMS = 9999.;
-    float tRMS;
+
+    // Coarse grid levels are looked up in the precomputed ToF table
+    const NTagGridToFTable& gridTable = *currentEvent->fGridToFTableInUse;
+    int level = 0;
+    int originRow = -1, minGridRow = -1;
+
+    // Grid points of a level, their table rows, and TRMS, reused across calls
+    static thread_local std::vector<float> levelPoints;
+    static thread_local std::vector<int> levelRows;
+    static thread_local std::vector<float> levelTRMS;
 
     // Repeat until grid width gets small enough
-    while (gridWidth > currentEvent->MINGRIDWIDTH) {
+    while (gridWidth > currentEvent->MINGRIDWIDTH && level < maxLevels) {
+
+        levelPoints.clear();
+        levelRows.clear();
 
         // Allocate coordinates to a grid point, X and Y
         for (int iGridX = 0; iGridX < nGridsInR; iGridX++) {
@@ -387,25 +546,32 @@ float NTagCandidate::MinimizeTRMS(const std::vector<float>& T, const std::vector
                     // Skip grid point further away from the maximum search range
                     if (GetDistance(gridOrigin.data(), gridPoint.data()) > maxSearchRange) continue;
 
-                    // Subtract ToF from the search vertex
-                    t_ToF = currentEvent->GetToFSubtracted(T, PMTID, gridPoint.data(), doSort);
-                    // Get TRMS from the residual hit times
-                    tRMS = GetTRMS(t_ToF);
-
-                    // Save TRMS minimizing grid point
-                    if (tRMS < minTRMS) {
-                        minTRMS = tRMS;
-                        minGridPoint = gridPoint;
-                    }
+                    // Save the search vertex to get TRMS of the residual hit times
+                    levelPoints.insert(levelPoints.end(), gridPoint.begin(), gridPoint.end());
+                    levelRows.push_back(gridTable.GetRow(level, originRow, iGridX, iGridY, iGridZ));
                 }
             }
         }
 
+        GetTRMSOfGridPoints(T, PMTID, levelPoints, levelRows, levelTRMS);
+
+        // Save TRMS minimizing grid point
+        for (unsigned int iPoint = 0; iPoint < levelRows.size(); iPoint++) {
+            if (levelTRMS[iPoint] < minTRMS) {
+                minTRMS = levelTRMS[iPoint];
+                std::copy(levelPoints.begin() + 3*iPoint, levelPoints.begin() + 3*iPoint + 3, minGridPoint.begin());
+                minGridRow = levelRows[iPoint];
+            }
+        }
+
         // Change grid origin to the TRMS-minimizing grid point,
         // shorten the grid width,
         // and repeat until grid width gets small enough!
         gridOrigin = minGridPoint;
+        originRow = minGridRow;
         gridWidth = gridWidth / 2.;
+        level++;
+        nFitIterations++;
     }
 
     // Output fit vertex = final grid origin
@@ -414,4 +580,351 @@ float NTagCandidate::MinimizeTRMS(const std::vector<float>& T, const std::vector
     rmsFitVertex[2] = gridOrigin[2];
 
     return minTRMS;
-}
\ No newline at end of file
+}
+
+float NTagCandidate::GetGridFitTRMS(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3],
+                                    float minTRMS)
+{
+    // No grid point has a TRMS with less than two hits, and the search returns its initial value
+    if (T.size() < 2) return minTRMS;
+
+    // Float sums of the sorted hit times, rounded as the grid search took TRMS before the kernel
+    static thread_local std::vector<float> t_ToF;
+    currentEvent->GetToFSubtracted(T, PMTID, fitVertex, t_ToF, true);
+
+    return GetTRMS(t_ToF);
+}
+
+void NTagCandidate::GetTRMSOfGridPoints(const std::vector<float>& T, const std::vector<int>& PMTID,
+                                        const std::vector<float>& points, const std::vector<int>& rows,
+                                        std::vector<float>& tRMS)
+{
+    int nHits = static_cast<int>(T.size());
+    int nPoints = static_cast<int>(rows.size());
+    const NTagGridToFTable& gridTable = *currentEvent->fGridToFTableInUse;
+
+    tRMS.resize(nPoints);
+    nFitEvaluations += nPoints;
+
+    // Tabulated points from the ToF table, others in batches of vertices
+    static thread_local std::vector<float> batchPoints, batchTRMS;
+    static thread_local std::vector<int> batchIndices;
+    batchPoints.clear(); batchIndices.clear();
+
+    for (int iPoint = 0; iPoint < nPoints; iPoint++) {
+        if (rows[iPoint] >= 0)
+            tRMS[iPoint] = gridTable.GetTable(rows[iPoint]).GetTRMS(T.data(), PMTID.data(), nHits);
+        else {
+            batchPoints.insert(batchPoints.end(), points.begin() + 3*iPoint, points.begin() + 3*iPoint + 3);
+            batchIndices.push_back(iPoint);
+        }
+    }
+
+    if (batchIndices.empty()) return;
+
+    batchTRMS.resize(batchIndices.size());
+    NTagToFTable::GetTRMS(T.data(), PMTID.data(), nHits, batchPoints.data(), batchIndices.size(), batchTRMS.data());
+
+    for (unsigned int iBatch = 0; iBatch < batchIndices.size(); iBatch++)
+        tRMS[batchIndices[iBatch]] = batchTRMS[iBatch];
+}
+
+float NTagCandidate::SearchTRMSGridPruned(const std::vector<float>& T, const std::vector<int>& PMTID, float rmsFitVertex[])
+{
+    int nHits = static_cast<int>(T.size());
+    assert(nHits == static_cast<int>(PMTID.size()));
+
+    // TRMS is undefined with less than two hits: nothing to bound
+    if (nHits < 2)
+        return SearchTRMSGrid(T, PMTID, rmsFitVertex, std::numeric_limits<int>::max());
+
+    float maxSearchRange = currentEvent->VTXSRCRANGE;
+    float gridWidth;
+
+    (maxSearchRange > 200) ? gridWidth = 500 : gridWidth = maxSearchRange / 2.;
+
+    int nGridsInR, nGridsInZ;
+    nGridsInZ = (int)(2*ZPINTK / gridWidth);
+    nGridsInR = (int)(2*RINTK / gridWidth);
+
+    // Blocks of 3x3x3 grid points
+    int nBlocksInR = (nGridsInR + 2) / 3;
+    int nBlocksInZ = (nGridsInZ + 2) / 3;
+    int nBlocks = nBlocksInR * nBlocksInR * nBlocksInZ;
+
+    // Grid search starts from tank center
+    std::array<float, 3> gridOrigin = {0., 0., 0.};
+    std::array<float, 3> minGridPoint = {0., 0., 0.};
+    std::array<float, 3> gridPoint;
+
+    float minTRMS = 9999.;
+
+    const NTagGridToFTable& gridTable = *currentEvent->fGridToFTableInUse;
+    int level = 0;
+    int originRow = -1, minGridRow = -1;
+
+    // Grid point coordinates and validity, same as SearchTRMSGrid
+    auto setGridPoint = [&](int iGridX, int iGridY, int iGridZ) {
+        gridPoint[0] = gridOrigin[0] + (iGridX - nGridsInR/2.) * gridWidth;
+        gridPoint[1] = gridOrigin[1] + (iGridY - nGridsInR/2.) * gridWidth;
+        gridPoint[2] = gridOrigin[2] + (iGridZ - nGridsInZ/2.) * gridWidth;
+        if (sqrt(gridPoint[0]*gridPoint[0] + gridPoint[1]*gridPoint[1]) > RINTK) return false;
+        if (gridPoint[2] > ZPINTK || gridPoint[2] < -ZPINTK) return false;
+        if (GetDistance(gridOrigin.data(), gridPoint.data()) > maxSearchRange) return false;
+        return true;
+    };
+
+    // Buffers reused across calls
+    static thread_local std::vector<std::pair<float, int>> blockBounds;
+    static thread_local std::vector<float> centerTRMS;
+    static thread_local std::vector<int> centerRow;
+    centerTRMS.resize(nBlocks);
+    centerRow.resize(nBlocks);
+
+    // Points to evaluate at once: coordinates, table rows, TRMS, and block or grid indices
+    static thread_local std::vector<float> points, pointTRMS;
+    static thread_local std::vector<int> pointRows, pointIndices;
+
+    float boundScale = sqrt(nHits / (nHits - 1.));
+
+    while (gridWidth > currentEvent->MINGRIDWIDTH) {
+
+        // Maximum TRMS change within a block
+        float maxTRMSChange = gridWidth * sqrt(3.) / NTagConstant::C_WATER * boundScale;
+
+        // Blocks overlapping the bounding box of the search range
+        auto getBlockRange = [&](int nGrids, int& first, int& last) {
+            first = std::max(0, (int)floor(nGrids/2. - maxSearchRange/gridWidth)) / 3;
+            last  = std::min(nGrids - 1, (int)ceil(nGrids/2. + maxSearchRange/gridWidth)) / 3;
+        };
+        int firstBlock[3], lastBlock[3];
+        getBlockRange(nGridsInR, firstBlock[0], lastBlock[0]);
+        getBlockRange(nGridsInR, firstBlock[1], lastBlock[1]);
+        getBlockRange(nGridsInZ, firstBlock[2], lastBlock[2]);
+
+        // Lower bounds from block centers
+        blockBounds.clear();
+        points.clear(); pointRows.clear(); pointIndices.clear();
+        for (int iBlockX = firstBlock[0]; iBlockX <= lastBlock[0]; iBlockX++)
+        for (int iBlockY = firstBlock[1]; iBlockY <= lastBlock[1]; iBlockY++)
+        for (int iBlockZ = firstBlock[2]; iBlockZ <= lastBlock[2]; iBlockZ++) {
+            int iBlock = (iBlockX * nBlocksInR + iBlockY) * nBlocksInZ + iBlockZ;
+            int iCenterX = 3 * iBlockX + 1;
+            int iCenterY = 3 * iBlockY + 1;
+            int iCenterZ = 3 * iBlockZ + 1;
+
+            // Skip blocks without any grid point to evaluate
+            int nPoints = 0;
+            for (int iGridX = iCenterX - 1; iGridX < std::min(iCenterX + 2, nGridsInR); iGridX++)
+                for (int iGridY = iCenterY - 1; iGridY < std::min(iCenterY + 2, nGridsInR); iGridY++)
+                    for (int iGridZ = iCenterZ - 1; iGridZ < std::min(iCenterZ + 2, nGridsInZ); iGridZ++)
+                        nPoints += setGridPoint(iGridX, iGridY, iGridZ);
+            if (!nPoints) continue;
+
+            // Block centers may be off the grid or out of the tank: only the position matters
+            bool isGridPoint = setGridPoint(iCenterX, iCenterY, iCenterZ)
+                               && iCenterX < nGridsInR && iCenterY < nGridsInR && iCenterZ < nGridsInZ;
+
+            // Not worth bounding a single point
+            if (!isGridPoint && nPoints == 1) {
+                centerTRMS[iBlock] = -1;
+                blockBounds.push_back(std::make_pair(-std::numeric_limits<float>::max(), iBlock));
+                continue;
+            }
+
+            points.insert(points.end(), gridPoint.begin(), gridPoint.end());
+            pointRows.push_back(isGridPoint ? gridTable.GetRow(level, originRow, iCenterX, iCenterY, iCenterZ) : -1);
+            pointIndices.push_back(iBlock);
+        }
+
+        GetTRMSOfGridPoints(T, PMTID, points, pointRows, pointTRMS);
+
+        for (unsigned int iCenter = 0; iCenter < pointIndices.size(); iCenter++) {
+            int iBlock = pointIndices[iCenter];
+            centerTRMS[iBlock] = pointTRMS[iCenter];
+            centerRow[iBlock] = pointRows[iCenter];
+
+            // Lower bound with a margin for float rounding of hit times and ToFs
+            float lowerBound = pointTRMS[iCenter] * (1 - 1e-5) - maxTRMSChange - 1e-3;
+            blockBounds.push_back(std::make_pair(lowerBound, iBlock));
+        }
+
+        // Visit blocks with smaller lower bounds first
+        std::sort(blockBounds.begin(), blockBounds.end());
+
+        float levelMinTRMS = minTRMS;
+        int levelMinIndex = -1;
+        std::array<float, 3> levelMinPoint = minGridPoint;
+        int levelMinRow = minGridRow;
+
+        // Smaller TRMS wins; for equal TRMS, the earlier point in the loop of SearchTRMSGrid
+        auto updateMinimum = [&](float tRMS, int index, const float* point, int row) {
+            if (tRMS < levelMinTRMS || (tRMS == levelMinTRMS && levelMinIndex >= 0 && index < levelMinIndex)) {
+                levelMinTRMS = tRMS;
+                levelMinIndex = index;
+                std::copy(point, point + 3, levelMinPoint.begin());
+                levelMinRow = row;
+            }
+        };
+
+        for (const auto& blockBound: blockBounds) {
+            int iBlock = blockBound.second;
+            int iBlockX = iBlock / (nBlocksInR * nBlocksInZ);
+            int iBlockY = iBlock / nBlocksInZ % nBlocksInR;
+            int iBlockZ = iBlock % nBlocksInZ;
+
+            // Skip if no point in the block can be smaller than the current minimum
+            bool prune = blockBound.first > levelMinTRMS;
+
+            points.clear(); pointRows.clear(); pointIndices.clear();
+            for (int iGridX = 3*iBlockX; iGridX < std::min(3*iBlockX + 3, nGridsInR); iGridX++) {
+                for (int iGridY = 3*iBlockY; iGridY < std::min(3*iBlockY + 3, nGridsInR); iGridY++) {
+                    for (int iGridZ = 3*iBlockZ; iGridZ < std::min(3*iBlockZ + 3, nGridsInZ); iGridZ++) {
+
+                        if (!setGridPoint(iGridX, iGridY, iGridZ)) continue;
+                        if (prune) { nFitPruned++; continue; }
+
+                        // Block center is already evaluated
+                        int index = (iGridX * nGridsInR + iGridY) * nGridsInZ + iGridZ;
+                        if (iGridX % 3 == 1 && iGridY % 3 == 1 && iGridZ % 3 == 1) {
+                            updateMinimum(centerTRMS[iBlock], index, gridPoint.data(), centerRow[iBlock]);
+                            continue;
+                        }
+
+                        points.insert(points.end(), gridPoint.begin(), gridPoint.end());
+                        pointRows.push_back(gridTable.GetRow(level, originRow, iGridX, iGridY, iGridZ));
+                        pointIndices.push_back(index);
+                    }
+                }
+            }
+
+            GetTRMSOfGridPoints(T, PMTID, points, pointRows, pointTRMS);
+
+            for (unsigned int iPoint = 0; iPoint < pointIndices.size(); iPoint++)
+                updateMinimum(pointTRMS[iPoint], pointIndices[iPoint], &points[3*iPoint], pointRows[iPoint]);
+        }
+
+        minTRMS = levelMinTRMS;
+        minGridPoint = levelMinPoint;
+        minGridRow = levelMinRow;
+
+        gridOrigin = minGridPoint;
+        originRow = minGridRow;
+        gridWidth = gridWidth / 2.;
+        level++;
+        nFitIterations++;
+    }
+
+    rmsFitVertex[0] = gridOrigin[0];
+    rmsFitVertex[1] = gridOrigin[1];
+    rmsFitVertex[2] = gridOrigin[2];
+
+    return minTRMS;
+}
+
+float NTagCandidate::MinimizeTRMSWithLM(const std::vector<float>& T, const std::vector<int>& PMTID, float fitVertex[3])
+{
+    int nHits = static_cast<int>(T.size());
+    if (nHits < 2) return NTagToFTable::GetTRMS(T.data(), PMTID.data(), nHits, fitVertex);
+
+    const double c = NTagConstant::C_WATER;
+    double maxSearchRange = currentEvent->VTXSRCRANGE;
+
+    static thread_local std::vector<double> residual, jacobian, trialResidual, trialJacobian;
+    residual.resize(nHits); jacobian.resize(3*nHits);
+    trialResidual.resize(nHits); trialJacobian.resize(3*nHits);
+
+    // Fills centered residuals and their Jacobian at vertex v, and returns the sum of squares
+    auto evaluate = [&](const double v[3], std::vector<double>& res, std::vector<double>& jac) {
+        double meanR = 0., meanJ[3] = {0., 0., 0.};
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            const float* pmt = NTagConstant::PMTXYZ[PMTID[iHit]-1];
+            double d[3] = {pmt[0] - v[0], pmt[1] - v[1], pmt[2] - v[2]};
+            double dist = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+            res[iHit] = T[iHit] - dist / c;
+            meanR += res[iHit];
+            for (int dim = 0; dim < 3; dim++) {
+                jac[3*iHit+dim] = d[dim] / (c * dist);
+                meanJ[dim] += jac[3*iHit+dim];
+            }
+        }
+        meanR /= nHits;
+        for (int dim = 0; dim < 3; dim++) meanJ[dim] /= nHits;
+
+        double cost = 0.;
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            res[iHit] -= meanR;
+            cost += res[iHit] * res[iHit];
+            for (int dim = 0; dim < 3; dim++) jac[3*iHit+dim] -= meanJ[dim];
+        }
+        nFitEvaluations++;
+        return cost;
+    };
+
+    double v[3] = {fitVertex[0], fitVertex[1], fitVertex[2]};
+    double cost = evaluate(v, residual, jacobian);
+    double lambda = 1e-3;
+
+    for (int iter = 0; iter < 100 && lambda < 1e10; iter++) {
+        nFitIterations++;
+
+        // Normal equations: (J^T J + lambda * diag(J^T J)) step = -J^T r
+        double JTJ[3][3] = {{0.}}, JTr[3] = {0.};
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            const double* J = &jacobian[3*iHit];
+            for (int i = 0; i < 3; i++) {
+                JTr[i] += J[i] * residual[iHit];
+                for (int j = 0; j < 3; j++) JTJ[i][j] += J[i] * J[j];
+            }
+        }
+
+        double step[3];
+        double A[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                A[i][j] = JTJ[i][j] + (i == j ? lambda * JTJ[i][i] : 0.);
+
+        // Solve with Cramer's rule
+        double det = A[0][0]*(A[1][1]*A[2][2] - A[1][2]*A[2][1])
+                   - A[0][1]*(A[1][0]*A[2][2] - A[1][2]*A[2][0])
+                   + A[0][2]*(A[1][0]*A[2][1] - A[1][1]*A[2][0]);
+        if (det == 0.) break;
+        for (int k = 0; k < 3; k++) {
+            double M[3][3];
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    M[i][j] = (j == k) ? -JTr[i] : A[i][j];
+            step[k] = (M[0][0]*(M[1][1]*M[2][2] - M[1][2]*M[2][1])
+                     - M[0][1]*(M[1][0]*M[2][2] - M[1][2]*M[2][0])
+                     + M[0][2]*(M[1][0]*M[2][1] - M[1][1]*M[2][0])) / det;
+        }
+
+        double newV[3] = {v[0] + step[0], v[1] + step[1], v[2] + step[2]};
+        double stepSize = sqrt(step[0]*step[0] + step[1]*step[1] + step[2]*step[2]);
+
+        // Reject steps out of the tank or the search range
+        bool outOfRange = sqrt(newV[0]*newV[0] + newV[1]*newV[1]) > RINTK
+                          || newV[2] > ZPINTK || newV[2] < -ZPINTK
+                          || sqrt(newV[0]*newV[0] + newV[1]*newV[1] + newV[2]*newV[2]) > maxSearchRange;
+
+        double newCost = outOfRange ? cost : evaluate(newV, trialResidual, trialJacobian);
+
+        if (!outOfRange && newCost < cost) {
+            double costChange = cost - newCost;
+            for (int dim = 0; dim < 3; dim++) v[dim] = newV[dim];
+            residual.swap(trialResidual);
+            jacobian.swap(trialJacobian);
+            cost = newCost;
+            lambda /= 10.;
+
+            // Converged well below the grid resolution
+            if (stepSize < 0.1 || costChange < 1e-9 * cost) break;
+        }
+        else
+            lambda *= 10.;
+    }
+
+    for (int dim = 0; dim < 3; dim++) fitVertex[dim] = v[dim];
+
+    return NTagToFTable::GetTRMS(T.data(), PMTID.data(), nHits, fitVertex);
+}
@@ -1,9 +1,11 @@
 #include <math.h>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <numeric>
 
-#include <TMath.h>
 #include <TRandom.h>
 
 // Size limit of secondary tree/bank
@@ -17,6 +19,7 @@
 #include <appatspC.h>
 #include <geotnkC.h>
 #include <skheadC.h>
+#include <skbadcC.h>
 #include <sktqC.h>
 #include <skvectC.h>
 #include <neworkC.h>
@@ -26,8 +29,33 @@
 #include "NTagPath.hh"
 #include "NTagCalculator.hh"
 #include "NTagEventInfo.hh"
+#include "NTagMemory.hh"
 #include "SKLibs.hh"
 
+// Moves the vectors in nested to spare, so that their capacity is reused in AppendKeepingCapacity
+template <typename T>
+static void ClearKeepingCapacity(std::vector<std::vector<T>>& nested, std::vector<std::vector<T>>& spare)
+{
+    for (auto& vec: nested) {
+        vec.clear();
+        spare.push_back(std::move(vec));
+    }
+    nested.clear();
+}
+
+// Appends an empty vector to nested, taken from spare if there is any
+template <typename T>
+static std::vector<T>& AppendKeepingCapacity(std::vector<std::vector<T>>& nested, std::vector<std::vector<T>>& spare)
+{
+    if (spare.empty())
+        nested.emplace_back();
+    else {
+        nested.push_back(std::move(spare.back()));
+        spare.pop_back();
+    }
+    return nested.back();
+}
+
 NTagEventInfo::NTagEventInfo(Verbosity verbose):
 TWIDTH(NTagDefault::TWIDTH),
 NHITSTH(NTagDefault::NHITSTH), NHITSMX(NTagDefault::NHITSMX),
@@ -39,14 +67,36 @@ TMINPEAKSEP(NTagDefault::TMINPEAKSEP),
 ODHITMX(NTagDefault::ODHITMX),
 VTXSRCRANGE(NTagDefault::VTXSRCRANGE),
 MINGRIDWIDTH(NTagDefault::MINGRIDWIDTH),
+GRIDTABLELEVELS(NTagDefault::GRIDTABLELEVELS),
+GRIDTABLEMEM(NTagDefault::GRIDTABLEMEM),
+LMSEEDLEVELS(NTagDefault::LMSEEDLEVELS),
+ANGLESAMPLE(NTagDefault::ANGLESAMPLE),
+NTHREADS(NTagDefault::NTHREADS),
+NWORKERS(NTagDefault::NWORKERS),
+NBONSAIPROCS(NTagDefault::NBONSAIPROCS),
 PVXRES(NTagDefault::PVXRES),
 customvx(0.), customvy(0.), customvz(0.),
+fNeutFitMode(mGRID),
 fVerbosity(verbose),
-bData(false), bUseTMVA(true), bSaveTQ(false), bForceMC(false), bUseResidual(true), bUseNeutFit(true)
+bData(false), bUseTMVA(true), bSaveTQ(false), bForceMC(false), bUseResidual(true), bUseNeutFit(true), bUseCascade(false)
 {
     nProcessedEvents = 0;
     preRawTrigTime[0] = -1;
     candidateVariablesInitialized = false;
+    tmvaVariablesBound = false;
+    nHeapAllocationsAtClear = nHeapAllocationsAtSearch = 0;
+    fThreadPool = nullptr;
+    fBonsaiPool = nullptr;
+    bHasRunState = false;
+    fGridToFTableInUse = &fGridToFTable;
+    fSigTQFile = NULL; fSigTQTree = NULL; fSigTQEntry = -1;
+    vSIGT = NULL; vSIGI = NULL;
+    vHitRawTimes = new std::vector<std::vector<float>>();
+    vHitResTimes = new std::vector<std::vector<float>>();
+    vHitCableIDs = new std::vector<std::vector<int>>();
+    vHitSigFlags = new std::vector<std::vector<int>>();
+    iCandidateVectors.fill(nullptr); fCandidateVectors.fill(nullptr);
+    iTMVAVectors.fill(nullptr);      fTMVAVectors.fill(nullptr);
 
     msg = NTagMessage("", fVerbosity);
 
@@ -57,6 +107,34 @@ bData(false), bUseTMVA(true), bSaveTQ(false), bForceMC(false), bUseResidual(true
 NTagEventInfo::~NTagEventInfo()
 {
     if (fSigTQFile) fSigTQFile->Close();
+    delete fThreadPool;
+    delete fBonsaiPool;
+    delete vHitRawTimes; delete vHitResTimes;
+    delete vHitCableIDs; delete vHitSigFlags;
+}
+
+std::mutex NTagEventInfo::fFortranMutex;
+std::atomic<int> NTagEventInfo::fNFortranWaiters(0);
+
+void NTagEventInfo::SaveRunState()
+{
+    fRunHeader = skhead_;
+    fRunBadChannels = skbadc_;
+    bHasRunState = true;
+}
+
+std::unique_lock<std::mutex> NTagEventInfo::LockFortran()
+{
+    fNFortranWaiters++;
+    std::unique_lock<std::mutex> lock(fFortranMutex);
+    fNFortranWaiters--;
+
+    // The thread reading events may have read the next events
+    if (bHasRunState) {
+        skhead_ = fRunHeader;
+        skbadc_ = fRunBadChannels;
+    }
+    return lock;
 }
 
 void NTagEventInfo::SetEventHeader()
@@ -65,15 +143,6 @@ void NTagEventInfo::SetEventHeader()
     subrunNo = skhead_.nsubsk;
     eventNo  = skhead_.nevsk;
 
-    // Mimic QISMSK: sum all Q of ID hits within 1.3 usec gate
-    qismsk = 0.;
-    for (int iHit = 0; iHit < sktqz_.nqiskz; iHit++) {
-        float hitTime = sktqz_.tiskz[iHit];
-        if (479.2 < hitTime && hitTime < 1779.2) {
-            qismsk += sktqz_.qiskz[iHit];
-        }
-    }
-
     // Number of OD hits
     odpc_2nd_s_(&nhitac);
 
@@ -238,8 +307,11 @@ void NTagEventInfo::SetTDiff()
 
 void NTagEventInfo::AppendRawHitInfo()
 {
-    if (fSigTQTree) {
+    // Read and index the signal hits once per event, not again for its AFT
+    if (fSigTQTree && fSigTQEntry != nProcessedEvents) {
         fSigTQTree->GetEntry(nProcessedEvents);
+        fSigTQEntry = nProcessedEvents;
+        IndexSignalHits();
     }
 
     float tOffset = 0.;
@@ -248,6 +320,9 @@ void NTagEventInfo::AppendRawHitInfo()
     int   pmtLast = 0.;
 
     bool  coincidenceFound = true;
+    bool  isFirstTrigger   = vTriggerBlockStart.empty();
+
+    vTriggerBlockStart.push_back(vTISKZ.size());
 
     if (!vTISKZ.empty()) {
         coincidenceFound = false;
@@ -256,16 +331,35 @@ void NTagEventInfo::AppendRawHitInfo()
         pmtLast = vCABIZ.back();
     }
 
-    for (int iHit = 0; iHit < sktqz_.nqiskz; iHit++) {
+    int nInputHits = sktqz_.nqiskz;
+    vTISKZ.reserve(vTISKZ.size() + nInputHits);
+    vQISKZ.reserve(vQISKZ.size() + nInputHits);
+    vCABIZ.reserve(vCABIZ.size() + nInputHits);
+    if (vSIGT) {
+        vISIGZ.reserve(vISIGZ.size() + nInputHits);
+        nTotalSigHits = vSIGT->size();
+    }
+
+    std::clock_t matchStartTime = std::clock();
+
+    for (int iHit = 0; iHit < nInputHits; iHit++) {
+
+        float rawHitTime = sktqz_.tiskz[iHit];
+        float hitQ       = sktqz_.qiskz[iHit];
+        int   hitPMTID   = sktqz_.icabiz[iHit];
 
-        if (!coincidenceFound && sktqz_.qiskz[iHit] == qLast && sktqz_.icabiz[iHit] == pmtLast) {
-            tOffset = tLast - sktqz_.tiskz[iHit];
+        // Mimic QISMSK: sum all Q of ID hits within 1.3 usec gate of the primary trigger
+        if (isFirstTrigger && 479.2 < rawHitTime && rawHitTime < 1779.2) {
+            qismsk += hitQ;
+        }
+
+        if (!coincidenceFound && hitQ == qLast && hitPMTID == pmtLast) {
+            tOffset = tLast - rawHitTime;
             coincidenceFound = true;
             msg.Print(Form("Coincidence found: t = %f ns, (offset: %f ns)", tLast, tOffset), pDEBUG);
         }
 
-        int hitPMTID = sktqz_.icabiz[iHit];
-        float hitTime = sktqz_.tiskz[iHit] + tOffset;
+        float hitTime = rawHitTime + tOffset;
 
         // Use hits that are in-gate and within MAXPM only
         if (sktqz_.ihtiflz[iHit] & (1<<1) && hitPMTID <= MAXPM) {
@@ -277,29 +371,45 @@ void NTagEventInfo::AppendRawHitInfo()
                 continue;
             }
 
-            vTISKZ.push_back( hitTime );
-            vQISKZ.push_back( sktqz_.qiskz[iHit] );
-            vCABIZ.push_back( hitPMTID           );
+            vTISKZ.push_back( hitTime  );
+            vQISKZ.push_back( hitQ     );
+            vCABIZ.push_back( hitPMTID );
             vPMTHitTime[hitPMTID] = hitTime;
 
+            // If both hit time and PMT ID match a hit in sig TQ, then the current hit iHit is from signal
             if (vSIGT) {
-                bool isSignal = false;
-                nTotalSigHits = vSIGT->size();
-                // Look for matching hits between sig+bkg TQ and sig TQ
-                for (int iSigHit = 0; iSigHit < nTotalSigHits; iSigHit++) {
-                    // If both hit time and PMT ID match, then the current hit iHit is from signal
-                    if (fabs(hitTime - vSIGT->at(iSigHit)) < 1e-3
-                        && sktqz_.icabiz[iHit] == vSIGI->at(iSigHit)) {
-                        isSignal = true;
-                    }
-                }
-                if (isSignal) { vISIGZ.push_back(1); nFoundSigHits++; }
-                else            vISIGZ.push_back(0);
+                if (IsSignalHit(hitTime, hitPMTID)) { vISIGZ.push_back(1); nFoundSigHits++; }
+                else                                  vISIGZ.push_back(0);
             }
         }
     }
 
     nqiskz = static_cast<int>(vTISKZ.size());
+
+    if (vSIGT) sigMatchTime += (std::clock() - matchStartTime) / (float) CLOCKS_PER_SEC * 1.e3;
+}
+
+void NTagEventInfo::IndexSignalHits()
+{
+    int nSigHits = vSIGT->size();
+
+    // Count signal hits per PMT, then place them by prefix sum
+    vSigHitStart.assign(MAXPM+2, 0);
+    for (int iSigHit = 0; iSigHit < nSigHits; iSigHit++) {
+        int sigPMTID = vSIGI->at(iSigHit);
+        // Hits outside MAXPM are never matched
+        if (0 <= sigPMTID && sigPMTID <= MAXPM) vSigHitStart[sigPMTID+1]++;
+    }
+    for (int iPMT = 0; iPMT <= MAXPM; iPMT++)
+        vSigHitStart[iPMT+1] += vSigHitStart[iPMT];
+
+    vSigHitTime.resize(vSigHitStart[MAXPM+1]);
+    static thread_local std::vector<int> nFilled;
+    nFilled.assign(vSigHitStart.begin(), vSigHitStart.end() - 1);
+    for (int iSigHit = 0; iSigHit < nSigHits; iSigHit++) {
+        int sigPMTID = vSIGI->at(iSigHit);
+        if (0 <= sigPMTID && sigPMTID <= MAXPM) vSigHitTime[nFilled[sigPMTID]++] = vSIGT->at(iSigHit);
+    }
 }
 
 void NTagEventInfo::SetToFSubtractedTQ()
@@ -307,7 +417,11 @@ void NTagEventInfo::SetToFSubtractedTQ()
     // Subtract ToF from raw PMT hit time
     if (bUseResidual) {
         float fitVertex[3] = {pvx, pvy, pvz};
-        vUnsortedT_ToF = GetToFSubtracted(vTISKZ, vCABIZ, fitVertex, false);
+
+        // Per-event ToF table from the prompt vertex to all PMTs
+        fPromptToFTable.SetVertex(fitVertex);
+        vUnsortedT_ToF.resize(nqiskz);
+        fPromptToFTable.SubtractToF(vTISKZ.data(), vCABIZ.data(), nqiskz, vUnsortedT_ToF.data());
     }
     else
         vUnsortedT_ToF = vTISKZ;
@@ -352,17 +466,20 @@ void NTagEventInfo::DumpEventVariables()
 
     // Hit information
     msg.Print("\033[1;36m* Hits\033[m");
-    msg.Print("\033[4mTotal hits          Signal hits         \033[0m");
+    msg.Print("\033[4mTotal hits          Signal hits         Read+match (ms)     \033[0m");
     msg.Print("", pDEFAULT, false);
     std::cout << std::left << std::setw(20) << nTotalHits;
     std::cout << std::left << std::setw(20);
-    if (vSIGT) std::cout << vSIGT->size();
+    if (vSIGT) std::cout << nTotalSigHits;
+    else       std::cout << "-";
+    std::cout << std::left << std::setw(20);
+    if (vSIGT) std::cout << sigMatchTime;
     else       std::cout << "-";
     std::cout << std::endl;
     msg.Print("");
 
     // RBN reduction information
-    int nFoundHits = nTotalHits - nRemovedHits;
+    int nFoundHits = nqiskz;
     msg.Print(Form("\033[1;36m* RBN reduction (Deadtime: %d us)\033[m", (int)TRBNWIDTH));
     msg.Print("\033[4mSurvived hits       Survived signal     \033[0m");
     msg.Print("", pDEFAULT, false);
@@ -370,7 +487,7 @@ void NTagEventInfo::DumpEventVariables()
               << Form("%d (%d%%)", nFoundHits, (int)(100*nFoundHits/(nTotalHits+1.e-3)));
     std::cout << std::left << std::setw(20);
     if (vSIGT) {
-        std::cout << Form("%d (%d%%)", nFoundSigHits, (int)(100*nFoundSigHits/(vSIGT->size()+1.e-3)));
+        std::cout << Form("%d (%d%%)", nFoundSigHits, (int)(100*nFoundSigHits/(nTotalSigHits+1.e-3)));
     }
     else std::cout << "-";
     std::cout << std::endl;
@@ -447,16 +564,16 @@ void NTagEventInfo::DumpEventVariables()
     for (auto& candidate: vCandidates) {
         msg.Print("", pDEFAULT, false);
         std::cout << std::left << std::setw(4) << candidate.candidateID;
-        std::cout << std::left << std::setw(8) << (int)(candidate.fVarMap["ReconCT"]*1.e-3);
-        std::cout << std::left << std::setw(5) << candidate.iVarMap["NHits"];
-        std::cout << std::left << std::setw(6) << candidate.iVarMap["NHits_n"];
+        std::cout << std::left << std::setw(8) << (int)(candidate.Get(fReconCT)*1.e-3);
+        std::cout << std::left << std::setw(5) << candidate.Get(iNHits);
+        std::cout << std::left << std::setw(6) << candidate.Get(iNHits_n);
         std::cout << std::left << std::setw(6);
         if (bData) std::cout << "-";
-        else if (candidate.iVarMap["CaptureType"] == 0) std::cout << "Bkg";
-        else if (candidate.iVarMap["CaptureType"] == 1) std::cout << "H";
-        else if (candidate.iVarMap["CaptureType"] == 2) std::cout << "Gd";
+        else if (candidate.Get(iCaptureType) == 0) std::cout << "Bkg";
+        else if (candidate.Get(iCaptureType) == 1) std::cout << "H";
+        else if (candidate.Get(iCaptureType) == 2) std::cout << "Gd";
         std::cout << std::left << std::setw(11);
-        if (bUseTMVA) std::cout << std::setprecision(3) << candidate.fVarMap["TMVAOutput"];
+        if (bUseTMVA) std::cout << std::setprecision(3) << candidate.Get(fTMVAOutput);
         else          std::cout << "-";
         std::cout << std::endl;
     }
@@ -592,6 +709,13 @@ void NTagEventInfo::SearchCaptureCandidates()
     int   N200Previous    = 0;
     float t0Previous      = -1e6;
 
+    // Window of TWIDTH sliding over the sorted hits
+    HitWindow window;
+
+    if (bUseTMVA && !tmvaVariablesBound) BindTMVAVariables();
+
+    nHeapAllocationsAtSearch = GetNHeapAllocations();
+
     // Loop over the saved TQ hit array from current event
     for (int iHit = 0; iHit < nqiskz; iHit++) {
 
@@ -603,7 +727,8 @@ void NTagEventInfo::SearchCaptureCandidates()
 
         // Calculate NHitsNew:
         // number of hits in 10(or so) ns window from the i-th hit
-        int NHits_iHit = GetNhitsFromStartIndex(vSortedT_ToF, iHit, TWIDTH);
+        SlideHitWindow(window, vSortedT_ToF, vSortedQ, iHit, TWIDTH);
+        int NHits_iHit = window.nHits;
 
         // Pass only if NHITSTH <= NHits_iHit <= NHITSMX:
         if ((NHits_iHit < NHITSTH) || (NHits_iHit > NHITSMX)) continue;
@@ -641,37 +766,240 @@ void NTagEventInfo::SearchCaptureCandidates()
     // Save the last peak
     if (NHitsPrevious >= NHITSTH)
         SavePeakFromHit(iHitPrevious);
+
+    SetCandidateFeatures();
 }
 
 void NTagEventInfo::SavePeakFromHit(int hitID)
 {
-    // Initialize candidate
-    vCandidates.push_back(NTagCandidate(vCandidates.size(), this));
+    // Initialize candidate with the hits within TWIDTH from hitID
+    vCandidates.emplace_back(vCandidates.size(), this);
+    vCandidates.back().SetHitInfo(hitID, GetNhitsFromStartIndex(vSortedT_ToF, hitID, TWIDTH));
+    //vCandidates.back().DumpHitInfo();
 
-    // Containers for hit info
-    float tWidth = TWIDTH;
-    std::vector<float> resTVec = GetVectorFromStartIndex(vSortedT_ToF, hitID, tWidth);
-    int nHits = resTVec.size();
+    // Increment number of neutron candidates
+    nCandidates++;
+}
 
-    std::vector<float> rawTVec = SliceVector(vTISKZ, hitID, nHits, reverseIndex.data());
-    std::vector<float> pmtQVec = SliceVector(vSortedQ, hitID, nHits);
-    std::vector<int>   cabIVec = SliceVector(vSortedPMTID, hitID, nHits);
-    std::vector<int>   sigFVec;
+// CPU time used by the calling thread, unlike std::clock, which counts all threads of the process [s]
+static double GetThreadCPUTime()
+{
+    timespec threadTime;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &threadTime);
+    return threadTime.tv_sec + threadTime.tv_nsec * 1.e-9;
+}
 
-    if (!vSortedSigFlag.empty()) sigFVec = SliceVector(vSortedSigFlag, hitID, nHits);
+void NTagEventInfo::SetCandidateFeatures()
+{
+    if (bUseCascade) ApplyCascade();
+
+    // CPU time of this thread and the threads of this instance only, as other workers share the process
+    double startCPUTime = 0;
+    if (bUseCascade) startCPUTime = GetThreadCPUTime() + (fThreadPool ? fThreadPool->GetCPUTime() : 0);
+
+    double poolCPUTime = 0;
+    if (fBonsaiPool) poolCPUTime = SetCandidateFeaturesWithBonsaiPool();
+    else             SetCandidateFeaturesWithThreads();
+
+    if (bUseCascade) {
+        fCascadeStats.fullCPUTime += GetThreadCPUTime() + (fThreadPool ? fThreadPool->GetCPUTime() : 0)
+                                     - startCPUTime + poolCPUTime;
+        if (!bData) fCascadeStats.isMC = true;
+
+        for (const auto& candidate: vCandidates) {
+            fCascadeStats.nCandidates++;
+            if (candidate.IsCascadeRejected()) fCascadeStats.nRejected++;
+            if (!bData && candidate.Get(iCaptureType) > 0) {
+                fCascadeStats.nCaptures++;
+                if (candidate.IsCascadeRejected()) fCascadeStats.nCapturesRejected++;
+            }
+        }
+    }
+}
 
-    // Save hit info to candidate
-    vCandidates.back().SetHitInfo(rawTVec, resTVec, pmtQVec, cabIVec, sigFVec);
-    //vCandidates.back().DumpHitInfo();
-    vCandidates.back().SetVariables();
+void NTagEventInfo::SetCandidateFeaturesWithThreads()
+{
+    if (NTHREADS <= 1 || vCandidates.size() < 2) {
+        for (auto& candidate: vCandidates) {
+            if (!candidate.IsCascadeRejected()) {
+                candidate.SetFeatureVariables();
+                auto lock = LockFortran();
+                candidate.SetFortranVariables();
+            }
+            if (bUseTMVA) {
+                candidate.SetNNVariables();
+                if (!candidate.IsCascadeRejected()) candidate.SetTMVAOutput();
+            }
+        }
+        return;
+    }
 
-    vHitRawTimes->push_back(rawTVec);
-    vHitResTimes->push_back(resTVec);
-    vHitCableIDs->push_back(cabIVec);
-    vHitSigFlags->push_back(sigFVec);
+    if (!fThreadPool) {
+        msg.Print(Form("Setting candidate features with %d threads...", NTHREADS), pDEBUG);
+        fThreadPool = new NTagThreadPool(NTHREADS);
+    }
 
-    // Increment number of neutron candidates
-    nCandidates++;
+    // C++ features in the pool threads
+    fThreadPool->Start(vCandidates.size(), [this](int iCandidate) {
+        if (!vCandidates[iCandidate].IsCascadeRejected())
+            vCandidates[iCandidate].SetFeatureVariables();
+    });
+
+    // BONSAI in this thread, in the same order as with one thread
+    for (unsigned int iCandidate = 0; iCandidate < vCandidates.size(); iCandidate++) {
+        fThreadPool->WaitForTask(iCandidate);
+        if (vCandidates[iCandidate].IsCascadeRejected()) continue;
+        auto lock = LockFortran();
+        vCandidates[iCandidate].SetFortranVariables();
+    }
+    fThreadPool->Wait();
+
+    if (bUseTMVA) {
+        for (auto& candidate: vCandidates) {
+            candidate.SetNNVariables();
+            if (!candidate.IsCascadeRejected()) candidate.SetTMVAOutput();
+        }
+    }
+}
+
+double NTagEventInfo::SetCandidateFeaturesWithBonsaiPool()
+{
+    double poolCPUTime = 0;
+
+    // BONSAI fits run in the pool processes while the C++ features are set,
+    // submitted with the run state of this event
+    static thread_local std::vector<int> jobIDs;
+    jobIDs.assign(vCandidates.size(), -1);
+    {
+        auto lock = LockFortran();
+        for (unsigned int iCandidate = 0; iCandidate < vCandidates.size(); iCandidate++) {
+            if (!vCandidates[iCandidate].IsCascadeRejected())
+                jobIDs[iCandidate] = vCandidates[iCandidate].SubmitBonsaiFit(*fBonsaiPool);
+        }
+    }
+
+    if (NTHREADS > 1 && vCandidates.size() > 1) {
+        if (!fThreadPool) {
+            msg.Print(Form("Setting candidate features with %d threads...", NTHREADS), pDEBUG);
+            fThreadPool = new NTagThreadPool(NTHREADS);
+        }
+        fThreadPool->Start(vCandidates.size(), [this](int iCandidate) {
+            if (!vCandidates[iCandidate].IsCascadeRejected())
+                vCandidates[iCandidate].SetFeatureVariables();
+        });
+        fThreadPool->Wait();
+    }
+    else {
+        for (auto& candidate: vCandidates) {
+            if (!candidate.IsCascadeRejected())
+                candidate.SetFeatureVariables();
+        }
+    }
+
+    for (unsigned int iCandidate = 0; iCandidate < vCandidates.size(); iCandidate++) {
+        NTagCandidate& candidate = vCandidates[iCandidate];
+
+        // Candidates with too many hits for the pool are fitted in this process
+        if (jobIDs[iCandidate] >= 0) {
+            float fitCPUTime;
+            NTagBonsaiFit fit = fBonsaiPool->GetFit(jobIDs[iCandidate], &fitCPUTime);
+            poolCPUTime += fitCPUTime;
+            auto lock = LockFortran();
+            candidate.SetFortranVariables(&fit);
+        }
+        else if (!candidate.IsCascadeRejected()) {
+            auto lock = LockFortran();
+            candidate.SetFortranVariables();
+        }
+
+        if (bUseTMVA) {
+            candidate.SetNNVariables();
+            if (!candidate.IsCascadeRejected()) candidate.SetTMVAOutput();
+        }
+    }
+
+    return poolCPUTime;
+}
+
+void NTagEventInfo::ApplyCascade()
+{
+    // Rejected candidates get the variables that the others set, from the settings of this event
+    NTagCandidate::GetFeatureVariableMask(*this, fCascadeIMask, fCascadeFMask);
+
+    for (auto& candidate: vCandidates) {
+        candidate.SetCascadeVariables();
+
+        bool isPassed = PassesCascade(candidate);
+        candidate.Set(iCascadePass, isPassed);
+
+        if (!isPassed)
+            candidate.SetCascadeRejectedVariables(fCascadeIMask, fCascadeFMask);
+    }
+}
+
+bool NTagEventInfo::PassesCascade(const NTagCandidate& candidate) const
+{
+    for (const auto& cut: fCascadeICuts) {
+        int value = candidate.Get(cut.first);
+        if (!(cut.second.first < value && value < cut.second.second)) return false;
+    }
+    for (const auto& cut: fCascadeFCuts) {
+        float value = candidate.Get(cut.first);
+        if (!(cut.second.first < value && value < cut.second.second)) return false;
+    }
+    return true;
+}
+
+void NTagEventInfo::SetCascadeCutRange(const char* key, float low, float up)
+{
+    // Variables set by NTagCandidate::SetCascadeVariables
+    static const IVariable iKeys[] = {iNHits, iN200};
+    static const FVariable fKeys[] = {fTRMS, fQSum, fReconCT, fTSpread, fBeta1, fBeta2, fBeta3, fBeta4, fBeta5};
+
+    for (auto iKey: iKeys) {
+        if (!strcmp(key, NTagCandidate::GetName(iKey))) {
+            fCascadeICuts.emplace_back(iKey, Range(low, up));
+            bUseCascade = true;
+            return;
+        }
+    }
+    for (auto fKey: fKeys) {
+        if (!strcmp(key, NTagCandidate::GetName(fKey))) {
+            fCascadeFCuts.emplace_back(fKey, Range(low, up));
+            bUseCascade = true;
+            return;
+        }
+    }
+    msg.Print(Form("%s is not a cascade variable: use NHits, N200, TRMS, QSum, ReconCT, TSpread, or Beta1-5.", key),
+              pERROR);
+}
+
+void NTagEventInfo::PrintCascadeSummary()
+{
+    for (const auto& cut: fCascadeICuts)
+        msg.Print(Form("Cascade cut: %f < %s < %f", cut.second.first, NTagCandidate::GetName(cut.first), cut.second.second));
+    for (const auto& cut: fCascadeFCuts)
+        msg.Print(Form("Cascade cut: %f < %s < %f", cut.second.first, NTagCandidate::GetName(cut.first), cut.second.second));
+
+    PrintCascadeStats(fCascadeStats, msg);
+}
+
+void NTagEventInfo::PrintCascadeStats(const CascadeStats& stats, NTagMessage& msg)
+{
+    long nFull = stats.nCandidates - stats.nRejected;
+    msg.Print(Form("Candidates rejected by the cascade: %ld / %ld (%.1f%%)", stats.nRejected, stats.nCandidates,
+                   stats.nCandidates ? 100. * stats.nRejected / stats.nCandidates : 0.));
+
+    if (nFull > 0) {
+        double savedTime = stats.fullCPUTime / nFull * stats.nRejected;
+        msg.Print(Form("CPU time after the cascade: %.2f s, estimated saving: %.2f s (%.1f%%)",
+                       stats.fullCPUTime, savedTime, 100. * savedTime / (stats.fullCPUTime + savedTime)));
+    }
+
+    if (stats.isMC)
+        msg.Print(Form("True capture candidates rejected (signal efficiency loss): %ld / %ld (%.2f%%)",
+                       stats.nCapturesRejected, stats.nCaptures,
+                       stats.nCaptures ? 100. * stats.nCapturesRejected / stats.nCaptures : 0.));
 }
 
 void NTagEventInfo::SetCandidateVariables()
@@ -687,32 +1015,68 @@ void NTagEventInfo::SetCandidateVariables()
 void NTagEventInfo::InitializeCandidateVariableVectors()
 {
     msg.PrintBlock("Initializing feature variables...", pSUBEVENT, pDEBUG, false);
-    for (auto const& pair: vCandidates[0].iVarMap) {
-        msg.Print(Form("Initializing variable %s...", pair.first.c_str()), pDEBUG);
-        iCandidateVarMap[pair.first] = new std::vector<int>();
+    const NTagCandidate& firstCandidate = vCandidates[0];
+    for (int key = 0; key < nIVariables; key++) {
+        if (!firstCandidate.IsSet((IVariable)key)) continue;
+        std::string name = NTagCandidate::GetName((IVariable)key);
+        msg.Print(Form("Initializing variable %s...", name.c_str()), pDEBUG);
+        iCandidateVectors[key] = iCandidateVarMap[name] = new std::vector<int>();
     }
-    for (auto const& pair: vCandidates[0].fVarMap) {
-        msg.Print(Form("Initializing variable %s...", pair.first.c_str()), pDEBUG);
-        fCandidateVarMap[pair.first] = new std::vector<float>();
+    for (int key = 0; key < nFVariables; key++) {
+        if (!firstCandidate.IsSet((FVariable)key)) continue;
+        std::string name = NTagCandidate::GetName((FVariable)key);
+        msg.Print(Form("Initializing variable %s...", name.c_str()), pDEBUG);
+        fCandidateVectors[key] = fCandidateVarMap[name] = new std::vector<float>();
     }
     candidateVariablesInitialized = true;
 }
 
 void NTagEventInfo::ExtractCandidateVariables()
 {
-    for (auto candidate: vCandidates) {
-        for (auto const& pair: candidate.iVarMap) {
-            iCandidateVarMap[pair.first]->push_back(pair.second);
+    for (auto const& candidate: vCandidates) {
+        int first = candidate.firstHitID;
+        int last  = first + candidate.nHits;
+
+        AppendKeepingCapacity(*vHitResTimes, fSpareFloatVectors).assign(vSortedT_ToF.begin() + first,
+                                                                         vSortedT_ToF.begin() + last);
+        AppendKeepingCapacity(*vHitCableIDs, fSpareIntVectors).assign(vSortedPMTID.begin() + first,
+                                                                       vSortedPMTID.begin() + last);
+        std::vector<float>& rawT = AppendKeepingCapacity(*vHitRawTimes, fSpareFloatVectors);
+        for (int iHit = 0; iHit < candidate.nHits; iHit++)
+            rawT.push_back(candidate.GetHitRawTime(iHit));
+        std::vector<int>& sigF = AppendKeepingCapacity(*vHitSigFlags, fSpareIntVectors);
+        if (!vSortedSigFlag.empty())
+            sigF.assign(vSortedSigFlag.begin() + first, vSortedSigFlag.begin() + last);
+
+        for (int key = 0; key < nIVariables; key++) {
+            if (iCandidateVectors[key]) iCandidateVectors[key]->push_back(candidate.iVars[key]);
         }
-        for (auto const& pair: candidate.fVarMap) {
-            fCandidateVarMap[pair.first]->push_back(pair.second);
+        for (int key = 0; key < nFVariables; key++) {
+            if (fCandidateVectors[key]) fCandidateVectors[key]->push_back(candidate.fVars[key]);
         }
     }
 }
 
+void NTagEventInfo::BindTMVAVariables()
+{
+    auto& iEventVectorMap = TMVATools.fVariables.iEventVectorMap;
+    auto& fEventVectorMap = TMVATools.fVariables.fEventVectorMap;
+
+    for (int key = 0; key < nIVariables; key++) {
+        auto it = iEventVectorMap.find(NTagCandidate::GetName((IVariable)key));
+        iTMVAVectors[key] = (it == iEventVectorMap.end()) ? nullptr : it->second;
+    }
+    for (int key = 0; key < nFVariables; key++) {
+        auto it = fEventVectorMap.find(NTagCandidate::GetName((FVariable)key));
+        fTMVAVectors[key] = (it == fEventVectorMap.end()) ? nullptr : it->second;
+    }
+
+    tmvaVariablesBound = true;
+}
+
 void NTagEventInfo::DumpCandidateVariables()
 {
-    for (auto candidate: vCandidates) {
+    for (auto& candidate: vCandidates) {
         candidate.DumpVariables();
     }
 
@@ -721,59 +1085,84 @@ void NTagEventInfo::DumpCandidateVariables()
 
 float NTagEventInfo::GetToF(float vertex[3], int pmtID)
 {
-    float vecFromVertexToPMT[3];
-
-    for (int i = 0; i < 3; i++)
-        vecFromVertexToPMT[i] = vertex[i] - NTagConstant::PMTXYZ[pmtID][i];
-
     return GetDistance(NTagConstant::PMTXYZ[pmtID], vertex) / NTagConstant::C_WATER;
 }
 
-std::vector<float> NTagEventInfo::GetToFSubtracted(const std::vector<float>& T, const std::vector<int>& PMTID, float vertex[3], bool doSort)
+void NTagEventInfo::GetToFSubtracted(const std::vector<float>& T, const std::vector<int>& PMTID, float vertex[3],
+                                     std::vector<float>& t_ToF, bool doSort)
 {
-    std::vector<float> t_ToF;
-    std::vector<float> doSortT_ToF;
-
     int nHits = static_cast<int>(T.size());
     assert(nHits == static_cast<int>(PMTID.size()));
 
     // Subtract TOF from PMT hit time
-    for (int iHit = 0; iHit < nHits; iHit++) {
-        int pmtID = PMTID[iHit] - 1;
-        t_ToF.push_back( T[iHit] - GetToF(vertex, pmtID) );
-    }
+    t_ToF.resize(nHits);
+    NTagToFTable::SubtractToF(T.data(), PMTID.data(), nHits, vertex, t_ToF.data());
 
-    if (doSort) {
-        int sortedIndex[nHits];
-        TMath::Sort(nHits, t_ToF.data(), sortedIndex, false);
-        for (int iHit = 0; iHit < nHits; iHit++)
-           doSortT_ToF.push_back( t_ToF[ sortedIndex[iHit] ] );
-        return doSortT_ToF;
-    }
-    else return t_ToF;
+    // Only the sorted times are returned, so sort them in place
+    if (doSort) std::sort(t_ToF.begin(), t_ToF.end());
 }
 
 void NTagEventInfo::SortToFSubtractedTQ()
 {
-    int sortedIndex[nqiskz], pmtID;
-    reverseIndex.clear(); reverseIndex.resize(nqiskz);
-
     // Sort: early hit first
-    TMath::Sort(nqiskz, vUnsortedT_ToF.data(), sortedIndex, false);
+    // Hits within each trigger block are nearly in time order, so sort the blocks and merge
+    int nInsertionSorted = GetSortedIndexOfBlocks(vUnsortedT_ToF.data(), nqiskz, vTriggerBlockStart, sortedIndex);
+    msg.Print(Form("%d of %d trigger blocks sorted by insertion", nInsertionSorted,
+                   std::max(1, (int)vTriggerBlockStart.size())), pDEBUG);
 
     // Save hit info, sorted in (T - ToF)
+    bool hasSigFlags = !vISIGZ.empty();
+    vSortedPMTID.resize(nqiskz);
+    vSortedT_ToF.resize(nqiskz);
+    vSortedQ.resize(nqiskz);
+    if (hasSigFlags) vSortedSigFlag.resize(nqiskz);
+
     for (int iHit = 0; iHit < nqiskz; iHit++) {
-        vSortedPMTID.push_back  ( vCABIZ[ sortedIndex[iHit] ]         );
-        vSortedT_ToF.push_back  ( vUnsortedT_ToF[ sortedIndex[iHit] ] );
-        vSortedQ.push_back      ( vQISKZ[ sortedIndex[iHit] ]         );
-        reverseIndex[sortedIndex[iHit]] = iHit;
+        int index = sortedIndex[iHit];
+        vSortedPMTID[iHit] = vCABIZ[index];
+        vSortedT_ToF[iHit] = vUnsortedT_ToF[index];
+        vSortedQ[iHit]     = vQISKZ[index];
+        if (hasSigFlags) vSortedSigFlag[iHit] = vISIGZ[index];
     }
+}
 
-    if (!vISIGZ.empty()) {
-        for (int iHit = 0; iHit < nqiskz; iHit++) {
-            vSortedSigFlag.push_back( vISIGZ[ sortedIndex[iHit] ]         );
-        }
-    }
+void NTagEventInfo::BuildGridToFTable()
+{
+    if (GRIDTABLELEVELS <= 0) return;
+
+    int nLevels = fGridToFTable.Build(VTXSRCRANGE, MINGRIDWIDTH, GRIDTABLELEVELS, GRIDTABLEMEM);
+
+    msg.Print(Form("Neut-fit grid ToF table: %d level(s), %d grid points, %.1f MB",
+                   nLevels, fGridToFTable.GetNRows(),
+                   fGridToFTable.GetNRows() * NTagToFTable::GetTableSizeInMB()));
+
+    if (nLevels < GRIDTABLELEVELS)
+        msg.Print(Form("Only %d of %d grid levels tabulated within the memory limit (%.0f MB) "
+                       "or the minimum grid width. ToF is computed directly for the rest.",
+                       nLevels, GRIDTABLELEVELS, GRIDTABLEMEM), pWARNING);
+}
+
+void NTagEventInfo::ProcessHits()
+{
+    SetToFSubtractedTQ();
+
+    // Tagging starts here!
+    SearchCaptureCandidates();
+    SetCandidateVariables();
+}
+
+void NTagEventInfo::GetRawHitIndicesInWindow(float tStart, float tEnd, std::vector<int>& index)
+{
+    // First hit with t > tStart, and first hit with t >= tEnd
+    auto first = std::upper_bound(vSortedT_ToF.begin(), vSortedT_ToF.end(), tStart);
+    auto last  = std::lower_bound(first, vSortedT_ToF.end(), tEnd);
+
+    index.clear();
+    for (auto it = first; it < last; ++it)
+        index.push_back(sortedIndex[it - vSortedT_ToF.begin()]);
+
+    // Keep the order of raw hits
+    std::sort(index.begin(), index.end());
 }
 
 void NTagEventInfo::Clear()
@@ -793,20 +1182,23 @@ void NTagEventInfo::Clear()
     vecx = 0; vecy = 0; vecz = 0;
 
     vTISKZ.clear(); vQISKZ.clear(); vCABIZ.clear(); vISIGZ.clear(); vPMTHitTime.fill(0);
+    vTriggerBlockStart.clear();
 
     vSortedPMTID.clear();
     vSortedT_ToF.clear(); vUnsortedT_ToF.clear(); vSortedQ.clear(); vSortedSigFlag.clear();
+    sortedIndex.clear();
 
     vAPRingPID.clear(); vAPMom.clear(); vAPMomE.clear(); vAPMomMu.clear();
     vFirstHitID.clear();
     TMVATools.fVariables.Clear();
 
-    vHitRawTimes->clear();
-    vHitResTimes->clear();
-    vHitCableIDs->clear();
-    vHitSigFlags->clear();
+    // Keep the hit vectors of candidates for reuse in the next event
+    ClearKeepingCapacity(*vHitRawTimes, fSpareFloatVectors);
+    ClearKeepingCapacity(*vHitResTimes, fSpareFloatVectors);
+    ClearKeepingCapacity(*vHitCableIDs, fSpareIntVectors);
+    ClearKeepingCapacity(*vHitSigFlags, fSpareIntVectors);
 
-    nTotalHits = 0; nTotalSigHits = 0; nFoundSigHits = 0; nRemovedHits = 0;
+    nTotalHits = 0; nTotalSigHits = 0; nFoundSigHits = 0; nRemovedHits = 0; sigMatchTime = 0.;
 
     vNGamma.clear(); vCandidateID.clear();
     vTrueCT.clear(); vCapVX.clear(); vCapVY.clear(); vCapVZ.clear(); vTotGammaE.clear();
@@ -821,12 +1213,118 @@ void NTagEventInfo::Clear()
 
     vCandidates.clear();
 
-    for (auto pair: iCandidateVarMap) {
+    for (auto& pair: iCandidateVarMap) {
         pair.second->clear();
     }
-    for (auto pair: fCandidateVarMap) {
+    for (auto& pair: fCandidateVarMap) {
         pair.second->clear();
     }
+
+    nHeapAllocationsAtClear = GetNHeapAllocations();
+}
+
+void NTagEventInfo::CopySettings(const NTagEventInfo& source)
+{
+    TWIDTH = source.TWIDTH;
+    NHITSTH = source.NHITSTH; NHITSMX = source.NHITSMX; N200MX = source.N200MX;
+    T0TH = source.T0TH; T0MX = source.T0MX;
+    TRBNWIDTH = source.TRBNWIDTH; TMATCHWINDOW = source.TMATCHWINDOW; TMINPEAKSEP = source.TMINPEAKSEP;
+    ODHITMX = source.ODHITMX; VTXSRCRANGE = source.VTXSRCRANGE; MINGRIDWIDTH = source.MINGRIDWIDTH;
+    GRIDTABLELEVELS = source.GRIDTABLELEVELS; GRIDTABLEMEM = source.GRIDTABLEMEM; LMSEEDLEVELS = source.LMSEEDLEVELS;
+    ANGLESAMPLE = source.ANGLESAMPLE; NTHREADS = source.NTHREADS; NWORKERS = source.NWORKERS;
+    NBONSAIPROCS = source.NBONSAIPROCS; PVXRES = source.PVXRES;
+
+    customvx = source.customvx; customvy = source.customvy; customvz = source.customvz;
+    fVertexMode = source.fVertexMode; fNeutFitMode = source.fNeutFitMode;
+
+    bData = source.bData; bUseTMVA = source.bUseTMVA; bSaveTQ = source.bSaveTQ; bForceMC = source.bForceMC;
+    bUseResidual = source.bUseResidual; bUseNeutFit = source.bUseNeutFit; bUseCascade = source.bUseCascade;
+    fCascadeICuts = source.fCascadeICuts; fCascadeFCuts = source.fCascadeFCuts;
+
+    TMVATools.SetReader(source.TMVATools.fReaderMethodName, source.TMVATools.fReaderWeightFileName);
+    TMVATools.fRangeMap = source.TMVATools.fRangeMap;
+
+    // The grid table is read-only once built
+    fGridToFTableInUse = source.fGridToFTableInUse;
+}
+
+// Makes the candidate variable vectors of each key exist in both instances, and swaps their contents
+template <typename Key, typename T, std::size_t N>
+static void SwapCandidateVectors(std::map<std::string, std::vector<T>*>& mapA, std::array<std::vector<T>*, N>& vectorsA,
+                                 std::map<std::string, std::vector<T>*>& mapB, std::array<std::vector<T>*, N>& vectorsB)
+{
+    for (std::size_t key = 0; key < N; key++) {
+        if (!vectorsA[key] && !vectorsB[key]) continue;
+        std::string name = NTagCandidate::GetName((Key)key);
+        if (!vectorsA[key]) vectorsA[key] = mapA[name] = new std::vector<T>();
+        if (!vectorsB[key]) vectorsB[key] = mapB[name] = new std::vector<T>();
+        vectorsA[key]->swap(*vectorsB[key]);
+    }
+}
+
+void NTagEventInfo::SwapEventState(NTagEventInfo& other)
+{
+    std::swap(runNo, other.runNo); std::swap(subrunNo, other.subrunNo); std::swap(eventNo, other.eventNo);
+    std::swap(nhitac, other.nhitac); std::swap(nqiskz, other.nqiskz); std::swap(trgType, other.trgType);
+    std::swap(trgOffset, other.trgOffset); std::swap(tDiff, other.tDiff); std::swap(qismsk, other.qismsk);
+    std::swap(pvx, other.pvx); std::swap(pvy, other.pvy); std::swap(pvz, other.pvz);
+    std::swap(dWall, other.dWall); std::swap(evis, other.evis);
+    std::swap(apNRings, other.apNRings); std::swap(apNMuE, other.apNMuE); std::swap(apNDecays, other.apNDecays);
+    std::swap(nCandidates, other.nCandidates); std::swap(maxN200, other.maxN200);
+    std::swap(maxN200Time, other.maxN200Time); std::swap(firstHitTime_ToF, other.firstHitTime_ToF);
+
+    std::swap(nTrueCaptures, other.nTrueCaptures);
+    std::swap(nSavedSec, other.nSavedSec); std::swap(nAllSec, other.nAllSec);
+    std::swap(nNInNeutVec, other.nNInNeutVec); std::swap(neutIntMode, other.neutIntMode);
+    std::swap(nVecInNeut, other.nVecInNeut); std::swap(neutIntMom, other.neutIntMom);
+    std::swap(nVec, other.nVec);
+    std::swap(vecx, other.vecx); std::swap(vecy, other.vecy); std::swap(vecz, other.vecz);
+
+    vTISKZ.swap(other.vTISKZ); vQISKZ.swap(other.vQISKZ); vCABIZ.swap(other.vCABIZ); vISIGZ.swap(other.vISIGZ);
+    vPMTHitTime.swap(other.vPMTHitTime); vTriggerBlockStart.swap(other.vTriggerBlockStart);
+
+    vSortedPMTID.swap(other.vSortedPMTID);
+    vSortedT_ToF.swap(other.vSortedT_ToF); vUnsortedT_ToF.swap(other.vUnsortedT_ToF);
+    vSortedQ.swap(other.vSortedQ); vSortedSigFlag.swap(other.vSortedSigFlag);
+    sortedIndex.swap(other.sortedIndex);
+
+    vAPRingPID.swap(other.vAPRingPID); vAPMom.swap(other.vAPMom);
+    vAPMomE.swap(other.vAPMomE); vAPMomMu.swap(other.vAPMomMu);
+    vFirstHitID.swap(other.vFirstHitID);
+
+    // Swap the contents, as the output branches hold the addresses of the pointers
+    vHitRawTimes->swap(*other.vHitRawTimes); vHitResTimes->swap(*other.vHitResTimes);
+    vHitCableIDs->swap(*other.vHitCableIDs); vHitSigFlags->swap(*other.vHitSigFlags);
+    fSpareFloatVectors.swap(other.fSpareFloatVectors); fSpareIntVectors.swap(other.fSpareIntVectors);
+
+    std::swap(nTotalHits, other.nTotalHits); std::swap(nTotalSigHits, other.nTotalSigHits);
+    std::swap(nFoundSigHits, other.nFoundSigHits); std::swap(nRemovedHits, other.nRemovedHits);
+    std::swap(sigMatchTime, other.sigMatchTime);
+    std::swap(nHeapAllocationsAtClear, other.nHeapAllocationsAtClear);
+    std::swap(nHeapAllocationsAtSearch, other.nHeapAllocationsAtSearch);
+
+    vNGamma.swap(other.vNGamma); vCandidateID.swap(other.vCandidateID);
+    vTrueCT.swap(other.vTrueCT); vCapVX.swap(other.vCapVX); vCapVY.swap(other.vCapVY); vCapVZ.swap(other.vCapVZ);
+    vTotGammaE.swap(other.vTotGammaE);
+
+    vSecPID.swap(other.vSecPID); vSecIntID.swap(other.vSecIntID);
+    vParentPID.swap(other.vParentPID); vCapID.swap(other.vCapID);
+    vSecVX.swap(other.vSecVX); vSecVY.swap(other.vSecVY); vSecVZ.swap(other.vSecVZ);
+    vSecPX.swap(other.vSecPX); vSecPY.swap(other.vSecPY); vSecPZ.swap(other.vSecPZ);
+    vSecDWall.swap(other.vSecDWall); vSecMom.swap(other.vSecMom); vSecT.swap(other.vSecT);
+
+    vNeutVecPID.swap(other.vNeutVecPID);
+    vVecPID.swap(other.vVecPID);
+    vVecPX.swap(other.vVecPX); vVecPY.swap(other.vVecPY); vVecPZ.swap(other.vVecPZ); vVecMom.swap(other.vVecMom);
+
+    vCandidates.swap(other.vCandidates);
+    for (auto& candidate: vCandidates)       candidate.currentEvent = this;
+    for (auto& candidate: other.vCandidates) candidate.currentEvent = &other;
+
+    SwapCandidateVectors<IVariable>(iCandidateVarMap, iCandidateVectors, other.iCandidateVarMap, other.iCandidateVectors);
+    SwapCandidateVectors<FVariable>(fCandidateVarMap, fCandidateVectors, other.fCandidateVarMap, other.fCandidateVectors);
+    candidateVariablesInitialized = other.candidateVariablesInitialized
+                                  = candidateVariablesInitialized || other.candidateVariablesInitialized;
 }
 
 void NTagEventInfo::SaveSecondary(int secID)
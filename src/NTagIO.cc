@@ -1,13 +1,21 @@
+#include <algorithm>
 #include <csignal>
 #include <cmath>
 
 #include <TFile.h>
+#include <TTree.h>
+#include <TBranch.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TThread.h>
+#include <RVersion.h>
 
 #include <skheadC.h>
 #include <skvectC.h>
 
 #include "NTagPath.hh"
 #include "NTagIO.hh"
+#include "NTagMemory.hh"
 #include "SKLibs.hh"
 
 NTagIO* NTagIO::instance;
@@ -20,8 +28,13 @@ NTagIO::NTagIO(const char* inFileName, const char* outFileName, Verbosity verbos
     bData = false;
     fVerbosity = verbose;
     candidateVariablesAdded = false;
+    fIsOtherJobSHEPending = false;
 
-    fSigTQFile = NULL; fSigTQTree = NULL;
+    fTagQueue = NULL; fDoneQueue = NULL;
+    fJobIndex = 0; fNJobs = 1; fIsJobRange = false;
+    fNSkipEntries = 0; fNEntries = -1;
+
+    fSigTQFile = NULL; fSigTQTree = NULL; fSigTQEntry = -1;
 
     outFile = new TFile(fOutFileName, "recreate");
 
@@ -52,6 +65,7 @@ void NTagIO::SKInitialize()
     const char* skoptn = "31,30,26,25,23"; skoptn_(skoptn, strlen(skoptn));
     msg.PrintBlock("Setting SK geometry...");
     skheadg_.sk_geometry = 5; geoset_();
+    NTagToFTable::SetPMTGeometry();
 
     // Initialize BONSAI
     msg.PrintBlock("Initializing ZBS...");
@@ -63,11 +77,25 @@ void NTagIO::SKInitialize()
 
 void NTagIO::ReadFile()
 {
+    bool usePipeline = GetNumberOfWorkers() > 0;
+
     if (bUseTMVA) {
-        TMVATools.InstantiateReader();
+        // Each event slot of the pipeline has its own reader
+        if (!usePipeline) TMVATools.InstantiateReader();
         TMVATools.DumpReaderCutRange();
     }
 
+    // Forked after bonsai_ini and before any thread is started
+    if (NBONSAIPROCS > 0 && !fBonsaiPool) {
+        msg.Print(Form("Starting %d BONSAI processes...", NBONSAIPROCS));
+        fBonsaiPool = new NTagBonsaiPool(NBONSAIPROCS, fVerbosity);
+    }
+
+    if (bUseNeutFit)
+        BuildGridToFTable();
+
+    if (usePipeline) StartPipeline();
+
     // SIGINT handler
     struct sigaction sigHandler;
     sigHandler.sa_handler = NTagIO::SIGINTHandler;
@@ -81,14 +109,94 @@ void NTagIO::ReadFile()
     bool bEOF = false;
     auto startTime = std::clock();
 
+    // Jobs of an input that can seek take contiguous parts of the event range, instead of blocks in turn
+    int nInputEntries = fNJobs > 1 ? GetNumberOfInputEntries() : -1;
+    if (nInputEntries >= 0) {
+        int nRangeEntries = std::max(nInputEntries - fNSkipEntries, 0);
+        if (fNEntries >= 0) nRangeEntries = std::min(nRangeEntries, fNEntries);
+        int jobStart = fNSkipEntries + (long)nRangeEntries * fJobIndex / fNJobs;
+        int jobEnd   = fNSkipEntries + (long)nRangeEntries * (fJobIndex + 1) / fNJobs;
+        SetEntryRange(jobStart, jobEnd - jobStart);
+        fIsJobRange = true;
+        msg.Print(Form("Job %d tags entries %d to %d", fJobIndex, jobStart, jobEnd - 1), pDEFAULT);
+    }
+
+    // Event range
+    bool isRangeEmpty = false;
+    int  nReadEntries = 0;
+    if (fNSkipEntries > 0) {
+        msg.Print(Form("Skipping %d entries...", fNSkipEntries), pDEFAULT);
+
+        // Read the last two skipped entries, so that TDiff of the first event is from the event before it:
+        // the previous entry, or the SHE of the previous entry if it is an AFT.
+        // (MC events with vertex in PMT are not counted, so two such entries leave TDiff of the first event 0.)
+        int nLookBack = std::min(fNSkipEntries, 2);
+        if (fNSkipEntries > nLookBack)
+            isRangeEmpty = !SkipEntries(fNSkipEntries - nLookBack);
+        for (int iEntry = 0; iEntry < nLookBack && !isRangeEmpty; iEntry++) {
+            if (skread_(&lun) != 0) {
+                msg.Print(Form("Input has no more than %d entries to skip!", fNSkipEntries), pWARNING);
+                isRangeEmpty = true;
+                break;
+            }
+            CheckMC();
+
+            if (bData && !bForceMC) {
+                if (!(skhead_.idtgsk & 1<<29)) SetTDiff();
+            }
+            else {
+                int inPMT;
+                skgetv_();
+                inpmt_(skvect_.pos, inPMT);
+                if (!inPMT) SetTDiff();
+            }
+        }
+        NTagBonsaiPool::SetHitsOverwritten();
+
+        // Count the skipped entries, so that the event index matches the input entry, e.g., in -sigTQpath
+        nProcessedEvents = fNSkipEntries;
+    }
+
     while (!bEOF) {
 
-        readStatus = skread_(&lun);
-        CheckMC();
+        // Keep the worker threads off Fortran while reading,
+        // letting those waiting since the last entry go first, as std::mutex is not fair
+        if (usePipeline) {
+            while (fNFortranWaiters > 0) std::this_thread::yield();
+            fFortranLock = std::unique_lock<std::mutex>(fFortranMutex);
+        }
+
+        // Past the range, read one more entry only if it can be the AFT of the last SHE
+        bool isPastRange = fNEntries >= 0 && nReadEntries >= fNEntries;
+        if (isRangeEmpty || (isPastRange && (!bData || bForceMC || !IsSHEPending())))
+            readStatus = 2;
+        else {
+            readStatus = skread_(&lun);
+            NTagBonsaiPool::SetHitsOverwritten();
+            CheckMC();
+            nReadEntries++;
+        }
+
+        bool isAFT = readStatus == 0 && bData && !bForceMC && (skhead_.idtgsk & 1<<29);
+
+        // Attach the AFT past the range to the last SHE, and stop
+        if (isPastRange && readStatus == 0) {
+            if (isAFT) {
+                msg.Print("Saving SHE+AFT at the end of the event range...", pDEBUG);
+                ReadEvent();
+            }
+            readStatus = 2;
+        }
 
         switch (readStatus) {
             case 0: // event read
 
+                // The AFT of an SHE before the range is tagged in the range with the SHE
+                if (isAFT && nReadEntries == 1 && fNSkipEntries > 0) {
+                    msg.Print("Skipping AFT of an SHE before the event range...", pDEBUG);
+                    break;
+                }
+
                 // If MC
                 if (!bData) {
                     std::cout << "\n\n" << std::endl;
@@ -118,29 +226,41 @@ void NTagIO::ReadFile()
 
             case 2: // end of input 
 				// If the last event was SHE, fill output.
- 		   		if (bData && !bForceMC && !IsRawHitVectorEmpty()) {
+ 		   		if (bData && !bForceMC && IsSHEPending()) {
 					msg.Print("Saving SHE without AFT...", pDEBUG);
-					SetToFSubtractedTQ();
-
-    	    		// Tagging starts here!
-        			SearchCaptureCandidates();
-        			SetCandidateVariables();
-
-        			FillTrees();
+					TagEvent();
 
 	        		// DONT'T FORGET TO CLEAR!
     	    		Clear();
     			}
+                if (usePipeline) StopPipeline();
         		std::cout << "\n\n" << std::endl;
-                msg.Print(Form("Reached the end of input. Closing file..."), pDEFAULT);
+                msg.Print(isPastRange ? "Reached the end of the event range. Closing file..."
+                                      : "Reached the end of input. Closing file...", pDEFAULT);
                 CloseFile();
                 bEOF = true;
 
-                msg.Print(Form("Number of saved events: %d", nProcessedEvents), pDEFAULT);
+                msg.Print(Form("Number of saved events: %lld", ntvarTree->GetEntries()), pDEFAULT);
+                // The jobs of an input file are summed in TagSKFileInJobs
+                if (bUseCascade && fNJobs == 1) PrintCascadeSummary();
                 msg.Timer("Reading this file", startTime, pDEFAULT);
                 break;
         }
+
+        if (fFortranLock.owns_lock()) fFortranLock.unlock();
+    }
+}
+
+bool NTagIO::SkipEntries(int nSkip)
+{
+    // ZBS has no index, so read through the skipped records without processing them
+    for (int iEntry = 0; iEntry < nSkip; iEntry++) {
+        if (skread_(&lun) == 2) {
+            msg.Print(Form("Input has only %d entries, not more than %d to skip!", iEntry, nSkip), pWARNING);
+            return false;
+        }
     }
+    return true;
 }
 
 void NTagIO::ReadEvent()
@@ -157,23 +277,23 @@ void NTagIO::ReadMCEvent()
     // Prompt-peak info
     trgType = skhead_.idtgsk;
     SetTDiff();
-    SetEventHeader();
-    SetPromptVertex();
-    SetFitInfo();
 
-    // MC-only truth info
-    SetMCInfo();
+    // Events of the other jobs are only counted, after taking the trigger time for TDiff
+    if (IsEventOfThisJob()) {
+        SetEventHeader();
+        SetPromptVertex();
+        SetFitInfo();
 
-    // Hit info (all hits)
-    AppendRawHitInfo();
-    SetToFSubtractedTQ();
+        // MC-only truth info
+        SetMCInfo();
 
-    // Tagging starts here!
-    SearchCaptureCandidates();
-    SetCandidateVariables();
+        // Hit info (all hits)
+        AppendRawHitInfo();
+    }
 
+    // Tagging starts here!
     // DONT'T FORGET TO FILL!
-    FillTrees();
+    TagEvent();
 }
 
 void NTagIO::ReadDataEvent()
@@ -186,15 +306,9 @@ void NTagIO::ReadDataEvent()
 
     // If previous event was SHE without following AFT,
     // just fill output because there's nothing to append.
-    else if (!IsRawHitVectorEmpty()) {
+    else if (IsSHEPending()) {
         msg.Print("Saving SHE without AFT...", pDEBUG);
-        SetToFSubtractedTQ();
-
-        // Tagging starts here!
-        SearchCaptureCandidates();
-        SetCandidateVariables();
-
-        FillTrees();
+        TagEvent();
 
         // DONT'T FORGET TO CLEAR!
         Clear();
@@ -230,6 +344,12 @@ void NTagIO::ReadSHEEvent()
     Clear();
     trgType = 1;
 
+    // SHE of the other jobs: only counted with its AFT, after taking the trigger time for TDiff
+    if (!IsEventOfThisJob()) {
+        fIsOtherJobSHEPending = true;
+        return;
+    }
+
     // Prompt-peak info
     SetEventHeader();
     SetPromptVertex();
@@ -245,22 +365,21 @@ void NTagIO::ReadnoSHEEvent()
     Clear();
     trgType = 3;
 
-    // Prompt-peak info
-    SetEventHeader();
-    SetPromptVertex();
-    SetFitInfo();
+    // Events of the other jobs are only counted, after taking the trigger time for TDiff
+    if (IsEventOfThisJob()) {
+        // Prompt-peak info
+        SetEventHeader();
+        SetPromptVertex();
+        SetFitInfo();
 
-    // Hit info (HE: close-to-prompt hits only)
-    AppendRawHitInfo();
-	SetToFSubtractedTQ();
+        // Hit info (HE: close-to-prompt hits only)
+        AppendRawHitInfo();
+    }
     SetTDiff();
 
     // Tagging starts here!
-    SearchCaptureCandidates();
-    SetCandidateVariables();
-
     // DONT'T FORGET TO FILL!
-    FillTrees();
+    TagEvent();
 
     // DONT'T FORGET TO CLEAR!
     Clear();
@@ -271,20 +390,33 @@ void NTagIO::ReadAFTEvent()
     trgType = 2;
 
     // Append hit info (AFT: delayed hits after prompt)
-    AppendRawHitInfo();
-    SetToFSubtractedTQ();
+    if (IsEventOfThisJob()) AppendRawHitInfo();
 
     // Tagging starts here!
-    SearchCaptureCandidates();
-    SetCandidateVariables();
-
     // DONT'T FORGET TO FILL!
-    FillTrees();
+    TagEvent();
 
     // DONT'T FORGET TO CLEAR!
     Clear();
 }
 
+void NTagIO::TagEvent()
+{
+    // Events of the other jobs are counted but not tagged
+    fIsOtherJobSHEPending = false;
+    if (!IsEventOfThisJob()) {
+        nProcessedEvents++;
+        return;
+    }
+
+    if (GetNumberOfWorkers() > 0)
+        SubmitEvent();
+    else {
+        ProcessHits();
+        FillTrees();
+    }
+}
+
 void NTagIO::WriteOutput()
 {
     outFile->cd();
@@ -425,6 +557,13 @@ void NTagIO::CreateBranchesToResTQTree()
 
 void NTagIO::FillTrees()
 {
+#ifdef NTAG_COUNT_ALLOCATIONS
+    unsigned long nHeapAllocations = GetNHeapAllocations();
+    msg.Print(Form("Heap allocations: %lu in this event, %lu in candidate search",
+                   nHeapAllocations - nHeapAllocationsAtClear,
+                   nHeapAllocations - nHeapAllocationsAtSearch), pDEBUG);
+#endif
+
     DumpEventVariables();
     if (fVerbosity > pDEFAULT) DumpCandidateVariables();
 
@@ -440,12 +579,233 @@ void NTagIO::FillTrees()
     nProcessedEvents++;
 }
 
+void NTagIO::StartPipeline()
+{
+    int nWorkers = GetNumberOfWorkers();
+    int nSlots = 2 * nWorkers;
+    msg.Print(Form("Tagging events with %d worker threads...", nWorkers), pDEFAULT);
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+
+    for (int iSlot = 0; iSlot < nSlots; iSlot++) {
+        NTagEventInfo* slot = new NTagEventInfo(fVerbosity);
+        slot->CopySettings(*this);
+        slot->fBonsaiPool = fBonsaiPool;
+        if (bUseTMVA) slot->TMVATools.InstantiateReader();
+        slot->Clear();
+        fEventSlots.push_back(slot);
+        fFreeSlots.push_back(slot);
+    }
+
+    // At most one entry per slot, so that they are not reallocated
+    fTaggedSlots.reserve(nSlots);
+    fSubmittedEvents.reserve(nSlots);
+
+    fTagQueue  = new NTagQueue<NTagEventInfo*>(nSlots);
+    fDoneQueue = new NTagQueue<NTagEventInfo*>(nSlots);
+
+    for (int iWorker = 0; iWorker < nWorkers; iWorker++)
+        fWorkers.emplace_back(&NTagIO::RunWorker, this);
+}
+
+void NTagIO::StopPipeline()
+{
+    WriteTaggedEvents(0);
+
+    for (unsigned int iWorker = 0; iWorker < fWorkers.size(); iWorker++)
+        fTagQueue->Push(nullptr);
+    for (auto& worker: fWorkers)
+        worker.join();
+    fWorkers.clear();
+
+    for (auto& slot: fEventSlots) {
+        fCascadeStats += slot->fCascadeStats;
+        slot->fBonsaiPool = nullptr; // owned by this instance
+        delete slot;
+    }
+    fEventSlots.clear(); fFreeSlots.clear();
+
+    delete fTagQueue;  fTagQueue = NULL;
+    delete fDoneQueue; fDoneQueue = NULL;
+}
+
+void NTagIO::SubmitEvent()
+{
+    // Free a slot
+    WriteTaggedEvents(fEventSlots.size() - 1);
+
+    NTagEventInfo* slot = fFreeSlots.back();
+    fFreeSlots.pop_back();
+
+    // The slot is cleared, so this instance is left cleared
+    slot->bData = bData;
+    slot->SaveRunState();
+    slot->SwapEventState(*this);
+    slot->nProcessedEvents = nProcessedEvents++;
+    fSubmittedEvents.push_back(slot->nProcessedEvents);
+
+    fTagQueue->Push(slot);
+}
+
+void NTagIO::WriteTaggedEvents(int maxInFlight)
+{
+    // Let the worker threads call Fortran while writing and waiting
+    bool wasLocked = fFortranLock.owns_lock();
+    if (wasLocked) fFortranLock.unlock();
+
+    int nTries = 0;
+    while ((int)fSubmittedEvents.size() > maxInFlight) {
+        NTagEventInfo* slot;
+        while (fDoneQueue->TryPop(slot))
+            fTaggedSlots.push_back(slot);
+
+        // Write in the input order
+        int nextEvent = fSubmittedEvents.front();
+        auto it = std::find_if(fTaggedSlots.begin(), fTaggedSlots.end(),
+                               [nextEvent](NTagEventInfo* s) { return s->nProcessedEvents == nextEvent; });
+        if (it != fTaggedSlots.end()) {
+            slot = *it;
+            fTaggedSlots.erase(it);
+            fSubmittedEvents.erase(fSubmittedEvents.begin());
+            WriteEvent(slot);
+            nTries = 0;
+        }
+        else
+            NTagQueue<NTagEventInfo*>::Wait(nTries++);
+    }
+
+    if (wasLocked) fFortranLock.lock();
+}
+
+void NTagIO::WriteEvent(NTagEventInfo* slot)
+{
+    // The event state of this instance may hold an event being read, e.g., SHE waiting for AFT
+    int nSubmittedEvents = nProcessedEvents;
+    bool isReadEventData = bData;
+
+    nProcessedEvents = slot->nProcessedEvents;
+    bData = slot->bData;
+    SwapEventState(*slot);
+
+    FillTrees();
+
+    SwapEventState(*slot);
+    nProcessedEvents = nSubmittedEvents;
+    bData = isReadEventData;
+
+    slot->Clear();
+    fFreeSlots.push_back(slot);
+}
+
+void NTagIO::RunWorker()
+{
+    NTagEventInfo* slot;
+
+    while (true) {
+        fTagQueue->Pop(slot);
+        if (!slot) return;
+
+        slot->ProcessHits();
+        fDoneQueue->Push(slot);
+    }
+}
+
+void NTagIO::MergeJobOutputs(const char* outFileName, const std::vector<std::string>& jobFileNames,
+                             bool areJobsInterleaved)
+{
+    NTagMessage msg("IO");
+    int nJobs = jobFileNames.size();
+
+    std::vector<TFile*> jobFiles;
+    for (auto const& jobFileName: jobFileNames) {
+        TFile* jobFile = TFile::Open(jobFileName.c_str());
+        if (!jobFile || jobFile->IsZombie())
+            msg.Print(Form("Cannot open job output %s!", jobFileName.c_str()), pERROR);
+        jobFiles.push_back(jobFile);
+    }
+
+    TFile* outFile = new TFile(outFileName, "recreate");
+
+    for (const char* treeName: {"ntvar", "truth", "restq"}) {
+
+        // Candidate variable branches exist only in the jobs that found a candidate,
+        // so take the branches from the job with the most
+        std::vector<TTree*> jobTrees;
+        TTree* templateTree = 0;
+        for (auto& jobFile: jobFiles) {
+            TTree* jobTree = (TTree*)jobFile->Get(treeName);
+            jobTrees.push_back(jobTree);
+            if (jobTree && (!templateTree || jobTree->GetListOfBranches()->GetEntries()
+                                             > templateTree->GetListOfBranches()->GetEntries()))
+                templateTree = jobTree;
+        }
+        if (!templateTree) continue;
+
+        outFile->cd();
+        TTree* outTree = templateTree->CloneTree(0);
+        TObjArray* outBranches = outTree->GetListOfBranches();
+
+        std::vector<int>   emptyInts;   std::vector<int>*   emptyIntsPtr   = &emptyInts;
+        std::vector<float> emptyFloats; std::vector<float>* emptyFloatsPtr = &emptyFloats;
+
+        // Job i has the blocks i, i + nJobs, i + 2*nJobs, ... of JOBBLOCKSIZE events if interleaved,
+        // and the i-th part of the events otherwise
+        std::vector<Long64_t> nextEntry(nJobs, 0);
+        bool isMerged = false;
+
+        while (!isMerged) {
+            isMerged = true;
+
+            for (int iJob = 0; iJob < nJobs; iJob++) {
+                TTree* jobTree = jobTrees[iJob];
+                if (!jobTree || nextEntry[iJob] >= jobTree->GetEntries()) continue;
+                isMerged = false;
+
+                // Read the job's entries into the output branches,
+                // and fill the candidate variables the job doesn't have with empty vectors
+                jobTree->CopyAddresses(outTree);
+                for (int iBranch = 0; iBranch < outBranches->GetEntries(); iBranch++) {
+                    TBranch* branch = (TBranch*)outBranches->At(iBranch);
+                    if (jobTree->GetBranch(branch->GetName())) continue;
+
+                    std::string className = branch->GetClassName();
+                    if (className == "vector<int>")
+                        outTree->SetBranchAddress(branch->GetName(), &emptyIntsPtr);
+                    else if (className == "vector<float>")
+                        outTree->SetBranchAddress(branch->GetName(), &emptyFloatsPtr);
+                }
+
+                Long64_t lastEntry = areJobsInterleaved ? std::min(nextEntry[iJob] + JOBBLOCKSIZE, jobTree->GetEntries())
+                                                        : jobTree->GetEntries();
+                for (; nextEntry[iJob] < lastEntry; nextEntry[iJob]++) {
+                    jobTree->GetEntry(nextEntry[iJob]);
+                    outTree->Fill();
+                }
+            }
+        }
+
+        msg.Print(Form("Merged %lld entries of tree %s from %d jobs", outTree->GetEntries(), treeName, nJobs), pDEFAULT);
+        outTree->Write();
+    }
+
+    outFile->Close();
+    delete outFile;
+    for (auto& jobFile: jobFiles) {
+        jobFile->Close();
+        delete jobFile;
+    }
+}
+
 void NTagIO::SetSignalTQ(const char* fSigTQName)
 {
     fSigTQFile = TFile::Open(fSigTQName);
     fSigTQTree = (TTree*)fSigTQFile->Get("rawtq");
 
-    vSIGT = 0; vSIGI = 0;
+    vSIGT = 0; vSIGI = 0; fSigTQEntry = -1;
     fSigTQTree->SetBranchAddress("T", &vSIGT);
     fSigTQTree->SetBranchAddress("I", &vSIGI);
 }
@@ -5,6 +5,7 @@
 #include <iterator>
 
 #include <TFile.h>
+#include <TTree.h>
 
 #include <skroot.h>
 #undef MAXHWSK
@@ -36,6 +37,31 @@ void NTagROOT::CloseFile()
     skroot_end_();
 }
 
+bool NTagROOT::SkipEntries(int nSkip)
+{
+    // The next skread reads the entry after the one jumped to
+    int entry = nSkip - 1;
+    int readError = 0;
+    skroot_jump_to_entry_(&lun, &entry, &readError);
+
+    if (readError) {
+        msg.Print(Form("Cannot skip to entry %d!", nSkip), pWARNING);
+        return false;
+    }
+    return true;
+}
+
+int NTagROOT::GetNumberOfInputEntries()
+{
+    // The SKROOT tree "data", opened apart from skroot to count its entries
+    TFile inFile(fInFileName);
+    TTree* dataTree = inFile.IsZombie() ? nullptr : (TTree*)inFile.Get("data");
+    if (!dataTree)
+        msg.Print(Form("Cannot count the entries of %s!", fInFileName), pERROR);
+
+    return dataTree->GetEntries();
+}
+
 void NTagROOT::ReadSecondaries()
 {
     int lun = 10;
@@ -16,6 +16,15 @@ NTagTMVAVariables::~NTagTMVAVariables() {}
 
 void NTagTMVAVariables::Clear()
 {
+    // Once the variables are declared, reset them without looking up the keys
+    if (!fVariableMap.empty()) {
+        for (auto& pair: iVariableMap) pair.second = 0;
+        for (auto& pair: fVariableMap) pair.second = 0.;
+        for (auto& pair: iEventVectorMap) pair.second->clear();
+        for (auto& pair: fEventVectorMap) pair.second->clear();
+        return;
+    }
+
     iVariableMap["NHits"] = 0;
     iVariableMap["N200"] = 0;
 
@@ -0,0 +1,85 @@
+#include <ctime>
+
+#include <pthread.h>
+
+#include "NTagThreadPool.hh"
+
+NTagThreadPool::NTagThreadPool(int nThreads)
+: fNTasks(0), fNextTask(0), fNDoneTasks(0), fStop(false)
+{
+    for (int iThread = 0; iThread < nThreads; iThread++)
+        fThreads.emplace_back(&NTagThreadPool::RunThread, this);
+}
+
+NTagThreadPool::~NTagThreadPool()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStop = true;
+    }
+    fTaskReady.notify_all();
+
+    for (auto& thread: fThreads)
+        thread.join();
+}
+
+void NTagThreadPool::Start(int nTasks, std::function<void(int)> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fTask = task;
+        fNTasks = nTasks;
+        fNextTask = 0;
+        fNDoneTasks = 0;
+        fIsTaskDone.assign(nTasks, 0);
+    }
+    fTaskReady.notify_all();
+}
+
+void NTagThreadPool::WaitForTask(int iTask)
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    fTaskDone.wait(lock, [this, iTask] { return fIsTaskDone[iTask] != 0; });
+}
+
+void NTagThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    fTaskDone.wait(lock, [this] { return fNDoneTasks == fNTasks; });
+}
+
+double NTagThreadPool::GetCPUTime()
+{
+    double cpuTime = 0;
+    for (auto& thread: fThreads) {
+        clockid_t clockID;
+        timespec threadTime;
+        if (pthread_getcpuclockid(thread.native_handle(), &clockID) == 0 && clock_gettime(clockID, &threadTime) == 0)
+            cpuTime += threadTime.tv_sec + threadTime.tv_nsec * 1.e-9;
+    }
+    return cpuTime;
+}
+
+void NTagThreadPool::RunThread()
+{
+    while (true) {
+        int iTask;
+        {
+            std::unique_lock<std::mutex> lock(fMutex);
+            fTaskReady.wait(lock, [this] { return fStop || fNextTask < fNTasks; });
+            if (fStop) return;
+            iTask = fNextTask++;
+        }
+
+        // fTask is not reassigned until all tasks have returned
+        fTask(iTask);
+
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fIsTaskDone[iTask] = 1;
+            fNDoneTasks++;
+        }
+        fTaskDone.notify_all();
+    }
+}
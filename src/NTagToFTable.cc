@@ -0,0 +1,316 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <cmath>
+#include <map>
+
+#include <geotnkC.h>
+
+#include "NTagCalculator.hh"
+#include "NTagEventInfo.hh"
+#include "NTagToFTable.hh"
+
+// Number of PMTs padded to a multiple of the SIMD width
+static constexpr int NPMTPADDED = (MAXPM + 7) / 8 * 8;
+
+// PMT coordinates in structure-of-arrays [cm]
+alignas(32) static float pmtX[NPMTPADDED];
+alignas(32) static float pmtY[NPMTPADDED];
+alignas(32) static float pmtZ[NPMTPADDED];
+
+NTagToFTable::NTagToFTable()
+: fToF(NPMTPADDED, 0.) {}
+NTagToFTable::~NTagToFTable() {}
+
+void NTagToFTable::SetPMTGeometry()
+{
+    for (int iPMT = 0; iPMT < MAXPM; iPMT++) {
+        pmtX[iPMT] = NTagConstant::PMTXYZ[iPMT][0];
+        pmtY[iPMT] = NTagConstant::PMTXYZ[iPMT][1];
+        pmtZ[iPMT] = NTagConstant::PMTXYZ[iPMT][2];
+    }
+}
+
+void NTagToFTable::SetVertex(const float vertex[3])
+{
+    int iPMT = 0;
+    float* tof = fToF.data();
+
+    // Same operations in the same order as GetDistance / C_WATER
+#ifdef __AVX2__
+    const __m256 vx = _mm256_set1_ps(vertex[0]);
+    const __m256 vy = _mm256_set1_ps(vertex[1]);
+    const __m256 vz = _mm256_set1_ps(vertex[2]);
+    const __m256 c  = _mm256_set1_ps(NTagConstant::C_WATER);
+
+    for (; iPMT < NPMTPADDED; iPMT += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(pmtX + iPMT), vx);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(pmtY + iPMT), vy);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(pmtZ + iPMT), vz);
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                  _mm256_mul_ps(dz, dz));
+        _mm256_storeu_ps(tof + iPMT, _mm256_div_ps(_mm256_sqrt_ps(d2), c));
+    }
+#endif
+
+    for (; iPMT < NPMTPADDED; iPMT++) {
+        float dx = pmtX[iPMT] - vertex[0];
+        float dy = pmtY[iPMT] - vertex[1];
+        float dz = pmtZ[iPMT] - vertex[2];
+        tof[iPMT] = std::sqrt(dx*dx + dy*dy + dz*dz) / NTagConstant::C_WATER;
+    }
+}
+
+void NTagToFTable::SubtractToF(const float* T, const int* cableID, int nHits, float* t_ToF) const
+{
+    int iHit = 0;
+    const float* tof = fToF.data();
+
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi32(1);
+
+    for (; iHit + 8 <= nHits; iHit += 8) {
+        __m256i pmtID = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(cableID + iHit)), one);
+        __m256  hitToF = _mm256_i32gather_ps(tof, pmtID, 4);
+        _mm256_storeu_ps(t_ToF + iHit, _mm256_sub_ps(_mm256_loadu_ps(T + iHit), hitToF));
+    }
+#endif
+
+    for (; iHit < nHits; iHit++)
+        t_ToF[iHit] = T[iHit] - tof[cableID[iHit]-1];
+}
+
+void NTagToFTable::SubtractToF(const float* T, const int* cableID, int nHits,
+                               const float vertex[3], float* t_ToF)
+{
+    int iHit = 0;
+
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 vx = _mm256_set1_ps(vertex[0]);
+    const __m256 vy = _mm256_set1_ps(vertex[1]);
+    const __m256 vz = _mm256_set1_ps(vertex[2]);
+    const __m256 c  = _mm256_set1_ps(NTagConstant::C_WATER);
+
+    for (; iHit + 8 <= nHits; iHit += 8) {
+        __m256i pmtID = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(cableID + iHit)), one);
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(pmtX, pmtID, 4), vx);
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(pmtY, pmtID, 4), vy);
+        __m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(pmtZ, pmtID, 4), vz);
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                  _mm256_mul_ps(dz, dz));
+        __m256 hitToF = _mm256_div_ps(_mm256_sqrt_ps(d2), c);
+        _mm256_storeu_ps(t_ToF + iHit, _mm256_sub_ps(_mm256_loadu_ps(T + iHit), hitToF));
+    }
+#endif
+
+    for (; iHit < nHits; iHit++) {
+        int pmtID = cableID[iHit] - 1;
+        float dx = pmtX[pmtID] - vertex[0];
+        float dy = pmtY[pmtID] - vertex[1];
+        float dz = pmtZ[pmtID] - vertex[2];
+        t_ToF[iHit] = T[iHit] - std::sqrt(dx*dx + dy*dy + dz*dz) / NTagConstant::C_WATER;
+    }
+}
+
+float NTagToFTable::GetTRMS(const float* T, const int* cableID, int nHits, const float vertex[3])
+{
+    if (nHits == 0) return 0.;
+
+    double mean = 0., m2 = 0.;
+    float t_ToF[8];
+
+    for (int iHit = 0; iHit < nHits; iHit += 8) {
+        int nChunk = nHits - iHit < 8 ? nHits - iHit : 8;
+        SubtractToF(T + iHit, cableID + iHit, nChunk, vertex, t_ToF);
+
+        // Welford's online update
+        for (int j = 0; j < nChunk; j++) {
+            double delta = t_ToF[j] - mean;
+            mean += delta / (iHit + j + 1);
+            m2 += delta * (t_ToF[j] - mean);
+        }
+    }
+
+    return std::sqrt(m2 / (nHits - 1));
+}
+
+void NTagToFTable::GetTRMS(const float* T, const int* cableID, int nHits,
+                           const float* vertices, int nVertices, float* tRMS)
+{
+    for (int iVertex = 0; iVertex < nVertices; iVertex += 8) {
+        int nBatch = nVertices - iVertex < 8 ? nVertices - iVertex : 8;
+
+        // Vertex coordinates of the batch, padded with the last vertex
+        alignas(32) float vx[8], vy[8], vz[8];
+        for (int j = 0; j < 8; j++) {
+            const float* vertex = vertices + 3 * (iVertex + (j < nBatch ? j : nBatch - 1));
+            vx[j] = vertex[0]; vy[j] = vertex[1]; vz[j] = vertex[2];
+        }
+
+        alignas(32) double mean[8] = {0.}, m2[8] = {0.};
+
+        // Same operations in the same order as the single-vertex kernel, one vertex per lane
+#ifdef __AVX2__
+        const __m256 x = _mm256_load_ps(vx);
+        const __m256 y = _mm256_load_ps(vy);
+        const __m256 z = _mm256_load_ps(vz);
+        const __m256 c = _mm256_set1_ps(NTagConstant::C_WATER);
+        __m256d meanLo = _mm256_setzero_pd(), meanHi = _mm256_setzero_pd();
+        __m256d m2Lo   = _mm256_setzero_pd(), m2Hi   = _mm256_setzero_pd();
+
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            int pmtID = cableID[iHit] - 1;
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(pmtX[pmtID]), x);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(pmtY[pmtID]), y);
+            __m256 dz = _mm256_sub_ps(_mm256_set1_ps(pmtZ[pmtID]), z);
+            __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                      _mm256_mul_ps(dz, dz));
+            __m256 t_ToF = _mm256_sub_ps(_mm256_set1_ps(T[iHit]), _mm256_div_ps(_mm256_sqrt_ps(d2), c));
+
+            // Welford's online update in double, 4 lanes at a time
+            __m256d n = _mm256_set1_pd(iHit + 1);
+            __m256d tLo = _mm256_cvtps_pd(_mm256_castps256_ps128(t_ToF));
+            __m256d tHi = _mm256_cvtps_pd(_mm256_extractf128_ps(t_ToF, 1));
+            __m256d deltaLo = _mm256_sub_pd(tLo, meanLo);
+            __m256d deltaHi = _mm256_sub_pd(tHi, meanHi);
+            meanLo = _mm256_add_pd(meanLo, _mm256_div_pd(deltaLo, n));
+            meanHi = _mm256_add_pd(meanHi, _mm256_div_pd(deltaHi, n));
+            m2Lo = _mm256_add_pd(m2Lo, _mm256_mul_pd(deltaLo, _mm256_sub_pd(tLo, meanLo)));
+            m2Hi = _mm256_add_pd(m2Hi, _mm256_mul_pd(deltaHi, _mm256_sub_pd(tHi, meanHi)));
+        }
+        _mm256_store_pd(m2, m2Lo);
+        _mm256_store_pd(m2 + 4, m2Hi);
+#else
+        for (int iHit = 0; iHit < nHits; iHit++) {
+            int pmtID = cableID[iHit] - 1;
+            for (int j = 0; j < 8; j++) {
+                float dx = pmtX[pmtID] - vx[j];
+                float dy = pmtY[pmtID] - vy[j];
+                float dz = pmtZ[pmtID] - vz[j];
+                float t_ToF = T[iHit] - std::sqrt(dx*dx + dy*dy + dz*dz) / NTagConstant::C_WATER;
+
+                // Welford's online update
+                double delta = t_ToF - mean[j];
+                mean[j] += delta / (iHit + 1);
+                m2[j] += delta * (t_ToF - mean[j]);
+            }
+        }
+#endif
+
+        for (int j = 0; j < nBatch; j++)
+            tRMS[iVertex + j] = nHits ? std::sqrt(m2[j] / (nHits - 1)) : 0.;
+    }
+}
+
+float NTagToFTable::GetTRMS(const float* T, const int* cableID, int nHits) const
+{
+    if (nHits == 0) return 0.;
+
+    double mean = 0., m2 = 0.;
+    float t_ToF[8];
+
+    for (int iHit = 0; iHit < nHits; iHit += 8) {
+        int nChunk = nHits - iHit < 8 ? nHits - iHit : 8;
+        SubtractToF(T + iHit, cableID + iHit, nChunk, t_ToF);
+
+        // Welford's online update
+        for (int j = 0; j < nChunk; j++) {
+            double delta = t_ToF[j] - mean;
+            mean += delta / (iHit + j + 1);
+            m2 += delta * (t_ToF[j] - mean);
+        }
+    }
+
+    return std::sqrt(m2 / (nHits - 1));
+}
+
+float NTagToFTable::GetTableSizeInMB()
+{
+    return NPMTPADDED * sizeof(float) / (1024. * 1024.);
+}
+
+NTagGridToFTable::NTagGridToFTable()
+: fNLevels(0), fNGridsInR(0), fNGridsInZ(0) {}
+NTagGridToFTable::~NTagGridToFTable() {}
+
+int NTagGridToFTable::Build(float maxSearchRange, float minGridWidth, int nLevels, float maxMemory)
+{
+    fNLevels = 0;
+    fNRowsBeforeLevel.clear();
+    fPointIndex.clear();
+    fTables.clear();
+
+    // Same grid as NTagCandidate::MinimizeTRMS
+    float gridWidth;
+    (maxSearchRange > 200) ? gridWidth = 500 : gridWidth = maxSearchRange / 2.;
+    fNGridsInZ = (int)(2*ZPINTK / gridWidth);
+    fNGridsInR = (int)(2*RINTK / gridWidth);
+    int nCells = fNGridsInR * fNGridsInR * fNGridsInZ;
+
+    std::vector<std::array<float, 3>> points;
+    std::map<std::array<float, 3>, int> rowOfPoint;
+    int maxRows = (int)(maxMemory / NTagToFTable::GetTableSizeInMB());
+
+    for (int level = 0; level < nLevels && gridWidth > minGridWidth; level++) {
+
+        int nRowsBefore = points.size();
+        int nOrigins = (level > 0) ? nRowsBefore : 1;
+        std::vector<int> pointIndex(nOrigins * nCells, -1);
+
+        for (int iOrigin = 0; iOrigin < nOrigins; iOrigin++) {
+            std::array<float, 3> gridOrigin = {0., 0., 0.};
+            if (level > 0) gridOrigin = points[iOrigin];
+            std::array<float, 3> gridPoint;
+
+            for (int iGridX = 0; iGridX < fNGridsInR; iGridX++) {
+                gridPoint[0] = gridOrigin[0] + (iGridX - fNGridsInR/2.) * gridWidth;
+
+                for (int iGridY = 0; iGridY < fNGridsInR; iGridY++) {
+                    gridPoint[1] = gridOrigin[1] + (iGridY - fNGridsInR/2.) * gridWidth;
+
+                    if (sqrt(gridPoint[0]*gridPoint[0] + gridPoint[1]*gridPoint[1]) > RINTK) continue;
+
+                    for (int iGridZ = 0; iGridZ < fNGridsInZ; iGridZ++) {
+                        gridPoint[2] = gridOrigin[2] + (iGridZ - fNGridsInZ/2.) * gridWidth;
+
+                        if (gridPoint[2] > ZPINTK || gridPoint[2] < -ZPINTK) continue;
+                        if (GetDistance(gridOrigin.data(), gridPoint.data()) > maxSearchRange) continue;
+
+                        // Grid points shared by different origins share a row
+                        auto found = rowOfPoint.find(gridPoint);
+                        int row;
+                        if (found != rowOfPoint.end())
+                            row = found->second;
+                        else {
+                            row = points.size();
+                            rowOfPoint[gridPoint] = row;
+                            points.push_back(gridPoint);
+                        }
+                        pointIndex[((iOrigin*fNGridsInR + iGridX)*fNGridsInR + iGridY)*fNGridsInZ + iGridZ] = row;
+                    }
+                }
+            }
+        }
+
+        // Stop before this level if the memory limit is reached
+        if ((int)points.size() > maxRows) {
+            points.resize(nRowsBefore);
+            break;
+        }
+
+        fNRowsBeforeLevel.push_back(nRowsBefore);
+        fPointIndex.push_back(pointIndex);
+        fNLevels++;
+        gridWidth = gridWidth / 2.;
+    }
+
+    // Fill ToF tables
+    fTables.resize(points.size());
+    for (unsigned int row = 0; row < points.size(); row++)
+        fTables[row].SetVertex(points[row].data());
+
+    return fNLevels;
+}